@@ -0,0 +1,167 @@
+/*
+ * acpi.c - ACPI table discovery
+ *
+ * Tables are read in place through the identity map. They are parsed once
+ * at boot, before the frame allocator can hand out the pages they sit in.
+ */
+
+#include "acpi.h"
+
+#include "string.h"
+
+/* BIOS data area word holding the EBDA segment */
+#define BDA_EBDA_SEG        0x40E
+
+#define MADT_TYPE_LAPIC     0
+#define MADT_TYPE_IOAPIC    1
+#define MADT_TYPE_ISO       2   /* Interrupt source override */
+#define MADT_LAPIC_ENABLED  0x1
+
+#define ISA_IRQS            16
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_t;
+
+typedef struct {
+    acpi_sdt_t header;
+    uint32_t lapic_addr;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+static uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+static uint32_t cpu_count;
+
+static acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_count;
+
+/* Where each ISA IRQ enters the I/O APICs, and its MPS INTI flags */
+static uint32_t isa_gsi[ISA_IRQS];
+static uint16_t isa_flags[ISA_IRQS];
+
+static int checksum_ok(const void *p, uint32_t len) {
+    const uint8_t *b = (const uint8_t *)p;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        sum = (uint8_t)(sum + b[i]);
+    }
+    return sum == 0;
+}
+
+/* The RSDP sits on a 16-byte boundary in [start, end) */
+static const acpi_rsdp_t *rsdp_scan(uint32_t start, uint32_t end) {
+    for (uint32_t a = start; a + sizeof(acpi_rsdp_t) <= end; a += 16) {
+        const acpi_rsdp_t *r = (const acpi_rsdp_t *)a;
+        if (memcmp(r->signature, "RSD PTR ", 8) == 0 && checksum_ok(r, sizeof(*r))) {
+            return r;
+        }
+    }
+    return 0;
+}
+
+static const acpi_rsdp_t *rsdp_find(void) {
+    /* First KiB of the EBDA, then the BIOS ROM area */
+    uint16_t seg;
+    memcpy(&seg, (const void *)BDA_EBDA_SEG, sizeof(seg));
+    uint32_t ebda = (uint32_t)seg << 4;
+    const acpi_rsdp_t *r = 0;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        r = rsdp_scan(ebda, ebda + 1024);
+    }
+    return r ? r : rsdp_scan(0xE0000, 0x100000);
+}
+
+static void madt_parse(const acpi_madt_t *madt) {
+    const uint8_t *p = (const uint8_t *)(madt + 1);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        if (p[0] == MADT_TYPE_LAPIC && p[1] >= 8) {
+            uint32_t flags;
+            memcpy(&flags, p + 4, sizeof(flags));
+            if ((flags & MADT_LAPIC_ENABLED) && cpu_count < ACPI_MAX_CPUS) {
+                cpu_apic_ids[cpu_count++] = p[3];
+            }
+        } else if (p[0] == MADT_TYPE_IOAPIC && p[1] >= 12 && ioapic_count < ACPI_MAX_IOAPICS) {
+            acpi_ioapic_t *io = &ioapics[ioapic_count++];
+            io->id = p[2];
+            memcpy(&io->addr, p + 4, sizeof(io->addr));
+            memcpy(&io->gsi_base, p + 8, sizeof(io->gsi_base));
+        } else if (p[0] == MADT_TYPE_ISO && p[1] >= 10 && p[2] == 0 && p[3] < ISA_IRQS) {
+            memcpy(&isa_gsi[p[3]], p + 4, sizeof(isa_gsi[0]));
+            memcpy(&isa_flags[p[3]], p + 8, sizeof(isa_flags[0]));
+        }
+        p += p[1];
+    }
+}
+
+int acpi_init(void) {
+    cpu_count = 0;
+    ioapic_count = 0;
+    for (uint32_t i = 0; i < ISA_IRQS; i++) {
+        isa_gsi[i] = i;     /* Identity unless overridden */
+        isa_flags[i] = 0;
+    }
+
+    const acpi_rsdp_t *rsdp = rsdp_find();
+    if (!rsdp) {
+        return -1;
+    }
+
+    const acpi_sdt_t *rsdt = (const acpi_sdt_t *)rsdp->rsdt_addr;
+    if (memcmp(rsdt->signature, "RSDT", 4) != 0 || !checksum_ok(rsdt, rsdt->length)) {
+        return -1;
+    }
+
+    const uint32_t *entries = (const uint32_t *)(rsdt + 1);
+    uint32_t n = (rsdt->length - sizeof(acpi_sdt_t)) / 4;
+    for (uint32_t i = 0; i < n; i++) {
+        const acpi_sdt_t *sdt = (const acpi_sdt_t *)entries[i];
+        if (memcmp(sdt->signature, "APIC", 4) == 0 && checksum_ok(sdt, sdt->length)) {
+            madt_parse((const acpi_madt_t *)sdt);
+            return cpu_count ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+uint32_t acpi_cpu_count(void) {
+    return cpu_count;
+}
+
+uint8_t acpi_cpu_apic_id(uint32_t index) {
+    return index < cpu_count ? cpu_apic_ids[index] : 0;
+}
+
+uint32_t acpi_ioapic_count(void) {
+    return ioapic_count;
+}
+
+const acpi_ioapic_t *acpi_ioapic(uint32_t index) {
+    return index < ioapic_count ? &ioapics[index] : 0;
+}
+
+uint32_t acpi_isa_gsi(uint8_t irq, uint16_t *flags) {
+    if (irq >= ISA_IRQS) {
+        *flags = 0;
+        return irq;
+    }
+    *flags = isa_flags[irq];
+    return isa_gsi[irq];
+}
@@ -0,0 +1,46 @@
+/*
+ * acpi.h - ACPI table discovery
+ *
+ * Only the MADT is read: it lists the local APIC of every processor the
+ * firmware enabled, which is what SMP bring-up needs, and the I/O APICs
+ * with the ISA IRQs the firmware wired to other inputs.
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+/* Most processors and I/O APICs recorded from the MADT */
+#define ACPI_MAX_CPUS 16
+#define ACPI_MAX_IOAPICS 4
+
+/* MPS INTI flags of an interrupt source override (0: bus default) */
+#define ACPI_INTI_POLARITY_MASK 0x3
+#define ACPI_INTI_ACTIVE_LOW    0x3
+#define ACPI_INTI_TRIGGER_MASK  0xC
+#define ACPI_INTI_LEVEL         0xC
+
+typedef struct {
+    uint8_t id;
+    uint32_t addr;          /* Physical MMIO base */
+    uint32_t gsi_base;      /* First global system interrupt it takes */
+} acpi_ioapic_t;
+
+/* Find the RSDP, RSDT and MADT; returns 0 if a MADT was parsed */
+int acpi_init(void);
+
+/* Enabled processors listed in the MADT (the BSP included) */
+uint32_t acpi_cpu_count(void);
+
+/* Local APIC ID of the index'th enabled processor */
+uint8_t acpi_cpu_apic_id(uint32_t index);
+
+uint32_t acpi_ioapic_count(void);
+const acpi_ioapic_t *acpi_ioapic(uint32_t index);
+
+/* Global system interrupt that ISA IRQ irq arrives on, with its INTI
+ * flags (0 for an ISA line: active high, edge triggered) */
+uint32_t acpi_isa_gsi(uint8_t irq, uint16_t *flags);
+
+#endif /* ACPI_H */
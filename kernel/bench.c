@@ -0,0 +1,335 @@
+/*
+ * bench.c - Block device, filesystem, system call and interrupt benchmarks
+ *
+ * Every result is printed as one line
+ *     BENCH <name> <value> <unit>
+ * on the console and on COM1, so a headless QEMU run can be grepped and
+ * compared between builds. Timing uses the TSC-calibrated clock_ns().
+ */
+
+#include "bench.h"
+
+#include <stdint.h>
+
+#include "clock.h"
+#include "disk.h"
+#include "exec.h"
+#include "idt.h"
+#include "process.h"
+#include "serial.h"
+#include "string.h"
+#include "syscall.h"
+#include "vfs.h"
+#include "vga.h"
+
+/* Scratch area past the FAT volume (4096..12287) and inside the image */
+#define BENCH_SCRATCH_LBA 16384u
+#define BENCH_SCRATCH_SECTORS 4096u
+#define BENCH_CHUNK_SECTORS 64u
+#define BENCH_RANDOM_OPS 256u
+#define BENCH_FS_FILES 12u
+#define BENCH_FS_ROUNDS 4u
+#define BENCH_APPEND_CHUNK 64u
+#define BENCH_SYSCALLS 20000u
+#define BENCH_IRQS 20000u
+
+static uint8_t io_buf[BENCH_CHUNK_SECTORS * 512];
+
+static uint32_t elapsed_us(uint64_t start) {
+    uint32_t us = udiv64_32(clock_ns() - start, NSEC_PER_USEC);
+    return us ? us : 1;
+}
+
+static uint32_t per_second(uint32_t count, uint32_t us) {
+    return udiv64_32((uint64_t)count * 1000000u, us);
+}
+
+static void append_str(char *line, size_t *pos, const char *s) {
+    while (*s && *pos < 95) {
+        line[(*pos)++] = *s++;
+    }
+    line[*pos] = '\0';
+}
+
+static void append_dec(char *line, size_t *pos, uint32_t v) {
+    char tmp[11];
+    int i = 10;
+    tmp[i] = '\0';
+    do {
+        tmp[--i] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v && i > 0);
+    append_str(line, pos, &tmp[i]);
+}
+
+static void report(const char *name, uint32_t value, const char *unit) {
+    char line[96];
+    size_t pos = 0;
+    append_str(line, &pos, "BENCH ");
+    append_str(line, &pos, name);
+    append_str(line, &pos, " ");
+    append_dec(line, &pos, value);
+    append_str(line, &pos, " ");
+    append_str(line, &pos, unit);
+    append_str(line, &pos, "\n");
+    vga_puts(line);
+    serial_puts(line);
+}
+
+static void report_error(const char *name) {
+    vga_printf("BENCH %s ERROR -\n", name);
+    serial_puts("BENCH ");
+    serial_puts(name);
+    serial_puts(" ERROR -\n");
+}
+
+static uint32_t lcg_next(uint32_t *state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+static void bench_disk_seq(int write) {
+    const char *name = write ? "disk.seq_write" : "disk.seq_read";
+    uint64_t start = clock_ns();
+    for (uint32_t s = 0; s < BENCH_SCRATCH_SECTORS; s += BENCH_CHUNK_SECTORS) {
+        int r = write ? disk_write_sectors(BENCH_SCRATCH_LBA + s, BENCH_CHUNK_SECTORS, io_buf)
+                      : disk_read_sectors(BENCH_SCRATCH_LBA + s, BENCH_CHUNK_SECTORS, io_buf);
+        if (r != 0) {
+            report_error(name);
+            return;
+        }
+    }
+    uint32_t us = elapsed_us(start);
+    report(name, per_second(BENCH_SCRATCH_SECTORS * 512u / 1024u, us), "KiB/s");
+}
+
+static void bench_disk_random(int write) {
+    const char *name = write ? "disk.rand_write" : "disk.rand_read";
+    const char *iops = write ? "disk.rand_write_iops" : "disk.rand_read_iops";
+    uint32_t seed = 0x0511u;
+    uint64_t start = clock_ns();
+    for (uint32_t i = 0; i < BENCH_RANDOM_OPS; i++) {
+        uint32_t lba = BENCH_SCRATCH_LBA + lcg_next(&seed) % BENCH_SCRATCH_SECTORS;
+        int r = write ? disk_write_sectors(lba, 1, io_buf) : disk_read_sectors(lba, 1, io_buf);
+        if (r != 0) {
+            report_error(name);
+            return;
+        }
+    }
+    uint32_t us = elapsed_us(start);
+    report(name, per_second(BENCH_RANDOM_OPS * 512u / 1024u, us), "KiB/s");
+    report(iops, per_second(BENCH_RANDOM_OPS, us), "ops/s");
+}
+
+static void bench_name(char out[13], uint32_t i) {
+    memcpy(out, "BNCH00.TMP", 11);
+    out[4] = (char)('0' + (i / 10) % 10);
+    out[5] = (char)('0' + i % 10);
+}
+
+static void bench_fs_ops(void) {
+    char name[13];
+    uint32_t create_us = 0, lookup_us = 0, delete_us = 0;
+
+    for (uint32_t round = 0; round < BENCH_FS_ROUNDS; round++) {
+        uint64_t start = clock_ns();
+        for (uint32_t i = 0; i < BENCH_FS_FILES; i++) {
+            bench_name(name, i);
+            if (vfs_touch(name) != 0) {
+                report_error("fs.create");
+                return;
+            }
+        }
+        create_us += elapsed_us(start);
+
+        start = clock_ns();
+        for (uint32_t i = 0; i < BENCH_FS_FILES; i++) {
+            uint32_t ino;
+            size_t len;
+            bench_name(name, i);
+            if (vfs_lookup(name, &ino, &len) != 0) {
+                report_error("fs.lookup");
+                return;
+            }
+        }
+        lookup_us += elapsed_us(start);
+
+        start = clock_ns();
+        for (uint32_t i = 0; i < BENCH_FS_FILES; i++) {
+            bench_name(name, i);
+            if (vfs_remove(name) != 0) {
+                report_error("fs.delete");
+                return;
+            }
+        }
+        delete_us += elapsed_us(start);
+    }
+
+    uint32_t ops = BENCH_FS_FILES * BENCH_FS_ROUNDS;
+    report("fs.create", per_second(ops, create_us), "ops/s");
+    report("fs.lookup", per_second(ops, lookup_us), "ops/s");
+    report("fs.delete", per_second(ops, delete_us), "ops/s");
+}
+
+static void bench_fs_append(void) {
+    static const char name[] = "BNCHAPP.TMP";
+    char chunk[BENCH_APPEND_CHUNK + 1];
+    memset(chunk, 'a', BENCH_APPEND_CHUNK);
+    chunk[BENCH_APPEND_CHUNK - 1] = '\n';
+    chunk[BENCH_APPEND_CHUNK] = '\0';
+
+    vfs_remove(name);
+    if (vfs_touch(name) != 0) {
+        report_error("fs.append");
+        return;
+    }
+
+    uint32_t count = 4096u / BENCH_APPEND_CHUNK;
+    uint64_t start = clock_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        if (vfs_append(name, chunk) != 0) {
+            report_error("fs.append");
+            vfs_remove(name);
+            return;
+        }
+    }
+    uint32_t us = elapsed_us(start);
+    vfs_remove(name);
+
+    report("fs.append", per_second(count * BENCH_APPEND_CHUNK, us), "B/s");
+    report("fs.append_ops", per_second(count, us), "ops/s");
+}
+
+/* TSC cycles for BENCH_SYSCALLS getpid calls through each entry path,
+ * written from ring 3 */
+static volatile uint64_t syscall_cycles[2];
+
+static inline int getpid_int80(void) {
+    int ret;
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(SYS_GETPID) : "memory");
+    return ret;
+}
+
+static inline int getpid_sysenter(void) {
+    int ret;
+    __asm__ volatile("push %%ebp\n\t"
+                     "mov %%esp, %%ebp\n\t"
+                     "lea 1f, %%esi\n\t"
+                     "sysenter\n"
+                     "1:\n\t"
+                     "pop %%ebp"
+                     : "=a"(ret)
+                     : "a"(SYS_GETPID)
+                     : "ecx", "edx", "esi", "memory");
+    return ret;
+}
+
+/* Runs in ring 3 out of kernel memory, like the usermode test */
+static void syscall_loop(void) {
+    uint64_t start = clock_cycles();
+    for (uint32_t i = 0; i < BENCH_SYSCALLS; i++) {
+        getpid_int80();
+    }
+    syscall_cycles[0] = clock_cycles() - start;
+
+    if (syscall_sysenter_available()) {
+        start = clock_cycles();
+        for (uint32_t i = 0; i < BENCH_SYSCALLS; i++) {
+            getpid_sysenter();
+        }
+        syscall_cycles[1] = clock_cycles() - start;
+    }
+
+    __asm__ volatile("int $0x80" : : "a"(SYS_EXIT), "b"(0));
+}
+
+static void bench_syscall(void) {
+    static uint8_t user_stack[4096] __attribute__((aligned(16)));
+    syscall_cycles[0] = syscall_cycles[1] = 0;
+
+    registers_t frame;
+    exec_user_frame(&frame, (uint32_t)syscall_loop, (uint32_t)&user_stack[sizeof(user_stack) - 16]);
+    int pid = process_create_user("sysbench", 0, &frame);
+    int status = -1;
+    if (pid < 0 || process_wait(pid, &status) != pid || status != 0) {
+        report_error("syscall.int80");
+        return;
+    }
+
+    report("syscall.int80", udiv64_32(syscall_cycles[0], BENCH_SYSCALLS), "cycles");
+    if (syscall_cycles[1]) {
+        report("syscall.sysenter", udiv64_32(syscall_cycles[1], BENCH_SYSCALLS), "cycles");
+    } else {
+        report_error("syscall.sysenter");
+    }
+}
+
+static void irq_bench_handler(registers_t *r) {
+    (void)r;
+}
+
+/* TSC cycles per interrupt into an empty handler from ring 0, through
+ * the exception path and through the IRQ stubs (without the PIC EOI) */
+static void bench_irq(void) {
+    idt_register_handler(IRQ_BENCH_SLOW_VECTOR, irq_bench_handler);
+    idt_register_handler(IRQ_BENCH_FAST_VECTOR, irq_bench_handler);
+
+    uint64_t start = clock_cycles();
+    for (uint32_t i = 0; i < BENCH_IRQS; i++) {
+        __asm__ volatile("int %0" : : "i"(IRQ_BENCH_SLOW_VECTOR) : "memory");
+    }
+    uint32_t common = udiv64_32(clock_cycles() - start, BENCH_IRQS);
+
+    start = clock_cycles();
+    for (uint32_t i = 0; i < BENCH_IRQS; i++) {
+        __asm__ volatile("int %0" : : "i"(IRQ_BENCH_FAST_VECTOR) : "memory");
+    }
+    uint32_t fast = udiv64_32(clock_cycles() - start, BENCH_IRQS);
+
+    report("irq.common", common, "cycles");
+    report("irq.fast", fast, "cycles");
+    report("irq.saved", common > fast ? common - fast : 0, "cycles");
+}
+
+void bench_run(const char *which) {
+    int disk = 1;
+    int fs = 1;
+    int sys = 1;
+    int irq = 1;
+    if (which && *which) {
+        if (strcmp(which, "disk") == 0) {
+            fs = sys = irq = 0;
+        } else if (strcmp(which, "fs") == 0) {
+            disk = sys = irq = 0;
+        } else if (strcmp(which, "syscall") == 0) {
+            disk = fs = irq = 0;
+        } else if (strcmp(which, "irq") == 0) {
+            disk = fs = sys = 0;
+        } else if (strcmp(which, "all") != 0) {
+            vga_puts("usage: bench [disk|fs|syscall|irq|all]\n");
+            return;
+        }
+    }
+
+    report("clock.tsc", clock_tsc_khz() / 1000u, "MHz");
+
+    if (disk) {
+        for (uint32_t i = 0; i < sizeof(io_buf); i++) {
+            io_buf[i] = (uint8_t)i;
+        }
+        bench_disk_seq(1);
+        bench_disk_seq(0);
+        bench_disk_random(1);
+        bench_disk_random(0);
+    }
+    if (fs) {
+        bench_fs_ops();
+        bench_fs_append();
+    }
+    if (sys) {
+        bench_syscall();
+    }
+    if (irq) {
+        bench_irq();
+    }
+}
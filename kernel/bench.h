@@ -0,0 +1,12 @@
+/*
+ * bench.h - Block device, filesystem, system call and interrupt benchmarks
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Run "disk", "fs", "syscall", "irq" or "all" (default) benchmarks and
+ * print BENCH lines */
+void bench_run(const char *which);
+
+#endif /* BENCH_H */
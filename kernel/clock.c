@@ -0,0 +1,74 @@
+/*
+ * clock.c - TSC-based monotonic clock
+ */
+
+#include "clock.h"
+
+#include "cpu.h"
+#include "timer.h"
+
+#define CALIBRATE_MS 50u
+#define NS_SHIFT 22u
+
+static uint32_t tsc_khz;
+static uint32_t ns_mult;     /* ns per cycle, fixed point NS_SHIFT */
+static uint64_t tsc_base;
+
+/* (a * mul) >> shift with a 64-bit a, without overflowing 64 bits */
+static uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint32_t ah = (uint32_t)(a >> 32);
+    uint32_t al = (uint32_t)a;
+    uint64_t ret = ((uint64_t)al * mul) >> shift;
+    if (ah) {
+        ret += ((uint64_t)ah * mul) << (32u - shift);
+    }
+    return ret;
+}
+
+/* Count TSC cycles across a polled PIT channel 2 countdown */
+static uint32_t calibrate_tsc_khz(void) {
+    uint64_t start = clock_cycles();
+    timer_pit_wait_ms(CALIBRATE_MS);
+    uint64_t end = clock_cycles();
+    return udiv64_32(end - start, CALIBRATE_MS);
+}
+
+void clock_init(void) {
+    tsc_khz = 0;
+    ns_mult = 0;
+
+    if (!(cpuid_edx(1) & CPUID_EDX_TSC)) {
+        return;
+    }
+
+    uint32_t khz = calibrate_tsc_khz();
+    if (khz < 1000) {
+        return; /* Implausible; keep the tick-based fallback */
+    }
+
+    tsc_khz = khz;
+    ns_mult = udiv64_32((uint64_t)NSEC_PER_MSEC << NS_SHIFT, khz);
+    tsc_base = clock_cycles();
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return mul_u64_u32_shr(cycles, ns_mult, NS_SHIFT);
+}
+
+uint64_t clock_ns(void) {
+    if (!tsc_khz) {
+        return (uint64_t)timer_get_ticks() * (NSEC_PER_SEC / TIMER_FREQ);
+    }
+    return clock_cycles_to_ns(clock_cycles() - tsc_base);
+}
+
+uint32_t clock_tsc_khz(void) {
+    return tsc_khz;
+}
+
+void clock_delay_us(uint32_t us) {
+    uint64_t end = clock_ns() + (uint64_t)us * NSEC_PER_USEC;
+    while (clock_ns() < end) {
+        __asm__ volatile("pause");
+    }
+}
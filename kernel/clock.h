@@ -0,0 +1,52 @@
+/*
+ * clock.h - TSC-based monotonic clock
+ *
+ * The TSC is calibrated against PIT channel 2 once at boot. clock_ns()
+ * counts from that point and has cycle resolution; timers expiring at a
+ * clock_ns() time are kept in the ktimer wheel.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#define NSEC_PER_USEC 1000u
+#define NSEC_PER_MSEC 1000000u
+#define NSEC_PER_SEC  1000000000u
+
+/* Calibrate the TSC (call before interrupts are enabled) */
+void clock_init(void);
+
+/* Raw TSC cycles */
+static inline uint64_t clock_cycles(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* Nanoseconds since clock_init */
+uint64_t clock_ns(void);
+
+/* Convert a cycle delta to nanoseconds */
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+
+/* Calibrated TSC frequency; 0 if the CPU has no TSC */
+uint32_t clock_tsc_khz(void);
+
+/* Busy-wait; safe with interrupts disabled */
+void clock_delay_us(uint32_t us);
+
+/* 64-by-32 division without libgcc; saturates if the quotient overflows */
+static inline uint32_t udiv64_32(uint64_t n, uint32_t d) {
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t lo = (uint32_t)n;
+    uint32_t q, r;
+    if (d == 0 || hi >= d) {
+        return 0xFFFFFFFFu;
+    }
+    __asm__("divl %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+    return q;
+}
+
+#endif /* CLOCK_H */
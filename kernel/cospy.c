@@ -5,6 +5,7 @@
 
 #include "keyboard.h"
 #include "memory.h"
+#include "paging.h"
 #include "string.h"
 #include "vfs.h"
 #include "vga.h"
@@ -640,9 +641,10 @@ int cospy_run_file(const char *filename) {
         return -1;
     }
 
+    /* Parsed from the cached page in place */
+    uint32_t frame;
     size_t file_len;
-    const char *content = vfs_read_ptr(filename, &file_len);
-    if (!content) {
+    if (vfs_get_page(filename, &frame, &file_len) != 0) {
         vga_puts("file not found: ");
         vga_puts(filename);
         vga_putc('\n');
@@ -655,8 +657,8 @@ int cospy_run_file(const char *filename) {
     char lines[64][COSPY_LINE_MAX];
     int line_count = 0;
 
-    const char *p = content;
-    const char *end = content + file_len;
+    const char *p = (const char *)frame;
+    const char *end = p + file_len;
 
     while (p < end && line_count < 64) {
         size_t len = 0;
@@ -667,6 +669,9 @@ int cospy_run_file(const char *filename) {
         line_count++;
         if (p < end && *p == '\n') p++;
     }
+    if (frame) {
+        frame_free(frame);
+    }
 
     /* Execute lines with while loop support */
     char while_body[16][COSPY_LINE_MAX];
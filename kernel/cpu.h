@@ -0,0 +1,85 @@
+/*
+ * cpu.h - CPUID, MSR and control register helpers
+ */
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+/* CPUID leaf 1 EDX feature bits */
+#define CPUID_EDX_PSE   (1u << 3)
+#define CPUID_EDX_TSC   (1u << 4)
+#define CPUID_EDX_MSR   (1u << 5)
+#define CPUID_EDX_APIC  (1u << 9)
+#define CPUID_EDX_SEP   (1u << 11)
+#define CPUID_EDX_FXSR  (1u << 24)
+#define CPUID_EDX_SSE   (1u << 25)
+
+/* Control register bits */
+#define CR0_MP          (1u << 1)
+#define CR0_EM          (1u << 2)
+#define CR0_TS          (1u << 3)
+#define CR0_NE          (1u << 5)
+#define CR0_WP          (1u << 16)
+#define CR0_PG          (1u << 31)
+#define CR4_PSE         (1u << 4)
+#define CR4_OSFXSR      (1u << 9)
+#define CR4_OSXMMEXCPT  (1u << 10)
+
+/* SYSENTER/SYSEXIT MSRs */
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+static inline uint32_t cpuid_edx(uint32_t leaf) {
+    uint32_t a, b, c, d;
+    cpuid(leaf, &a, &b, &c, &d);
+    return d;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t v;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint32_t v) {
+    __asm__ volatile("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t v;
+    __asm__ volatile("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr3(uint32_t v) {
+    __asm__ volatile("mov %0, %%cr3" : : "r"(v) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t v;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uint32_t v) {
+    __asm__ volatile("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+#endif /* CPU_H */
@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 #include "io.h"
+#include "trace.h"
 
 #define ATA_IO_BASE 0x1F0
 #define ATA_REG_DATA (ATA_IO_BASE + 0)
@@ -61,7 +62,7 @@ static void ata_select_lba(uint32_t lba, uint8_t count) {
 void disk_init(void) {
 }
 
-int disk_read_sectors(uint32_t lba, uint8_t count, void *buf) {
+static int ata_read(uint32_t lba, uint8_t count, void *buf) {
     uint16_t *dst = (uint16_t *)buf;
 
     if (count == 0) {
@@ -85,7 +86,7 @@ int disk_read_sectors(uint32_t lba, uint8_t count, void *buf) {
     return 0;
 }
 
-int disk_write_sectors(uint32_t lba, uint8_t count, const void *buf) {
+static int ata_write(uint32_t lba, uint8_t count, const void *buf) {
     const uint16_t *src = (const uint16_t *)buf;
 
     if (count == 0) {
@@ -108,3 +109,17 @@ int disk_write_sectors(uint32_t lba, uint8_t count, const void *buf) {
 
     return 0;
 }
+
+int disk_read_sectors(uint32_t lba, uint8_t count, void *buf) {
+    TRACE(TRACE_DISK_READ, lba);
+    int r = ata_read(lba, count, buf);
+    TRACE(TRACE_DISK_END, r);
+    return r;
+}
+
+int disk_write_sectors(uint32_t lba, uint8_t count, const void *buf) {
+    TRACE(TRACE_DISK_WRITE, lba);
+    int r = ata_write(lba, count, buf);
+    TRACE(TRACE_DISK_END, r);
+    return r;
+}
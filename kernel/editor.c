@@ -152,15 +152,13 @@ int editor_edit_file(const char *name) {
     /* Flush any leftover keyboard input from previous session */
     keyboard_flush();
 
-    size_t len = 0;
-    const char *src = vfs_read_ptr(name, &len);
-    if (!src) {
-        text[0] = '\0';
-        len = 0;
-    } else {
-        memcpy(text, src, len);
-        text[len] = '\0';
+    /* Keep the last byte for the terminator */
+    int got = vfs_read(name, text, sizeof(text) - 1);
+    size_t len = got < 0 ? 0 : (size_t)got;
+    if (len > sizeof(text) - 1) {
+        len = sizeof(text) - 1;
     }
+    text[len] = '\0';
 
     size_t cursor = 0;
     mode_t mode = MODE_NORMAL;
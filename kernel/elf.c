@@ -0,0 +1,71 @@
+/*
+ * elf.c - ELF32 executable loading
+ *
+ * Only statically linked i386 executables: each PT_LOAD segment is copied
+ * page by page into frames of the target directory, with the rest of its
+ * memory size left zeroed (.bss).
+ */
+
+#include "elf.h"
+
+#include "paging.h"
+#include "string.h"
+#include "vm.h"
+
+static int header_ok(const elf32_ehdr_t *eh, size_t len) {
+    if (len < sizeof(*eh) || eh->e_magic != ELF_MAGIC || eh->e_class != ELFCLASS32 ||
+        eh->e_data != ELFDATA2LSB || eh->e_type != ET_EXEC || eh->e_machine != EM_386) {
+        return 0;
+    }
+    if (eh->e_phentsize != sizeof(elf32_phdr_t) || eh->e_phoff > len ||
+        (uint32_t)eh->e_phnum * sizeof(elf32_phdr_t) > len - eh->e_phoff) {
+        return 0;
+    }
+    return eh->e_entry >= USER_BASE && eh->e_entry < USER_MMAP_BASE;
+}
+
+static int load_segment(uint32_t dir, const elf32_phdr_t *ph, const uint8_t *image, size_t len) {
+    uint32_t va = ph->p_vaddr;
+    if (ph->p_filesz > ph->p_memsz || ph->p_offset > len || ph->p_filesz > len - ph->p_offset ||
+        va < USER_BASE || va >= USER_MMAP_BASE || ph->p_memsz > USER_MMAP_BASE - va) {
+        return -1;
+    }
+
+    const uint8_t *src = image + ph->p_offset;
+    uint32_t end = va + ph->p_memsz;
+    int writable = (ph->p_flags & PF_W) != 0;
+
+    for (uint32_t page = va & ~(PAGE_SIZE - 1); page < end; page += PAGE_SIZE) {
+        uint32_t frame = vm_map(dir, page, writable);
+        if (!frame) {
+            return -1;
+        }
+
+        /* The part of [va, va + filesz) inside this page */
+        uint32_t from = page > va ? page : va;
+        uint32_t to = page + PAGE_SIZE;
+        if (to > va + ph->p_filesz) {
+            to = va + ph->p_filesz;
+        }
+        if (from < to) {
+            memcpy((uint8_t *)frame + (from - page), src + (from - va), to - from);
+        }
+    }
+    return 0;
+}
+
+int elf_load(uint32_t dir, const uint8_t *image, size_t len, uint32_t *entry) {
+    const elf32_ehdr_t *eh = (const elf32_ehdr_t *)image;
+    if (!header_ok(eh, len)) {
+        return -1;
+    }
+
+    const elf32_phdr_t *ph = (const elf32_phdr_t *)(image + eh->e_phoff);
+    for (uint32_t i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD && ph[i].p_memsz && load_segment(dir, &ph[i], image, len) != 0) {
+            return -1;
+        }
+    }
+    *entry = eh->e_entry;
+    return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * elf.h - ELF32 executable loading
+ */
+
+#ifndef ELF_H
+#define ELF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ELF_MAGIC   0x464C457Fu     /* "\x7FELF" */
+#define ELFCLASS32  1
+#define ELFDATA2LSB 1
+#define ET_EXEC     2
+#define EM_386      3
+#define PT_LOAD     1
+#define PF_W        0x2
+
+typedef struct {
+    uint32_t e_magic;
+    uint8_t e_class;
+    uint8_t e_data;
+    uint8_t e_version_id;
+    uint8_t e_pad[9];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint32_t e_entry;
+    uint32_t e_phoff;
+    uint32_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} __attribute__((packed)) elf32_ehdr_t;
+
+typedef struct {
+    uint32_t p_type;
+    uint32_t p_offset;
+    uint32_t p_vaddr;
+    uint32_t p_paddr;
+    uint32_t p_filesz;
+    uint32_t p_memsz;
+    uint32_t p_flags;
+    uint32_t p_align;
+} __attribute__((packed)) elf32_phdr_t;
+
+/* Map image's PT_LOAD segments into the user address space dir and store
+ * the entry point. Segments must lie below the user stack. Returns 0, or
+ * -1 for a malformed image or when memory runs out (dir may then hold
+ * some of the pages; destroy it). */
+int elf_load(uint32_t dir, const uint8_t *image, size_t len, uint32_t *entry);
+
+#endif /* ELF_H */
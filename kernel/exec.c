@@ -0,0 +1,114 @@
+/*
+ * exec.c - Running ELF programs from the filesystem
+ *
+ * A program gets a fresh address space holding its PT_LOAD segments and
+ * USER_STACK_PAGES of stack below USER_STACK_TOP. The file is read into
+ * scratch frames first, as vfs buffers only last until the next vfs call.
+ */
+
+#include "exec.h"
+
+#include "elf.h"
+#include "fs.h"
+#include "idt.h"
+#include "mmap.h"
+#include "paging.h"
+#include "process.h"
+#include "string.h"
+#include "vfs.h"
+#include "vm.h"
+
+#define IMAGE_PAGES ((FS_MAX_FILE_SIZE + PAGE_SIZE - 1) / PAGE_SIZE)
+
+/* Build an address space for path; 0 on failure */
+static uint32_t load_image(const char *path, uint32_t *entry) {
+    uint32_t image = frame_alloc_contig(IMAGE_PAGES);
+    if (!image) {
+        return 0;
+    }
+
+    int len = vfs_read(path, (void *)image, FS_MAX_FILE_SIZE);
+    uint32_t dir = len > 0 ? vm_create() : 0;
+    int ok = dir && elf_load(dir, (const uint8_t *)image, (size_t)len, entry) == 0;
+    for (uint32_t va = USER_STACK_BASE; ok && va < USER_STACK_TOP; va += PAGE_SIZE) {
+        ok = vm_map(dir, va, 1) != 0;
+    }
+
+    for (uint32_t i = 0; i < IMAGE_PAGES; i++) {
+        frame_free(image + i * PAGE_SIZE);
+    }
+    if (!ok) {
+        vm_destroy(dir);
+        return 0;
+    }
+    return dir;
+}
+
+void exec_user_frame(registers_t *r, uint32_t eip, uint32_t esp) {
+    memset(r, 0, sizeof(*r));
+    r->ds = r->es = r->fs = r->gs = USER_DS;
+    r->ss = USER_DS;
+    r->cs = USER_CS;
+    r->eip = eip;
+    r->useresp = esp;
+    r->eflags = 0x202;
+}
+
+static const char *base_name(const char *path) {
+    const char *name = path;
+    for (const char *c = path; *c; c++) {
+        if (*c == '/') {
+            name = c + 1;
+        }
+    }
+    return name;
+}
+
+int exec_spawn(const char *path) {
+    uint32_t entry;
+    uint32_t dir = load_image(path, &entry);
+    if (!dir) {
+        return -1;
+    }
+
+    registers_t frame;
+    exec_user_frame(&frame, entry, USER_STACK_TOP - 16);
+    int pid = process_create_user(base_name(path), dir, &frame);
+    if (pid < 0) {
+        vm_destroy(dir);
+    }
+    return pid;
+}
+
+int exec_replace(registers_t *regs, const char *path) {
+    uint32_t entry;
+    uint32_t dir = load_image(path, &entry);
+    if (!dir) {
+        return -1;
+    }
+
+    /* Never run with a page_dir that is not loaded */
+    process_t *p = process_current();
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    uint32_t old = p->page_dir;
+    p->page_dir = dir;
+    vm_switch(dir);
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+    vm_destroy(old);
+    p->ring = 0;  /* It was in the old image */
+    p->ring_entries = 0;
+    mmap_reset(p);
+
+    exec_user_frame(regs, entry, USER_STACK_TOP - 16);
+    const char *name = base_name(path);
+    size_t len = strlen(name);
+    if (len > sizeof(p->name) - 1) {
+        len = sizeof(p->name) - 1;
+    }
+    memcpy(p->name, name, len);
+    p->name[len] = '\0';
+    return 0;
+}
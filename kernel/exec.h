@@ -0,0 +1,24 @@
+/*
+ * exec.h - Running ELF programs from the filesystem
+ */
+
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stdint.h>
+
+struct registers;
+
+/* Ring 3 entry state: user segments, interrupts on */
+void exec_user_frame(struct registers *r, uint32_t eip, uint32_t esp);
+
+/* Start path in a new address space as a child of the current task;
+ * returns its pid or -1 */
+int exec_spawn(const char *path);
+
+/* Replace the calling user program, whose syscall frame is regs, with
+ * path. Returns -1 (and leaves the caller untouched) if it cannot be
+ * loaded. path must not point into the caller's address space. */
+int exec_replace(struct registers *regs, const char *path);
+
+#endif /* EXEC_H */
@@ -0,0 +1,368 @@
+/*
+ * file.c - Open files and per-process descriptor tables
+ *
+ * Regular files are read and written through vfs_read_at() and
+ * vfs_write_at(). Reads are served from the page cache and writes drop
+ * the file's cached pages, so every descriptor still sees every write at
+ * once. Program buffers are copied through a bounce frame, and
+ * console output through a small stack buffer, so no page fault on a
+ * program's memory can happen while an fs, descriptor or console lock is
+ * held. The bounce frame belongs to the task and goes with its
+ * descriptors, so a copy that faults and kills the task leaks nothing.
+ *
+ * Names are kept as given to open() and resolved against the current
+ * directory on each call, which the flat fs shares among all tasks.
+ */
+
+#include "file.h"
+
+#include "keyboard.h"
+#include "paging.h"
+#include "process.h"
+#include "string.h"
+#include "vfs.h"
+#include "vga.h"
+
+/* Console output is staged this many bytes at a time */
+#define CONSOLE_CHUNK 256
+
+static file_t file_table[FILE_MAX];
+static file_t console_file = { FILE_CONSOLE, O_RDWR, 0, 0, MUTEX_INIT, "console" };
+
+/* Guards file_table slots and refs */
+static spinlock_t file_lock = SPINLOCK_INIT;
+
+static file_t *file_alloc(void) {
+    uint32_t flags = spin_lock_irqsave(&file_lock);
+    file_t *f = 0;
+    for (int i = 0; i < FILE_MAX; i++) {
+        if (file_table[i].type == FILE_FREE) {
+            f = &file_table[i];
+            f->type = FILE_REG;  /* Claimed; the caller fills it in */
+            f->refs = 1;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&file_lock, flags);
+
+    if (f) {
+        f->flags = 0;
+        f->offset = 0;
+        mutex_init(&f->lock);
+    }
+    return f;
+}
+
+static void file_get(file_t *f) {
+    if (f == &console_file) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&file_lock);
+    f->refs++;
+    spin_unlock_irqrestore(&file_lock, flags);
+}
+
+static void file_put(file_t *f) {
+    if (f == &console_file) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&file_lock);
+    if (--f->refs == 0) {
+        f->type = FILE_FREE;
+    }
+    spin_unlock_irqrestore(&file_lock, flags);
+}
+
+static file_t *fd_file(int fd) {
+    if (fd < 0 || fd >= PROCESS_MAX_FDS) {
+        return 0;
+    }
+    return process_current()->files[fd];
+}
+
+void file_inherit(process_t *child, process_t *parent) {
+    if (!parent || !parent->user) {
+        for (int fd = 0; fd < 3; fd++) {
+            child->files[fd] = &console_file;
+        }
+        return;
+    }
+    for (int fd = 0; fd < PROCESS_MAX_FDS; fd++) {
+        file_t *f = parent->files[fd];
+        if (f) {
+            file_get(f);
+        }
+        child->files[fd] = f;
+    }
+}
+
+void file_close_all(process_t *p) {
+    for (int fd = 0; fd < PROCESS_MAX_FDS; fd++) {
+        file_t *f = p->files[fd];
+        p->files[fd] = 0;
+        if (f) {
+            file_put(f);
+        }
+    }
+    if (p->bounce) {
+        frame_free(p->bounce);
+        p->bounce = 0;
+    }
+}
+
+int file_open(const char *path, int flags) {
+    process_t *p = process_current();
+    int fd = 0;
+    while (fd < PROCESS_MAX_FDS && p->files[fd]) {
+        fd++;
+    }
+    if (fd == PROCESS_MAX_FDS || strlen(path) > FS_MAX_NAME) {
+        return -1;
+    }
+
+    int writable = (flags & O_ACCMODE) != O_RDONLY;
+    size_t size;
+    int is_dir;
+    if (vfs_stat(path, &size, &is_dir) != 0) {
+        if (!(flags & O_CREAT) || vfs_touch(path) != 0) {
+            return -1;
+        }
+        is_dir = 0;
+    }
+
+    /* Listings only cover the current directory */
+    if (is_dir && (writable || strcmp(path, ".") != 0)) {
+        return -1;
+    }
+    if (!is_dir && writable && (flags & O_TRUNC) && vfs_write_raw(path, "", 0) != 0) {
+        return -1;
+    }
+
+    file_t *f = file_alloc();
+    if (!f) {
+        return -1;
+    }
+    f->flags = flags;
+    memcpy(f->name, path, strlen(path) + 1);
+    f->type = is_dir ? FILE_DIR : FILE_REG;
+    p->files[fd] = f;
+    return fd;
+}
+
+int file_close(int fd) {
+    file_t *f = fd_file(fd);
+    if (!f) {
+        return -1;
+    }
+    process_current()->files[fd] = 0;
+    file_put(f);
+    return 0;
+}
+
+static int console_read(char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = keyboard_getchar();
+        buf[i] = c;
+        if (c == '\n') {
+            return (int)(i + 1);
+        }
+    }
+    return (int)len;
+}
+
+static void console_write(const char *buf, size_t len) {
+    char chunk[CONSOLE_CHUNK];
+    while (len) {
+        size_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+        memcpy(chunk, buf, n);
+        vga_write(chunk, n);
+        buf += n;
+        len -= n;
+    }
+}
+
+/* The current task's bounce frame, allocated on first use */
+static void *bounce_frame(void) {
+    process_t *p = process_current();
+    if (!p->bounce) {
+        p->bounce = frame_alloc();
+    }
+    return (void *)p->bounce;
+}
+
+int file_read(int fd, void *buf, size_t len) {
+    file_t *f = fd_file(fd);
+    if (!f || (f->flags & O_ACCMODE) == O_WRONLY) {
+        return -1;
+    }
+    if (f->type == FILE_CONSOLE) {
+        return console_read((char *)buf, len);
+    }
+    if (f->type != FILE_REG) {
+        return -1;
+    }
+
+    void *bounce = bounce_frame();
+    if (!bounce) {
+        return -1;
+    }
+    if (len > PAGE_SIZE) {
+        len = PAGE_SIZE;
+    }
+
+    mutex_lock(&f->lock);
+    int n = vfs_read_at(f->name, f->offset, bounce, len);
+    if (n > 0) {
+        f->offset += (uint32_t)n;
+    }
+    mutex_unlock(&f->lock);
+
+    /* Only now touch the program's memory, which may fault */
+    if (n > 0) {
+        memcpy(buf, bounce, (size_t)n);
+    }
+    return n;
+}
+
+/* Write len bytes of kernel memory at the file's offset (its end with
+ * O_APPEND) and move the offset past them */
+static int reg_write(file_t *f, const void *kbuf, size_t len) {
+    mutex_lock(&f->lock);
+    uint32_t off = f->offset;
+    if (f->flags & O_APPEND) {
+        size_t size;
+        int is_dir;
+        off = vfs_stat(f->name, &size, &is_dir) == 0 ? (uint32_t)size : off;
+    }
+    int n = vfs_write_at(f->name, off, kbuf, len);
+    if (n > 0) {
+        f->offset = off + (uint32_t)n;
+    }
+    mutex_unlock(&f->lock);
+    return n;
+}
+
+static file_t *writable_file(int fd) {
+    file_t *f = fd_file(fd);
+    if (!f || (f->flags & O_ACCMODE) == O_RDONLY || f->type == FILE_DIR) {
+        return 0;
+    }
+    return f;
+}
+
+int file_write(int fd, const void *buf, size_t len) {
+    file_t *f = writable_file(fd);
+    if (!f) {
+        return -1;
+    }
+    if (f->type == FILE_CONSOLE) {
+        console_write((const char *)buf, len);
+        return (int)len;
+    }
+
+    void *bounce = bounce_frame();
+    if (!bounce) {
+        return -1;
+    }
+    if (len > PAGE_SIZE) {
+        len = PAGE_SIZE;  /* No file holds more */
+    }
+    memcpy(bounce, buf, len);
+    return reg_write(f, bounce, len);
+}
+
+int file_writev(int fd, const iovec_t *iov, int count) {
+    file_t *f = writable_file(fd);
+    if (!f || count < 0 || count > IOV_MAX) {
+        return -1;
+    }
+
+    size_t total = 0;
+    if (f->type == FILE_CONSOLE) {
+        for (int i = 0; i < count; i++) {
+            console_write((const char *)iov[i].base, iov[i].len);
+            total += iov[i].len;
+        }
+        return (int)total;
+    }
+
+    /* Gather into one write, so the pieces land together */
+    char *bounce = bounce_frame();
+    if (!bounce) {
+        return -1;
+    }
+    for (int i = 0; i < count && total < PAGE_SIZE; i++) {
+        size_t n = iov[i].len < PAGE_SIZE - total ? iov[i].len : PAGE_SIZE - total;
+        memcpy(bounce + total, iov[i].base, n);
+        total += n;
+    }
+    return reg_write(f, bounce, total);
+}
+
+int file_lseek(int fd, int offset, int whence) {
+    file_t *f = fd_file(fd);
+    if (!f || f->type != FILE_REG) {
+        return -1;
+    }
+
+    mutex_lock(&f->lock);
+    int base = -1;
+    if (whence == SEEK_SET) {
+        base = 0;
+    } else if (whence == SEEK_CUR) {
+        base = (int)f->offset;
+    } else if (whence == SEEK_END) {
+        size_t size;
+        int is_dir;
+        if (vfs_stat(f->name, &size, &is_dir) == 0) {
+            base = (int)size;
+        }
+    }
+    int pos = base < 0 ? -1 : base + offset;
+    if (pos >= 0) {
+        f->offset = (uint32_t)pos;
+    } else {
+        pos = -1;
+    }
+    mutex_unlock(&f->lock);
+    return pos;
+}
+
+int file_readdir(int fd, dirent_t *ent) {
+    file_t *f = fd_file(fd);
+    if (!f || f->type != FILE_DIR) {
+        return -1;
+    }
+
+    dirent_t d;
+    memset(&d, 0, sizeof(d));
+    mutex_lock(&f->lock);
+    size_t len;
+    int is_dir;
+    int found = vfs_list_dir_entry(f->offset, d.name, &len, &is_dir) != 0;
+    if (found) {
+        d.is_dir = (uint32_t)is_dir;
+        size_t size = 0;
+        if (!is_dir && vfs_stat(d.name, &size, &is_dir) == 0) {
+            d.size = (uint32_t)size;
+        }
+        f->offset++;
+    }
+    mutex_unlock(&f->lock);
+
+    if (found) {
+        *ent = d;
+    }
+    return found;
+}
+
+int file_stat(const char *path, stat_t *st) {
+    size_t size;
+    int is_dir;
+    if (vfs_stat(path, &size, &is_dir) != 0) {
+        return -1;
+    }
+    st->size = (uint32_t)size;
+    st->is_dir = (uint32_t)is_dir;
+    return 0;
+}
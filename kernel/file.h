@@ -0,0 +1,59 @@
+/*
+ * file.h - Open files and per-process descriptor tables
+ *
+ * A descriptor indexes the calling task's files[], whose entries point
+ * into a shared pool of open files. fork() shares them (and their
+ * offsets) with the child, as on Unix; the console is one file that every
+ * table starts with on fds 0-2 and is never freed.
+ */
+
+#ifndef FILE_H
+#define FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fs.h"
+#include "sync.h"
+#include "syscall.h"
+
+/* Open files system-wide */
+#define FILE_MAX 64
+
+typedef enum {
+    FILE_FREE = 0,
+    FILE_CONSOLE,                   /* Keyboard in, screen out */
+    FILE_REG,                       /* Regular file in the current directory */
+    FILE_DIR                        /* The current directory, for readdir */
+} file_type_t;
+
+typedef struct file {
+    file_type_t type;
+    int flags;                      /* O_* given to open() */
+    uint32_t refs;                  /* Descriptors pointing here */
+    uint32_t offset;
+    mutex_t lock;                   /* Orders I/O through a shared offset */
+    char name[FS_MAX_NAME + 1];
+} file_t;
+
+struct process;
+
+/* Give child a copy of parent's table, or the console on fds 0-2 if the
+ * parent is a kernel thread */
+void file_inherit(struct process *child, struct process *parent);
+
+/* Drop every descriptor of p; safe to call more than once */
+void file_close_all(struct process *p);
+
+/* Descriptor calls act on the current task's table and return -1 on
+ * error. Buffers must already be known to be the caller's. */
+int file_open(const char *path, int flags);
+int file_close(int fd);
+int file_read(int fd, void *buf, size_t len);
+int file_write(int fd, const void *buf, size_t len);
+int file_writev(int fd, const iovec_t *iov, int count);
+int file_lseek(int fd, int offset, int whence);
+int file_readdir(int fd, dirent_t *ent);
+int file_stat(const char *path, stat_t *st);
+
+#endif /* FILE_H */
@@ -0,0 +1,163 @@
+/*
+ * fpu.c - Lazy x87/SSE state switching
+ *
+ * A task's registers are saved when it is switched out after using the
+ * FPU in that slice, so it can resume on any CPU. The registers also stay
+ * loaded: a CPU's fpu_owner whose state nobody has touched since gets
+ * them back without a trap or a restore.
+ */
+
+#include "fpu.h"
+
+#include "cpu.h"
+#include "idt.h"
+#include "process.h"
+#include "smp.h"
+#include "string.h"
+
+#define MXCSR_DEFAULT 0x1F80u   /* All SIMD exceptions masked */
+
+/* Smaller copies are not worth the CR0 writes */
+#define FPU_MEMCPY_MIN 256u
+
+static int enabled;
+
+static inline void clts(void) {
+    __asm__ volatile("clts");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void fxsave(fpu_state_t *s) {
+    __asm__ volatile("fxsave %0" : "=m"(*s));
+}
+
+static inline void fxrstor(const fpu_state_t *s) {
+    __asm__ volatile("fxrstor %0" : : "m"(*s));
+}
+
+/* #NM: the running task used the FPU with CR0.TS set */
+static void fpu_trap(registers_t *r) {
+    (void)r;
+    cpu_t *cpu = this_cpu();
+    process_t *p = cpu->current;
+
+    clts();
+    if (!p) {
+        return;  /* Boot code before the scheduler owns nothing */
+    }
+
+    if (cpu->fpu_owner != p || p->fpu_cpu != cpu->id) {
+        if (p->fpu_used) {
+            fxrstor(&p->fpu);
+        } else {
+            uint32_t mxcsr = MXCSR_DEFAULT;
+            __asm__ volatile("fninit; ldmxcsr %0" : : "m"(mxcsr));
+            p->fpu_used = 1;
+        }
+        cpu->fpu_owner = p;
+        p->fpu_cpu = cpu->id;
+    }
+    cpu->fpu_live = 1;
+}
+
+int fpu_init(void) {
+    uint32_t edx = cpuid_edx(1);
+    if (!(edx & CPUID_EDX_FXSR) || !(edx & CPUID_EDX_SSE)) {
+        return -1;
+    }
+
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    __asm__ volatile("fninit");
+
+    idt_register_handler(7, fpu_trap);
+    enabled = 1;
+    stts();
+    return 0;
+}
+
+int fpu_available(void) {
+    return enabled;
+}
+
+void fpu_task_init(process_t *p) {
+    p->fpu_used = 0;
+    p->fpu_cpu = FPU_NO_CPU;
+}
+
+void fpu_switch(process_t *prev, process_t *next) {
+    if (!enabled) {
+        return;
+    }
+
+    cpu_t *cpu = this_cpu();
+    if (cpu->fpu_live) {
+        fxsave(&prev->fpu);
+        cpu->fpu_live = 0;
+    }
+
+    if (cpu->fpu_owner == next && next->fpu_cpu == cpu->id) {
+        clts();  /* Its registers are still here and current */
+        cpu->fpu_live = 1;
+    } else {
+        stts();
+    }
+}
+
+uint32_t kernel_fpu_begin(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+
+    if (enabled) {
+        cpu_t *cpu = this_cpu();
+        if (cpu->fpu_live) {
+            fxsave(&cpu->fpu_owner->fpu);
+            cpu->fpu_live = 0;
+        }
+        cpu->fpu_owner = 0;  /* The kernel clobbers the registers */
+        clts();
+    }
+    return flags;
+}
+
+void kernel_fpu_end(uint32_t flags) {
+    if (enabled) {
+        stts();
+    }
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+}
+
+void *fpu_memcpy(void *dst, const void *src, size_t n) {
+    if (!enabled || n < FPU_MEMCPY_MIN) {
+        return memcpy(dst, src, n);
+    }
+
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+    size_t blocks = n / 64;
+
+    uint32_t flags = kernel_fpu_begin();
+    while (blocks--) {
+        __asm__ volatile(
+            "movups   (%0), %%xmm0\n\t"
+            "movups 16(%0), %%xmm1\n\t"
+            "movups 32(%0), %%xmm2\n\t"
+            "movups 48(%0), %%xmm3\n\t"
+            "movups %%xmm0,   (%1)\n\t"
+            "movups %%xmm1, 16(%1)\n\t"
+            "movups %%xmm2, 32(%1)\n\t"
+            "movups %%xmm3, 48(%1)"
+            : : "r"(s), "r"(d) : "memory");
+        s += 64;
+        d += 64;
+    }
+    kernel_fpu_end(flags);
+
+    memcpy(d, s, n % 64);
+    return dst;
+}
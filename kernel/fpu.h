@@ -0,0 +1,45 @@
+/*
+ * fpu.h - Lazy x87/SSE state switching
+ *
+ * Every task has an FXSAVE area. CR0.TS is set whenever the FPU registers
+ * do not hold the running task's state, so its first x87 or SSE
+ * instruction after a switch traps (#NM) and loads it: tasks that never
+ * touch the FPU never pay for a save or restore. Kernel code may use SSE
+ * between kernel_fpu_begin() and kernel_fpu_end().
+ */
+
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FPU_STATE_SIZE 512
+
+/* fpu_cpu of a task whose state is in no CPU's registers */
+#define FPU_NO_CPU 0xFFFFFFFFu
+
+typedef struct {
+    uint8_t data[FPU_STATE_SIZE];
+} __attribute__((aligned(16))) fpu_state_t;
+
+struct process;
+
+/* Enable FXSAVE/SSE on this CPU; returns 0 if supported */
+int fpu_init(void);
+int fpu_available(void);
+
+/* New task: starts from a clean FPU on first use */
+void fpu_task_init(struct process *p);
+
+/* Called by the scheduler before switching, interrupts off */
+void fpu_switch(struct process *prev, struct process *next);
+
+/* Bracket kernel SSE use; interrupts stay off in between */
+uint32_t kernel_fpu_begin(void);
+void kernel_fpu_end(uint32_t flags);
+
+/* memcpy() with SSE for large copies (non-overlapping) */
+void *fpu_memcpy(void *dst, const void *src, size_t n);
+
+#endif /* FPU_H */
@@ -3,73 +3,19 @@
 #include <stdint.h>
 
 #include "disk.h"
+#include "fs_layout.h"
+#include "journal.h"
+#include "pagecache.h"
+#include "paging.h"
 #include "string.h"
+#include "trace.h"
 
-#define FAT_LBA_START 4096u
-#define FAT_TOTAL_SECTORS 8192u
-#define FAT_SECTORS_PER_CLUSTER 1u
-#define FAT_RESERVED_SECTORS 1u
-#define FAT_FAT_COUNT 1u
-#define FAT_ROOT_ENTRIES 128u
-#define FAT_SECTORS_PER_FAT 32u
-
-#define FAT_ROOT_DIR_SECTORS ((FAT_ROOT_ENTRIES * 32u + 511u) / 512u)
-#define FAT_FIRST_DATA_SECTOR (FAT_RESERVED_SECTORS + (FAT_FAT_COUNT * FAT_SECTORS_PER_FAT) + FAT_ROOT_DIR_SECTORS)
-#define FAT_DATA_SECTORS (FAT_TOTAL_SECTORS - FAT_FIRST_DATA_SECTOR)
-#define FAT_CLUSTER_COUNT (FAT_DATA_SECTORS / FAT_SECTORS_PER_CLUSTER)
-#define FAT_CLUSTER_MIN 2u
-#define FAT_CLUSTER_MAX (FAT_CLUSTER_MIN + FAT_CLUSTER_COUNT - 1u)
-
-#define FAT_ATTR_ARCHIVE 0x20
-#define FAT16_EOC 0xFFFFu
-
-#define FAT_EU_SIZE (FAT_SECTORS_PER_FAT * 512u)
-#define ROOT_EU_SIZE (FAT_ROOT_DIR_SECTORS * 512u)
-
-typedef struct {
-    uint8_t jmp_boot[3];
-    char oem_name[8];
-    uint16_t bytes_per_sector;
-    uint8_t sectors_per_cluster;
-    uint16_t reserved_sector_count;
-    uint8_t num_fats;
-    uint16_t root_entry_count;
-    uint16_t total_sectors_16;
-    uint8_t media;
-    uint16_t fat_size_16;
-    uint16_t sectors_per_track;
-    uint16_t num_heads;
-    uint32_t hidden_sectors;
-    uint32_t total_sectors_32;
-    uint8_t drive_number;
-    uint8_t reserved1;
-    uint8_t boot_signature;
-    uint32_t volume_id;
-    char volume_label[11];
-    char fs_type[8];
-    uint8_t boot_code[448];
-    uint16_t signature;
-} __attribute__((packed)) fat16_boot_sector_t;
-
-typedef struct {
-    char name[8];
-    char ext[3];
-    uint8_t attr;
-    uint8_t ntres;
-    uint8_t crt_time_tenth;
-    uint16_t crt_time;
-    uint16_t crt_date;
-    uint16_t lst_acc_date;
-    uint16_t fst_clus_hi;
-    uint16_t wrt_time;
-    uint16_t wrt_date;
-    uint16_t fst_clus_lo;
-    uint32_t file_size;
-} __attribute__((packed)) fat_dir_entry_t;
+/* Files read ahead of a directory scan, at most */
+#define READAHEAD_MAX 8u
 
 static uint8_t fat_buf[FAT_EU_SIZE];
 static uint8_t root_buf[ROOT_EU_SIZE];
-static char read_cache[FS_MAX_FILE_SIZE + 1];
+static uint8_t ino_buf[512]; /* Directory sector read by ino_entry() */
 static int fs_ready;
 
 /* Current directory tracking */
@@ -77,6 +23,11 @@ static uint16_t current_dir_cluster; /* 0 = root directory */
 static char current_path[FS_MAX_PATH];
 static uint8_t dir_buf[512]; /* Buffer for reading subdirectory clusters */
 
+/* Metadata sectors modified since the last commit */
+static uint32_t fat_dirty;   /* One bit per FAT sector */
+static uint32_t root_dirty;  /* One bit per root directory sector */
+static int subdir_dirty;     /* dir_buf holds an unflushed change */
+
 static uint32_t root_lba(void) {
     return FAT_LBA_START + FAT_RESERVED_SECTORS + (FAT_FAT_COUNT * FAT_SECTORS_PER_FAT);
 }
@@ -85,6 +36,14 @@ static uint32_t data_lba(void) {
     return FAT_LBA_START + FAT_FIRST_DATA_SECTOR;
 }
 
+static uint32_t fat_lba(void) {
+    return FAT_LBA_START + FAT_RESERVED_SECTORS;
+}
+
+static uint32_t journal_lba(void) {
+    return FAT_LBA_START + 1u;
+}
+
 static uint32_t cluster_lba(uint16_t cluster) {
     return data_lba() + ((uint32_t)(cluster - FAT_CLUSTER_MIN) * FAT_SECTORS_PER_CLUSTER);
 }
@@ -128,10 +87,11 @@ static void fat_set(uint16_t cluster, uint16_t val) {
     uint32_t off = (uint32_t)cluster * 2u;
     fat_buf[off] = (uint8_t)(val & 0xFF);
     fat_buf[off + 1] = (uint8_t)((val >> 8) & 0xFF);
+    fat_dirty |= 1u << (off / 512u);
 }
 
 static int flush_fat(void) {
-    return disk_write_sectors(FAT_LBA_START + FAT_RESERVED_SECTORS, FAT_SECTORS_PER_FAT, fat_buf);
+    return disk_write_sectors(fat_lba(), FAT_SECTORS_PER_FAT, fat_buf);
 }
 
 static int flush_root(void) {
@@ -143,6 +103,10 @@ static int fat_format(void) {
         return -1;
     }
 
+    if (journal_format() != 0) {
+        return -1;
+    }
+
     memset(fat_buf, 0, sizeof(fat_buf));
     fat_set(0, 0xFFF8);
     fat_set(1, FAT16_EOC);
@@ -155,6 +119,7 @@ static int fat_format(void) {
         return -1;
     }
 
+    fat_dirty = 0;
     return 0;
 }
 
@@ -269,7 +234,67 @@ static fat_dir_entry_t *root_entries(void) {
 /* Forward declarations for directory functions */
 static fat_dir_entry_t *current_dir_entries(void);
 static int find_entry_in_current(const char *name, int *free_idx);
-static int flush_current_dir(void);
+
+/* Record that directory entry idx of the current directory changed */
+static void mark_dirent(int idx) {
+    if (current_dir_cluster == 0) {
+        root_dirty |= 1u << ((uint32_t)idx * sizeof(fat_dir_entry_t) / 512u);
+    } else {
+        subdir_dirty = 1;
+    }
+}
+
+/* Write every dirty FAT and directory sector as one journal transaction */
+static int fs_commit(void) {
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_COMMIT);
+    journal_begin();
+
+    for (uint32_t s = 0; s < FAT_SECTORS_PER_FAT; s++) {
+        if ((fat_dirty & (1u << s)) && journal_add(fat_lba() + s, fat_buf + s * 512u) != 0) {
+            goto fail;
+        }
+    }
+    for (uint32_t s = 0; s < FAT_ROOT_DIR_SECTORS; s++) {
+        if ((root_dirty & (1u << s)) && journal_add(root_lba() + s, root_buf + s * 512u) != 0) {
+            goto fail;
+        }
+    }
+    if (subdir_dirty && journal_add(cluster_lba(current_dir_cluster), dir_buf) != 0) {
+        goto fail;
+    }
+
+    if (journal_commit() != 0) {
+        goto fail;
+    }
+
+    fat_dirty = 0;
+    root_dirty = 0;
+    subdir_dirty = 0;
+    TRACE(TRACE_FS_END, 0);
+    return 0;
+
+fail:
+    journal_abort();
+    TRACE(TRACE_FS_END, -1);
+    return -1;
+}
+
+/* Throw away uncommitted changes by reloading dirty sectors as last committed */
+static void fs_rollback(void) {
+    for (uint32_t s = 0; s < FAT_SECTORS_PER_FAT; s++) {
+        if (fat_dirty & (1u << s)) {
+            journal_read_block(fat_lba() + s, fat_buf + s * 512u);
+        }
+    }
+    for (uint32_t s = 0; s < FAT_ROOT_DIR_SECTORS; s++) {
+        if (root_dirty & (1u << s)) {
+            journal_read_block(root_lba() + s, root_buf + s * 512u);
+        }
+    }
+    fat_dirty = 0;
+    root_dirty = 0;
+    subdir_dirty = 0;
+}
 
 static int find_entry(const char *name, int *free_idx) {
     char f11[11];
@@ -330,36 +355,167 @@ static void free_chain(uint16_t first) {
     }
 }
 
-static int load_cluster_chain(uint16_t first, uint32_t size) {
-    if (size > FS_MAX_FILE_SIZE) {
-        size = FS_MAX_FILE_SIZE;
-    }
-
-    uint32_t copied = 0;
+/* Read len bytes from offset (a multiple of 512) of a chain straight
+ * into dst, which has room for whole sectors. Runs of adjacent clusters
+ * go to the disk as one request. Returns the bytes read, fewer if the
+ * chain ends early. */
+static int load_cluster_chain(uint16_t first, uint32_t offset, uint32_t len, uint8_t *dst) {
     uint16_t c = first;
+    for (uint32_t skip = offset / 512u; skip > 0 && c >= FAT_CLUSTER_MIN && c <= FAT_CLUSTER_MAX; skip--) {
+        c = fat_get(c);
+    }
 
-    while (c >= FAT_CLUSTER_MIN && c <= FAT_CLUSTER_MAX && copied < size) {
-        uint8_t sec[512];
-        if (disk_read_sectors(cluster_lba(c), 1, sec) != 0) {
+    uint32_t sectors = (len + 511u) / 512u;
+    uint32_t done = 0;
+    while (done < sectors && c >= FAT_CLUSTER_MIN && c <= FAT_CLUSTER_MAX) {
+        uint16_t start = c;
+        uint32_t run = 1;
+        uint16_t next = fat_get(c);
+        while (done + run < sectors && next == c + 1u && run < 255u) {
+            c = next;
+            run++;
+            next = fat_get(c);
+        }
+        if (disk_read_sectors(cluster_lba(start), (uint8_t)run, dst + done * 512u) != 0) {
             return -1;
         }
+        done += run;
+        c = next;
+    }
 
-        uint32_t take = size - copied;
-        if (take > 512) {
-            take = 512;
+    return (int)(done * 512u < len ? done * 512u : len);
+}
+
+/* Inode numbers name a directory slot: the directory's first cluster
+ * (0: root) above the index of the entry in it */
+static uint32_t make_ino(uint16_t dir_cluster, int idx) {
+    return ((uint32_t)dir_cluster << 16) | (uint32_t)idx;
+}
+
+/* Copy the regular file entry behind ino */
+static int ino_entry(uint32_t ino, fat_dir_entry_t *out) {
+    uint16_t dir = (uint16_t)(ino >> 16);
+    uint32_t idx = ino & 0xFFFFu;
+    const fat_dir_entry_t *ent;
+    if (dir == 0) {
+        if (idx >= FS_MAX_FILES) {
+            return -1;
+        }
+        ent = root_entries();
+    } else {
+        if (idx >= 512u / sizeof(fat_dir_entry_t) ||
+            journal_read_block(cluster_lba(dir), ino_buf) != 0) {
+            return -1;
         }
-        memcpy(read_cache + copied, sec, take);
-        copied += take;
+        ent = (const fat_dir_entry_t *)ino_buf;
+    }
 
-        uint16_t next = fat_get(c);
-        if (next >= 0xFFF8 || next == 0x0000) {
+    uint8_t lead = (uint8_t)ent[idx].name[0];
+    if (lead == 0x00 || lead == 0xE5 || (ent[idx].attr & FS_ATTR_DIRECTORY)) {
+        return -1;
+    }
+    *out = ent[idx];
+    return 0;
+}
+
+static uint32_t file_bytes(const fat_dir_entry_t *e) {
+    if (e->fst_clus_lo < FAT_CLUSTER_MIN) {
+        return 0;
+    }
+    return e->file_size < FS_MAX_FILE_SIZE ? e->file_size : FS_MAX_FILE_SIZE;
+}
+
+/* Page index of file e in a new frame, zero-filled past the end */
+static uint32_t read_page(const fat_dir_entry_t *e, uint32_t index) {
+    uint32_t frame = frame_alloc();
+    if (!frame) {
+        return 0;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_READ_PAGE);
+    uint32_t offset = index * PAGE_SIZE;
+    uint32_t size = file_bytes(e);
+    uint32_t len = size - offset < PAGE_SIZE ? size - offset : PAGE_SIZE;
+    int got = load_cluster_chain(e->fst_clus_lo, offset, len, (uint8_t *)frame);
+    TRACE(TRACE_FS_END, got);
+    if (got < 0) {
+        frame_free(frame);
+        return 0;
+    }
+    memset((uint8_t *)frame + got, 0, PAGE_SIZE - (uint32_t)got);
+    return frame;
+}
+
+/* Read-ahead follows scans through a directory. Files are a page at
+ * most, so the stream is over inodes rather than the pages of one file:
+ * using the slot after the last one used doubles the window, up to
+ * READAHEAD_MAX files, and the files that far ahead are read in.
+ * Anything else starts over. */
+static uint32_t ra_last = 0xFFFFFFFFu;
+static uint32_t ra_window;
+static uint32_t ra_next;     /* First slot not read ahead yet */
+
+static void readahead(uint32_t ino) {
+    if (ino == ra_last) {
+        return;
+    }
+    if (ino != ra_last + 1u) {
+        ra_last = ino;
+        ra_window = 0;
+        ra_next = ino + 1u;
+        return;
+    }
+    ra_last = ino;
+    ra_window = ra_window ? ra_window * 2u : 1u;
+    if (ra_window > READAHEAD_MAX) {
+        ra_window = READAHEAD_MAX;
+    }
+
+    uint32_t dir = ino & 0xFFFF0000u;
+    uint32_t slots = dir ? 512u / sizeof(fat_dir_entry_t) : FS_MAX_FILES;
+    uint32_t end = ino + 1u + ra_window;
+    if (end > dir + slots) {
+        end = dir + slots;
+    }
+    if (ra_next <= ino) {
+        ra_next = ino + 1u;
+    }
+    for (; ra_next < end; ra_next++) {
+        fat_dir_entry_t e;
+        if (ino_entry(ra_next, &e) != 0 || file_bytes(&e) == 0 ||
+            pagecache_lookup(ra_next, 0, PC_PROBE)) {
+            continue;
+        }
+        uint32_t frame = read_page(&e, 0);
+        if (!frame) {
             break;
         }
-        c = next;
+        if (pagecache_insert(ra_next, 0, frame, PC_READAHEAD) != 0) {
+            frame_free(frame);
+        }
+    }
+}
+
+/* Page index of file e (inode ino) through the page cache, read from
+ * disk on a miss; 0 if it is past the end or cannot be read. flags are
+ * pagecache_lookup() flags, applied to the page returned. */
+static uint32_t file_page(uint32_t ino, const fat_dir_entry_t *e, uint32_t index, int flags) {
+    if (index >= (file_bytes(e) + PAGE_SIZE - 1u) / PAGE_SIZE) {
+        return 0;
     }
 
-    read_cache[copied] = '\0';
-    return (int)copied;
+    uint32_t frame = pagecache_lookup(ino, index, flags);
+    if (!frame) {
+        frame = read_page(e, index);
+        if (frame && pagecache_insert(ino, index, frame, flags) != 0) {
+            frame_free(frame);
+            frame = 0;
+        }
+    }
+    if (frame) {
+        readahead(ino);
+    }
+    return frame;
 }
 
 static int write_cluster_chain(const char *data, uint32_t size, uint16_t *first_out) {
@@ -413,20 +569,27 @@ static int write_cluster_chain(const char *data, uint32_t size, uint16_t *first_
 void fs_init(void) {
     fs_ready = 0;
 
+    journal_init(journal_lba(), FAT_JOURNAL_SECTORS);
+
     fat16_boot_sector_t bs;
     if (disk_read_sectors(FAT_LBA_START, 1, &bs) != 0 || !valid_boot(&bs)) {
         if (fat_format() != 0) {
             return;
         }
+    } else if (journal_replay() < 0) {
+        return;
     }
 
-    if (disk_read_sectors(FAT_LBA_START + FAT_RESERVED_SECTORS, FAT_SECTORS_PER_FAT, fat_buf) != 0) {
+    if (disk_read_sectors(fat_lba(), FAT_SECTORS_PER_FAT, fat_buf) != 0) {
         return;
     }
     if (disk_read_sectors(root_lba(), FAT_ROOT_DIR_SECTORS, root_buf) != 0) {
         return;
     }
 
+    fat_dirty = 0;
+    root_dirty = 0;
+    subdir_dirty = 0;
     fs_ready = 1;
 }
 
@@ -455,8 +618,13 @@ int fs_touch(const char *name) {
     ent[free_idx].attr = FAT_ATTR_ARCHIVE;
     ent[free_idx].fst_clus_lo = 0;
     ent[free_idx].file_size = 0;
+    mark_dirent(free_idx);
 
-    return flush_current_dir();
+    if (fs_commit() != 0) {
+        fs_rollback();
+        return -1;
+    }
+    return 0;
 }
 
 int fs_remove(const char *name) {
@@ -476,15 +644,15 @@ int fs_remove(const char *name) {
     if (first >= FAT_CLUSTER_MIN) {
         free_chain(first);
     }
+    pagecache_drop(make_ino(current_dir_cluster, idx));
 
     ent[idx].name[0] = (char)0xE5;
     ent[idx].file_size = 0;
     ent[idx].fst_clus_lo = 0;
+    mark_dirent(idx);
 
-    if (flush_fat() != 0) {
-        return -2;
-    }
-    if (flush_current_dir() != 0) {
+    if (fs_commit() != 0) {
+        fs_rollback();
         return -2;
     }
 
@@ -513,25 +681,29 @@ int fs_write_raw(const char *name, const char *data, size_t len) {
         memcpy(ent[idx].name, f11, 8);
         memcpy(ent[idx].ext, f11 + 8, 3);
         ent[idx].attr = FAT_ATTR_ARCHIVE;
+        mark_dirent(idx);
     }
 
-    if (ent[idx].fst_clus_lo >= FAT_CLUSTER_MIN) {
-        free_chain(ent[idx].fst_clus_lo);
-        ent[idx].fst_clus_lo = 0;
-    }
-
+    /* Write the new chain while the old one is still allocated, so no
+     * cluster of the committed file is overwritten before the commit. */
     uint16_t first = 0;
     if (write_cluster_chain(data, (uint32_t)len, &first) != 0) {
+        fs_rollback();
         return -3;
     }
 
+    if (ent[idx].fst_clus_lo >= FAT_CLUSTER_MIN) {
+        free_chain(ent[idx].fst_clus_lo);
+    }
+
+    /* Only now: data may have come from the cached page */
+    pagecache_drop(make_ino(current_dir_cluster, idx));
     ent[idx].fst_clus_lo = first;
     ent[idx].file_size = (uint32_t)len;
+    mark_dirent(idx);
 
-    if (flush_fat() != 0) {
-        return -4;
-    }
-    if (flush_current_dir() != 0) {
+    if (fs_commit() != 0) {
+        fs_rollback();
         return -4;
     }
 
@@ -543,61 +715,161 @@ int fs_write(const char *name, const char *text) {
 }
 
 int fs_append(const char *name, const char *text) {
-    if (!fs_ready) {
+    if (!fs_ready || !valid_name(name)) {
         return -1;
     }
 
-    size_t old_len = 0;
-    const char *old = fs_read_ptr(name, &old_len);
-    if (!old) {
-        old_len = 0;
+    size_t add = strlen(text);
+    int idx = find_entry_in_current(name, 0);
+    if (idx < 0) {
+        return fs_write_raw(name, text, add);
     }
 
-    size_t add = strlen(text);
-    if (old_len + add > FS_MAX_FILE_SIZE) {
+    fat_dir_entry_t *ent = current_dir_entries();
+    if (!ent) return -1;
+
+    if (ent[idx].attr & FS_ATTR_DIRECTORY) {
+        return -1;
+    }
+
+    uint32_t size = ent[idx].file_size;
+    uint16_t first = ent[idx].fst_clus_lo;
+    if (size + add > FS_MAX_FILE_SIZE) {
         return -1;
     }
+    if (add == 0) {
+        return 0;
+    }
+    if (size > 0 && first < FAT_CLUSTER_MIN) {
+        return -1;
+    }
+
+    /* Locate the cluster holding the last byte of the file */
+    uint16_t tail = 0;
+    if (size > 0) {
+        uint32_t hops = (size - 1u) / 512u;
+        tail = first;
+        while (hops-- > 0) {
+            uint16_t next = fat_get(tail);
+            if (next < FAT_CLUSTER_MIN || next > FAT_CLUSTER_MAX) {
+                return -1;
+            }
+            tail = next;
+        }
+    }
+
+    /* Fill the unused part of the tail cluster in place. Bytes past the
+     * committed file_size are not part of the file until the commit. */
+    uint32_t used = size % 512u;
+    uint32_t written = 0;
+    if (tail && used != 0) {
+        uint8_t sec[512];
+        if (disk_read_sectors(cluster_lba(tail), 1, sec) != 0) {
+            return -3;
+        }
+        written = 512u - used;
+        if (written > add) {
+            written = (uint32_t)add;
+        }
+        memcpy(sec + used, text, written);
+        if (disk_write_sectors(cluster_lba(tail), 1, sec) != 0) {
+            return -3;
+        }
+    }
+
+    /* Extend the chain with fresh clusters for the remainder */
+    if (written < add) {
+        uint16_t ext = 0;
+        if (write_cluster_chain(text + written, (uint32_t)add - written, &ext) != 0) {
+            fs_rollback();
+            return -3;
+        }
+        if (tail) {
+            fat_set(tail, ext);
+        } else {
+            /* An empty file may still own clusters (written by another
+             * tool); they go in the same transaction */
+            if (first >= FAT_CLUSTER_MIN) {
+                free_chain(first);
+            }
+            ent[idx].fst_clus_lo = ext;
+        }
+    }
 
-    memcpy(read_cache, old ? old : "", old_len);
-    memcpy(read_cache + old_len, text, add);
-    read_cache[old_len + add] = '\0';
+    pagecache_drop(make_ino(current_dir_cluster, idx));
+    ent[idx].file_size = size + (uint32_t)add;
+    mark_dirent(idx);
 
-    return fs_write_raw(name, read_cache, old_len + add);
+    if (fs_commit() != 0) {
+        fs_rollback();
+        return -4;
+    }
+
+    return 0;
 }
 
-const char *fs_read_ptr(const char *name, size_t *len) {
+int fs_read(const char *name, size_t off, void *dst, size_t len, size_t *size) {
     if (!fs_ready) {
-        return 0;
+        return -1;
     }
 
     int idx = find_entry_in_current(name, 0);
     if (idx < 0) {
-        return 0;
+        return -1;
     }
 
     fat_dir_entry_t *ent = current_dir_entries();
-    if (!ent) return 0;
+    if (!ent) return -1;
 
-    uint32_t size = ent[idx].file_size;
-    uint16_t first = ent[idx].fst_clus_lo;
+    uint32_t bytes = ent[idx].file_size;
+    if (ent[idx].fst_clus_lo < FAT_CLUSTER_MIN) {
+        bytes = 0;
+    }
+    if (bytes > FS_MAX_FILE_SIZE) {
+        bytes = FS_MAX_FILE_SIZE;
+    }
+    if (size) {
+        *size = bytes;
+    }
+    if (off >= bytes) {
+        return 0;
+    }
+    if (len > bytes - off) {
+        len = bytes - off;
+    }
 
-    if (size == 0 || first < FAT_CLUSTER_MIN) {
-        read_cache[0] = '\0';
-        if (len) {
-            *len = 0;
-        }
-        return read_cache;
+    /* Copy from the cached page, holding a share of it so that neither
+     * reclaim nor a drop frees the frame in the meantime */
+    uint32_t frame = file_page(make_ino(current_dir_cluster, idx), &ent[idx], 0, PC_SHARE);
+    if (!frame) {
+        return -1;
     }
+    memcpy(dst, (const char *)frame + off, len);
+    frame_free(frame);
+    return (int)len;
+}
 
-    int got = load_cluster_chain(first, size);
-    if (got < 0) {
-        return 0;
+int fs_lookup(const char *name, uint32_t *ino, size_t *size) {
+    if (!fs_ready) {
+        return -1;
     }
 
-    if (len) {
-        *len = (size_t)got;
+    int idx = find_entry_in_current(name, 0);
+    fat_dir_entry_t *ent = current_dir_entries();
+    if (idx < 0 || !ent || (ent[idx].attr & FS_ATTR_DIRECTORY)) {
+        return -1;
     }
-    return read_cache;
+    *ino = make_ino(current_dir_cluster, idx);
+    *size = ent[idx].file_size < FS_MAX_FILE_SIZE ? ent[idx].file_size : FS_MAX_FILE_SIZE;
+    return 0;
+}
+
+uint32_t fs_page(uint32_t ino, uint32_t index) {
+    fat_dir_entry_t e;
+    if (!fs_ready || ino_entry(ino, &e) != 0) {
+        return 0;
+    }
+    return file_page(ino, &e, index, PC_SHARE);
 }
 
 int fs_list_entry(size_t index, const char **name, size_t *len) {
@@ -649,7 +921,7 @@ static fat_dir_entry_t *current_dir_entries(void) {
         return (fat_dir_entry_t *)root_buf;
     }
     /* Load subdirectory cluster into dir_buf */
-    if (disk_read_sectors(cluster_lba(current_dir_cluster), 1, dir_buf) != 0) {
+    if (journal_read_block(cluster_lba(current_dir_cluster), dir_buf) != 0) {
         return 0;
     }
     return (fat_dir_entry_t *)dir_buf;
@@ -696,14 +968,6 @@ static int find_entry_in_current(const char *name, int *free_idx) {
     return -1;
 }
 
-/* Flush current directory to disk */
-static int flush_current_dir(void) {
-    if (current_dir_cluster == 0) {
-        return flush_root();
-    }
-    return disk_write_sectors(cluster_lba(current_dir_cluster), 1, dir_buf);
-}
-
 int fs_mkdir(const char *name) {
     if (!fs_ready || !valid_name(name)) {
         return -1;
@@ -744,13 +1008,16 @@ int fs_mkdir(const char *name) {
     dotdot->fst_clus_lo = current_dir_cluster;
 
     if (disk_write_sectors(cluster_lba(dir_cluster), 1, new_dir) != 0) {
-        free_chain(dir_cluster);
+        fs_rollback();
         return -4;
     }
 
     /* Create directory entry in current directory */
     fat_dir_entry_t *ent = current_dir_entries();
-    if (!ent) return -5;
+    if (!ent) {
+        fs_rollback();
+        return -5;
+    }
 
     char f11[11];
     fat_name_from_input(name, f11);
@@ -760,9 +1027,12 @@ int fs_mkdir(const char *name) {
     ent[free_idx].attr = FS_ATTR_DIRECTORY;
     ent[free_idx].fst_clus_lo = dir_cluster;
     ent[free_idx].file_size = 0;
+    mark_dirent(free_idx);
 
-    if (flush_fat() != 0) return -6;
-    if (flush_current_dir() != 0) return -6;
+    if (fs_commit() != 0) {
+        fs_rollback();
+        return -6;
+    }
 
     return 0;
 }
@@ -790,7 +1060,7 @@ int fs_rmdir(const char *name) {
 
     /* Check if directory is empty (only . and .. entries) */
     uint8_t check_buf[512];
-    if (disk_read_sectors(cluster_lba(dir_cluster), 1, check_buf) != 0) {
+    if (journal_read_block(cluster_lba(dir_cluster), check_buf) != 0) {
         return -3;
     }
 
@@ -809,9 +1079,12 @@ int fs_rmdir(const char *name) {
     /* Mark entry as deleted */
     ent[idx].name[0] = (char)0xE5;
     ent[idx].fst_clus_lo = 0;
+    mark_dirent(idx);
 
-    if (flush_fat() != 0) return -5;
-    if (flush_current_dir() != 0) return -5;
+    if (fs_commit() != 0) {
+        fs_rollback();
+        return -5;
+    }
 
     return 0;
 }
@@ -2,6 +2,7 @@
 #define FS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define FS_MAX_FILES 32
 #define FS_MAX_NAME 23
@@ -17,7 +18,16 @@ int fs_remove(const char *name);
 int fs_write(const char *name, const char *text);
 int fs_append(const char *name, const char *text);
 int fs_write_raw(const char *name, const char *data, size_t len);
-const char *fs_read_ptr(const char *name, size_t *len);
+/* Copy up to len bytes of the file from offset off, with its size in
+ * *size; bytes copied or -1 */
+int fs_read(const char *name, size_t off, void *dst, size_t len, size_t *size);
+
+/* Inode and size of a regular file in the current directory */
+int fs_lookup(const char *name, uint32_t *ino, size_t *size);
+
+/* Cached frame holding page index of ino, read in on a miss, with a
+ * share of it taken for the caller; 0 if the file is gone or shorter */
+uint32_t fs_page(uint32_t ino, uint32_t index);
 int fs_list_entry(size_t index, const char **name, size_t *len);
 
 /* Directory operations */
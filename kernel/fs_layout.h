@@ -0,0 +1,76 @@
+/*
+ * fs_layout.h - On-disk layout of the OsU FAT16 volume
+ *
+ * Shared by the kernel driver (fs.c) and the host image tool
+ * (tools/osufs.c) so both agree on the geometry valid_boot() accepts.
+ */
+
+#ifndef FS_LAYOUT_H
+#define FS_LAYOUT_H
+
+#include <stdint.h>
+
+#define FAT_LBA_START 4096u
+#define FAT_TOTAL_SECTORS 8192u
+#define FAT_SECTORS_PER_CLUSTER 1u
+#define FAT_JOURNAL_SECTORS 64u
+#define FAT_RESERVED_SECTORS (1u + FAT_JOURNAL_SECTORS) /* boot sector + log */
+#define FAT_FAT_COUNT 1u
+#define FAT_ROOT_ENTRIES 128u
+#define FAT_SECTORS_PER_FAT 32u
+
+#define FAT_ROOT_DIR_SECTORS ((FAT_ROOT_ENTRIES * 32u + 511u) / 512u)
+#define FAT_FIRST_DATA_SECTOR (FAT_RESERVED_SECTORS + (FAT_FAT_COUNT * FAT_SECTORS_PER_FAT) + FAT_ROOT_DIR_SECTORS)
+#define FAT_DATA_SECTORS (FAT_TOTAL_SECTORS - FAT_FIRST_DATA_SECTOR)
+#define FAT_CLUSTER_COUNT (FAT_DATA_SECTORS / FAT_SECTORS_PER_CLUSTER)
+#define FAT_CLUSTER_MIN 2u
+#define FAT_CLUSTER_MAX (FAT_CLUSTER_MIN + FAT_CLUSTER_COUNT - 1u)
+
+#define FAT_ATTR_ARCHIVE 0x20
+#define FAT16_EOC 0xFFFFu
+
+#define FAT_EU_SIZE (FAT_SECTORS_PER_FAT * 512u)
+#define ROOT_EU_SIZE (FAT_ROOT_DIR_SECTORS * 512u)
+
+typedef struct {
+    uint8_t jmp_boot[3];
+    char oem_name[8];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_sector_count;
+    uint8_t num_fats;
+    uint16_t root_entry_count;
+    uint16_t total_sectors_16;
+    uint8_t media;
+    uint16_t fat_size_16;
+    uint16_t sectors_per_track;
+    uint16_t num_heads;
+    uint32_t hidden_sectors;
+    uint32_t total_sectors_32;
+    uint8_t drive_number;
+    uint8_t reserved1;
+    uint8_t boot_signature;
+    uint32_t volume_id;
+    char volume_label[11];
+    char fs_type[8];
+    uint8_t boot_code[448];
+    uint16_t signature;
+} __attribute__((packed)) fat16_boot_sector_t;
+
+typedef struct {
+    char name[8];
+    char ext[3];
+    uint8_t attr;
+    uint8_t ntres;
+    uint8_t crt_time_tenth;
+    uint16_t crt_time;
+    uint16_t crt_date;
+    uint16_t lst_acc_date;
+    uint16_t fst_clus_hi;
+    uint16_t wrt_time;
+    uint16_t wrt_date;
+    uint16_t fst_clus_lo;
+    uint32_t file_size;
+} __attribute__((packed)) fat_dir_entry_t;
+
+#endif /* FS_LAYOUT_H */
@@ -4,6 +4,7 @@
  */
 
 #include "gfxcon.h"
+#include "fpu.h"
 #include "vesa.h"
 
 /* Console state */
@@ -57,9 +58,7 @@ static void scroll_up(void) {
 
         /* Copy each row up by 16 pixels (one character height) */
         for (int y = 0; y < (int)vesa_height - 16; y++) {
-            for (int x = 0; x < (int)vesa_width; x++) {
-                fb[y * row_pixels + x] = fb[(y + 16) * row_pixels + x];
-            }
+            fpu_memcpy(&fb[y * row_pixels], &fb[(y + 16) * row_pixels], vesa_width * 4);
         }
 
         /* Clear the last row */
@@ -76,9 +75,7 @@ static void scroll_up(void) {
         for (int y = 0; y < (int)vesa_height - 16; y++) {
             uint32_t dst = (uint32_t)y * vesa_pitch;
             uint32_t src = (uint32_t)(y + 16) * vesa_pitch;
-            for (int x = 0; x < (int)vesa_width * 3; x++) {
-                fb[dst + x] = fb[src + x];
-            }
+            fpu_memcpy(&fb[dst], &fb[src], vesa_width * 3);
         }
 
         for (int y = (int)vesa_height - 16; y < (int)vesa_height; y++) {
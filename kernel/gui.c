@@ -3,10 +3,12 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "clock.h"
 #include "keyboard.h"
 #include "mouse.h"
 #include "timer.h"
 #include "vesa.h"
+#include "wait.h"
 
 #define GUI_BAR_H 24
 #define WIN_TITLE_H 18
@@ -142,6 +144,19 @@ static void gui_log_line(const char *s) {
     log_lines[7][k] = '\0';
 }
 
+/* Off the run queue until a key or mouse packet arrives, or the taskbar
+ * clock reaches its next second */
+static void gui_wait_input(void) {
+    uint32_t next = (timer_get_ticks() / TIMER_FREQ + 1) * TIMER_FREQ;
+    uint64_t deadline = (uint64_t)next * (NSEC_PER_SEC / TIMER_FREQ);
+
+    uint32_t flags = wait_irq_save();
+    while (!keyboard_has_data() && !mouse_has_event() && clock_ns() < deadline) {
+        wait_sleep_until(&input_wait, deadline);
+    }
+    wait_irq_restore(flags);
+}
+
 void gui_run(void) {
     if (!vesa_enabled) {
         return;
@@ -169,7 +184,7 @@ void gui_run(void) {
     uint8_t last_buttons = 0;
 
     while (running) {
-        __asm__ volatile("sti; hlt");
+        gui_wait_input();
         mouse_state_t tmp;
         if (mouse_poll(&tmp)) {
             ms = tmp;
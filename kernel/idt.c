@@ -1,14 +1,14 @@
 #include "idt.h"
 
 #include "io.h"
+#include "process.h"
+#include "smp.h"
 #include "v86.h"
 #include "vga.h"
 
 #define IDT_ENTRIES 256
 #define KERNEL_CS 0x08
 #define KERNEL_DS 0x10
-#define USER_CS   0x1B  /* 0x18 | 3 (ring 3) */
-#define USER_DS   0x23  /* 0x20 | 3 (ring 3) */
 #define IDT_FLAG_INT_GATE 0x8E
 #define IDT_FLAG_INT_GATE_USER 0xEE  /* DPL=3 for user mode access */
 
@@ -42,11 +42,15 @@ typedef struct {
 
 static idt_entry_t idt[IDT_ENTRIES];
 static idt_ptr_t idt_ptr;
-static interrupt_handler_t handlers[IDT_ENTRIES];
+/* Called by vector; the FAST_IRQ stubs in isr.asm index it directly */
+interrupt_handler_t idt_handlers[IDT_ENTRIES];
 
-/* GDT with 6 entries: null, kernel code, kernel data, user code, user data, TSS */
-static gdt_entry_t gdt[6];
-static gdt_ptr_t gdt_ptr;
+/* One GDT per CPU with 8 entries: null, kernel code, kernel data, user
+ * code, user data, TSS, double-fault TSS, per-CPU data. Selectors are
+ * the same everywhere; the TSS and per-CPU bases differ. */
+#define GDT_ENTRIES 8
+static gdt_entry_t gdt[MAX_CPUS][GDT_ENTRIES];
+static gdt_ptr_t gdt_ptr[MAX_CPUS];
 
 extern void isr0(void);
 extern void isr1(void);
@@ -98,6 +102,20 @@ extern void irq13(void);
 extern void irq14(void);
 extern void irq15(void);
 
+extern void isr48(void);   /* LAPIC timer */
+extern void isr49(void);   /* Reschedule IPI */
+extern void isr50(void);   /* TLB shootdown IPI */
+extern void isr51(void);   /* Benchmark, common path */
+extern void isr52(void);   /* Benchmark, fast path */
+extern void isr64(void);   /* MSI vectors */
+extern void isr65(void);
+extern void isr66(void);
+extern void isr67(void);
+extern void isr68(void);
+extern void isr69(void);
+extern void isr70(void);
+extern void isr71(void);
+extern void isr255(void);  /* LAPIC spurious */
 extern void isr128(void);  /* Syscall interrupt */
 
 static void idt_set_gate(uint8_t n, uint32_t base, uint16_t selector, uint8_t flags) {
@@ -108,19 +126,30 @@ static void idt_set_gate(uint8_t n, uint32_t base, uint16_t selector, uint8_t fl
     idt[n].base_high = (uint16_t)((base >> 16) & 0xFFFF);
 }
 
-/* Set GDT entry */
-static void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
-    gdt[num].base_low = (uint16_t)(base & 0xFFFF);
-    gdt[num].base_middle = (uint8_t)((base >> 16) & 0xFF);
-    gdt[num].base_high = (uint8_t)((base >> 24) & 0xFF);
-    gdt[num].limit_low = (uint16_t)(limit & 0xFFFF);
-    gdt[num].granularity = (uint8_t)((limit >> 16) & 0x0F) | (gran & 0xF0);
-    gdt[num].access = access;
+/* Set an entry in cpu's GDT */
+static void gdt_set_gate(uint32_t cpu, int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt_entry_t *e = &gdt[cpu][num];
+    e->base_low = (uint16_t)(base & 0xFFFF);
+    e->base_middle = (uint8_t)((base >> 16) & 0xFF);
+    e->base_high = (uint8_t)((base >> 24) & 0xFF);
+    e->limit_low = (uint16_t)(limit & 0xFFFF);
+    e->granularity = (uint8_t)((limit >> 16) & 0x0F) | (gran & 0xF0);
+    e->access = access;
 }
 
-/* Set TSS descriptor in GDT */
-void gdt_set_tss(uint32_t base, uint32_t limit) {
-    gdt_set_gate(5, base, limit, 0x89, 0x00);  /* Present, DPL=0, TSS */
+/* Set TSS descriptor in cpu's GDT */
+void gdt_set_tss(uint32_t cpu, uint32_t base, uint32_t limit) {
+    gdt_set_gate(cpu, 5, base, limit, 0x89, 0x00);  /* Present, DPL=0, TSS */
+}
+
+/* Set double-fault TSS descriptor in cpu's GDT */
+void gdt_set_df_tss(uint32_t cpu, uint32_t base, uint32_t limit) {
+    gdt_set_gate(cpu, 6, base, limit, 0x89, 0x00);  /* Present, DPL=0, TSS */
+}
+
+/* Replace an interrupt gate with a task gate to a TSS selector */
+void idt_set_task_gate(uint8_t n, uint16_t tss_selector) {
+    idt_set_gate(n, 0, tss_selector, 0x85);  /* Present, DPL=0, task gate */
 }
 
 /* Make interrupt gate accessible from ring 3 */
@@ -128,19 +157,26 @@ void idt_set_gate_ring3(uint8_t n) {
     idt[n].flags = IDT_FLAG_INT_GATE_USER;
 }
 
-static void gdt_init(void) {
-    gdt_set_gate(0, 0, 0, 0, 0);                /* Null segment */
-    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF); /* Kernel code: ring 0 */
-    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF); /* Kernel data: ring 0 */
-    gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF); /* User code: ring 3 */
-    gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF); /* User data: ring 3 */
+/* Build and load cpu's GDT; %gs then addresses cpus[cpu] */
+static void gdt_init(uint32_t cpu) {
+    cpu_t *c = &cpus[cpu];
+    c->self = c;
+    c->id = cpu;
+
+    gdt_set_gate(cpu, 0, 0, 0, 0, 0);                /* Null segment */
+    gdt_set_gate(cpu, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF); /* Kernel code: ring 0 */
+    gdt_set_gate(cpu, 2, 0, 0xFFFFFFFF, 0x92, 0xCF); /* Kernel data: ring 0 */
+    gdt_set_gate(cpu, 3, 0, 0xFFFFFFFF, 0xFA, 0xCF); /* User code: ring 3 */
+    gdt_set_gate(cpu, 4, 0, 0xFFFFFFFF, 0xF2, 0xCF); /* User data: ring 3 */
     /* TSS will be set up by tss_init() */
-    gdt_set_gate(5, 0, 0, 0, 0);  /* Placeholder for TSS */
+    gdt_set_gate(cpu, 5, 0, 0, 0, 0);  /* Placeholder for TSS */
+    gdt_set_gate(cpu, 6, 0, 0, 0, 0);  /* Placeholder for double-fault TSS */
+    gdt_set_gate(cpu, 7, (uint32_t)c, sizeof(cpu_t) - 1, 0x92, 0x40); /* Per-CPU data */
 
-    gdt_ptr.limit = sizeof(gdt) - 1;
-    gdt_ptr.base = (uint32_t)&gdt;
+    gdt_ptr[cpu].limit = sizeof(gdt[cpu]) - 1;
+    gdt_ptr[cpu].base = (uint32_t)&gdt[cpu];
 
-    __asm__ volatile("lgdt %0" : : "m"(gdt_ptr));
+    __asm__ volatile("lgdt %0" : : "m"(gdt_ptr[cpu]));
 
     /* Reload segment registers */
     __asm__ volatile(
@@ -148,11 +184,12 @@ static void gdt_init(void) {
         "mov %%ax, %%ds\n\t"
         "mov %%ax, %%es\n\t"
         "mov %%ax, %%fs\n\t"
-        "mov %%ax, %%gs\n\t"
         "mov %%ax, %%ss\n\t"
+        "mov %0, %%ax\n\t"
+        "mov %%ax, %%gs\n\t"
         "ljmp $0x08, $1f\n\t"
         "1:\n\t"
-        : : : "eax"
+        : : "i"(PERCPU_SELECTOR) : "eax"
     );
 }
 
@@ -185,16 +222,16 @@ static void pic_remap(void) {
 }
 
 void idt_register_handler(uint8_t n, interrupt_handler_t handler) {
-    handlers[n] = handler;
+    idt_handlers[n] = handler;
 }
 
 void idt_init(void) {
     /* Initialize GDT first */
-    gdt_init();
+    gdt_init(0);
 
     for (int i = 0; i < IDT_ENTRIES; i++) {
         idt_set_gate((uint8_t)i, 0, 0, 0);
-        handlers[i] = 0;
+        idt_handlers[i] = 0;
     }
 
     idt_set_gate(0, (uint32_t)isr0, KERNEL_CS, IDT_FLAG_INT_GATE);
@@ -249,6 +286,24 @@ void idt_init(void) {
     idt_set_gate(46, (uint32_t)irq14, KERNEL_CS, IDT_FLAG_INT_GATE);
     idt_set_gate(47, (uint32_t)irq15, KERNEL_CS, IDT_FLAG_INT_GATE);
 
+    /* Local APIC timer and spurious vectors */
+    idt_set_gate(48, (uint32_t)isr48, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(IPI_RESCHED_VECTOR, (uint32_t)isr49, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(IPI_TLB_VECTOR, (uint32_t)isr50, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(255, (uint32_t)isr255, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(IRQ_BENCH_SLOW_VECTOR, (uint32_t)isr51, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(IRQ_BENCH_FAST_VECTOR, (uint32_t)isr52, KERNEL_CS, IDT_FLAG_INT_GATE);
+
+    /* PCI message signalled interrupts (PCI_MSI_VECTOR_BASE) */
+    idt_set_gate(64, (uint32_t)isr64, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(65, (uint32_t)isr65, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(66, (uint32_t)isr66, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(67, (uint32_t)isr67, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(68, (uint32_t)isr68, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(69, (uint32_t)isr69, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(70, (uint32_t)isr70, KERNEL_CS, IDT_FLAG_INT_GATE);
+    idt_set_gate(71, (uint32_t)isr71, KERNEL_CS, IDT_FLAG_INT_GATE);
+
     /* Syscall interrupt - accessible from ring 3 */
     idt_set_gate(0x80, (uint32_t)isr128, KERNEL_CS, IDT_FLAG_INT_GATE_USER);
 
@@ -261,6 +316,12 @@ void idt_init(void) {
     __asm__ volatile("lidt %0" : : "m"(idt_ptr));
 }
 
+/* Application processors share the IDT but get their own GDT */
+void idt_init_ap(uint32_t cpu) {
+    gdt_init(cpu);
+    __asm__ volatile("lidt %0" : : "m"(idt_ptr));
+}
+
 void isr_handler_c(registers_t *r) {
     /* Handle GP fault specially for V86 mode */
     if (r->int_no == 13 && v86_is_active()) {
@@ -270,16 +331,12 @@ void isr_handler_c(registers_t *r) {
         }
     }
 
-    if (handlers[r->int_no]) {
-        handlers[r->int_no](r);
+    if (idt_handlers[r->int_no]) {
+        idt_handlers[r->int_no](r);
     } else if (r->int_no < 32) {
         vga_printf("EXC %u err=%x\n", r->int_no, r->err_code);
-    }
-
-    if (r->int_no >= 32 && r->int_no <= 47) {
-        if (r->int_no >= 40) {
-            outb(0xA0, 0x20);
+        if ((r->cs & 3) && !(r->eflags & 0x20000)) {
+            process_exit(-1);  /* A faulting user program dies */
         }
-        outb(0x20, 0x20);
     }
 }
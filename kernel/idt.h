@@ -21,11 +21,27 @@ typedef struct registers {
     uint32_t eip;
     uint32_t cs;
     uint32_t eflags;
+    uint32_t useresp;      /* Only pushed on entry from ring 3 */
+    uint32_t ss;
 } registers_t;
 
+#define USER_CS 0x1B  /* 0x18 | 3 (ring 3) */
+#define USER_DS 0x23  /* 0x20 | 3 (ring 3) */
+
+/* IRQs enter through per-vector stubs that acknowledge the interrupt
+ * controller before the handler runs, so a handler that switches tasks
+ * (the timer) never leaves it waiting. These two vectors reach an empty
+ * handler through the exception path and the IRQ path, for "bench irq". */
+#define IRQ_BENCH_SLOW_VECTOR 51
+#define IRQ_BENCH_FAST_VECTOR 52
+
 typedef void (*interrupt_handler_t)(registers_t *r);
 
 void idt_init(void);
+void idt_init_ap(uint32_t cpu);
 void idt_register_handler(uint8_t n, interrupt_handler_t handler);
 
+/* Pop frame (built to look like one saved by an interrupt) and iret */
+void isr_return_to(const registers_t *frame) __attribute__((noreturn));
+
 #endif
@@ -0,0 +1,183 @@
+/*
+ * ioapic.c - ISA interrupt routing through the I/O APIC
+ *
+ * Each I/O APIC is reached through the uncached identity map of its MMIO
+ * window: a register index goes to IOREGSEL and the value through IOWIN,
+ * so every access to the pair holds ioapic_lock. ISA IRQs keep vectors
+ * 32-47, so handlers registered for the PIC work unchanged; the MADT
+ * says which input (GSI) each one arrives on and how it is signalled.
+ */
+
+#include "ioapic.h"
+
+#include "acpi.h"
+#include "io.h"
+#include "lapic.h"
+#include "smp.h"
+#include "sync.h"
+
+#define IOAPIC_REGSEL     0x00
+#define IOAPIC_WIN        0x10
+
+#define IOAPIC_REG_VER    0x01
+#define IOAPIC_REG_REDTBL 0x10    /* Two registers per entry */
+
+#define REDIR_ACTIVE_LOW  (1u << 13)
+#define REDIR_LEVEL       (1u << 15)
+#define REDIR_MASKED      (1u << 16)
+
+#define ISA_IRQS          16
+#define ISA_VECTOR_BASE   32
+#define PIC_CASCADE_IRQ   2       /* Never raised: the slave PIC's input */
+
+typedef struct {
+    volatile uint32_t *base;
+    uint32_t gsi_base;
+    uint32_t entries;
+} ioapic_t;
+
+typedef struct {
+    ioapic_t *io;                 /* 0: not routed */
+    uint32_t pin;
+    uint32_t low;                 /* Vector, polarity, trigger, mask */
+    uint32_t dest;                /* Local APIC ID */
+} isa_route_t;
+
+/* Nonzero once the I/O APIC routes ISA IRQs; the IRQ stubs in isr.asm
+ * read it to choose between a PIC and a local APIC EOI */
+volatile uint32_t ioapic_routing;
+
+static spinlock_t ioapic_lock = SPINLOCK_INIT;
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_count;
+static isa_route_t isa_route[ISA_IRQS];
+
+static uint32_t reg_read(ioapic_t *io, uint32_t reg) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    return io->base[IOAPIC_WIN / 4];
+}
+
+static void reg_write(ioapic_t *io, uint32_t reg, uint32_t value) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    io->base[IOAPIC_WIN / 4] = value;
+}
+
+/* Program the entry of isa_route[irq]; ioapic_lock held */
+static void route_write(uint8_t irq) {
+    isa_route_t *r = &isa_route[irq];
+    reg_write(r->io, IOAPIC_REG_REDTBL + 2 * r->pin + 1, r->dest << 24);
+    reg_write(r->io, IOAPIC_REG_REDTBL + 2 * r->pin, r->low);
+}
+
+static ioapic_t *ioapic_for(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        ioapic_t *io = &ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->entries) {
+            return io;
+        }
+    }
+    return 0;
+}
+
+static void pic_set_masked(uint8_t irq, int masked) {
+    uint16_t port = irq < 8 ? 0x21 : 0xA1;
+    uint8_t bit = (uint8_t)(1u << (irq & 7));
+    uint8_t mask = inb(port);
+    outb(port, masked ? (uint8_t)(mask | bit) : (uint8_t)(mask & ~bit));
+}
+
+int ioapic_init(void) {
+    if (!lapic_present() || acpi_init() != 0 || acpi_ioapic_count() == 0) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_count = 0;
+    for (uint32_t i = 0; i < acpi_ioapic_count(); i++) {
+        const acpi_ioapic_t *a = acpi_ioapic(i);
+        ioapic_t *io = &ioapics[ioapic_count++];
+        io->base = (volatile uint32_t *)(uintptr_t)a->addr;
+        io->gsi_base = a->gsi_base;
+        io->entries = ((reg_read(io, IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+        for (uint32_t pin = 0; pin < io->entries; pin++) {
+            reg_write(io, IOAPIC_REG_REDTBL + 2 * pin, REDIR_MASKED);
+        }
+    }
+
+    /* Lines the PICs had unmasked stay enabled */
+    uint32_t enabled = ~((uint32_t)inb(0x21) | ((uint32_t)inb(0xA1) << 8));
+    uint32_t dest = lapic_id();
+    for (uint8_t irq = 0; irq < ISA_IRQS; irq++) {
+        isa_route_t *r = &isa_route[irq];
+        uint16_t inti;
+        uint32_t gsi = acpi_isa_gsi(irq, &inti);
+        r->io = irq == PIC_CASCADE_IRQ ? 0 : ioapic_for(gsi);
+        if (!r->io) {
+            continue;
+        }
+        r->pin = gsi - r->io->gsi_base;
+        r->dest = dest;
+        r->low = ISA_VECTOR_BASE + irq;
+        if ((inti & ACPI_INTI_POLARITY_MASK) == ACPI_INTI_ACTIVE_LOW) {
+            r->low |= REDIR_ACTIVE_LOW;
+        }
+        if ((inti & ACPI_INTI_TRIGGER_MASK) == ACPI_INTI_LEVEL) {
+            r->low |= REDIR_LEVEL;
+        }
+        if (!(enabled & (1u << irq))) {
+            r->low |= REDIR_MASKED;
+        }
+        route_write(irq);
+    }
+
+    outb(0x21, 0xFF);
+    outb(0xA1, 0xFF);
+    ioapic_routing = 1;
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+    return 0;
+}
+
+int ioapic_active(void) {
+    return ioapic_routing != 0;
+}
+
+static void set_masked(uint8_t irq, int masked) {
+    if (irq >= ISA_IRQS) {
+        return;
+    }
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    if (!ioapic_routing) {
+        pic_set_masked(irq, masked);
+    } else if (isa_route[irq].io) {
+        if (masked) {
+            isa_route[irq].low |= REDIR_MASKED;
+        } else {
+            isa_route[irq].low &= ~REDIR_MASKED;
+        }
+        route_write(irq);
+    }
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void irq_mask(uint8_t irq) {
+    set_masked(irq, 1);
+}
+
+void irq_unmask(uint8_t irq) {
+    set_masked(irq, 0);
+}
+
+int irq_set_cpu(uint8_t irq, uint32_t cpu) {
+    if (irq >= ISA_IRQS || cpu >= MAX_CPUS || !cpus[cpu].online) {
+        return -1;
+    }
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    int ret = -1;
+    if (ioapic_routing && isa_route[irq].io) {
+        isa_route[irq].dest = cpus[cpu].apic_id;
+        route_write(irq);
+        ret = 0;
+    }
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+    return ret;
+}
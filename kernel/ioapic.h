@@ -0,0 +1,31 @@
+/*
+ * ioapic.h - ISA interrupt routing through the I/O APIC
+ *
+ * Until ioapic_init() succeeds the 8259 PICs deliver IRQs 0-15 as
+ * vectors 32-47. Afterwards the PICs are masked and the I/O APIC sends
+ * the same vectors to a local APIC, which the IRQ stubs acknowledge with
+ * one MMIO write instead of port I/O to one or both PICs.
+ */
+
+#ifndef IOAPIC_H
+#define IOAPIC_H
+
+#include <stdint.h>
+
+/* Take over the ISA lines the PICs had enabled, all delivered to the
+ * boot CPU; returns 0 if an I/O APIC now routes them. Needs the local
+ * APIC and the MADT. */
+int ioapic_init(void);
+
+/* Nonzero once ISA IRQs come through the I/O APIC */
+int ioapic_active(void);
+
+/* Mask or unmask ISA IRQ irq (0-15) on whichever controller routes it */
+void irq_mask(uint8_t irq);
+void irq_unmask(uint8_t irq);
+
+/* Deliver ISA IRQ irq to cpus[cpu]; -1 without an I/O APIC or if that
+ * CPU is not online */
+int irq_set_cpu(uint8_t irq, uint32_t cpu);
+
+#endif /* IOAPIC_H */
@@ -1,6 +1,22 @@
 [BITS 32]
 
+; Tracepoints (trace.h); the Makefile passes CONFIG_TRACE
+%ifndef CONFIG_TRACE
+%define CONFIG_TRACE 1
+%endif
+TRACE_IRQ_ENTER equ 2
+TRACE_IRQ_EXIT  equ 3
+
 [EXTERN isr_handler_c]
+[EXTERN syscall_dispatch]
+[EXTERN idt_handlers]
+[EXTERN ioapic_routing]
+[EXTERN lapic_eoi_reg]
+[EXTERN softirq_run]
+%if CONFIG_TRACE
+[EXTERN trace_on]
+[EXTERN trace_emit]
+%endif
 
 [GLOBAL isr0]
 [GLOBAL isr1]
@@ -52,8 +68,24 @@
 [GLOBAL irq14]
 [GLOBAL irq15]
 
+[GLOBAL isr48]   ; LAPIC timer
+[GLOBAL isr49]   ; Reschedule IPI
+[GLOBAL isr50]   ; TLB shootdown IPI
+[GLOBAL isr51]   ; Benchmark, common path
+[GLOBAL isr52]   ; Benchmark, fast path
+[GLOBAL isr64]   ; MSI vectors
+[GLOBAL isr65]
+[GLOBAL isr66]
+[GLOBAL isr67]
+[GLOBAL isr68]
+[GLOBAL isr69]
+[GLOBAL isr70]
+[GLOBAL isr71]
+[GLOBAL isr255]  ; LAPIC spurious
 [GLOBAL isr128]  ; Syscall interrupt
 [GLOBAL tss_flush]
+[GLOBAL isr_return_to]
+[GLOBAL sysenter_entry]
 
 %macro ISR_NOERR 1
 isr%1:
@@ -68,11 +100,48 @@ isr%1:
     jmp isr_common_stub
 %endmacro
 
-%macro IRQ 2
-irq%1:
+; Hardware interrupts take a lighter path than exceptions. Each vector
+; gets its own stub, which acknowledges the interrupt itself and calls
+; the vector's slot of idt_handlers[] directly. The frame is the usual
+; registers_t, but segments are only reloaded, and restored on the way
+; out, when the interrupt came from ring 3 or V86 mode.
+; FAST_IRQ label, vector, EOI: 0 none (the handler sends it), 1 or 2 an
+; ISA IRQ on the master or slave PIC (a local APIC EOI once the I/O APIC
+; routes them), 3 a local APIC EOI
+%macro FAST_IRQ 3
+%1:
     push dword 0
     push dword %2
-    jmp isr_common_stub
+    push ds
+    push es
+    push fs
+    push gs
+    pusha
+    call irq_enter
+%if %3 == 1 || %3 == 2
+    cmp dword [ioapic_routing], 0
+    jne %%lapic_eoi
+%if %3 == 2
+    mov al, 0x20
+    out 0xA0, al
+%endif
+    mov al, 0x20
+    out 0x20, al
+    jmp %%eoi_done
+%endif
+%if %3 != 0
+%%lapic_eoi:
+    mov eax, [lapic_eoi_reg]
+    mov dword [eax], 0
+%endif
+%%eoi_done:
+    mov eax, [idt_handlers + %2 * 4]
+    test eax, eax
+    jz irq_return
+    push esp
+    call eax
+    add esp, 4
+    jmp irq_return
 %endmacro
 
 ISR_NOERR 0
@@ -108,22 +177,42 @@ ISR_NOERR 29
 ISR_ERR   30
 ISR_NOERR 31
 
-IRQ 0, 32
-IRQ 1, 33
-IRQ 2, 34
-IRQ 3, 35
-IRQ 4, 36
-IRQ 5, 37
-IRQ 6, 38
-IRQ 7, 39
-IRQ 8, 40
-IRQ 9, 41
-IRQ 10, 42
-IRQ 11, 43
-IRQ 12, 44
-IRQ 13, 45
-IRQ 14, 46
-IRQ 15, 47
+FAST_IRQ irq0, 32, 1
+FAST_IRQ irq1, 33, 1
+FAST_IRQ irq2, 34, 1
+FAST_IRQ irq3, 35, 1
+FAST_IRQ irq4, 36, 1
+FAST_IRQ irq5, 37, 1
+FAST_IRQ irq6, 38, 1
+FAST_IRQ irq7, 39, 1
+FAST_IRQ irq8, 40, 2
+FAST_IRQ irq9, 41, 2
+FAST_IRQ irq10, 42, 2
+FAST_IRQ irq11, 43, 2
+FAST_IRQ irq12, 44, 2
+FAST_IRQ irq13, 45, 2
+FAST_IRQ irq14, 46, 2
+FAST_IRQ irq15, 47, 2
+
+; Local APIC vectors (acknowledged by their handlers, not the PIC)
+FAST_IRQ isr48, 48, 0
+FAST_IRQ isr49, 49, 0
+FAST_IRQ isr50, 50, 0
+ISR_NOERR 255
+
+; The same empty handler through each path, for "bench irq"
+ISR_NOERR 51
+FAST_IRQ isr52, 52, 0
+
+; Message signalled interrupts from PCI devices
+FAST_IRQ isr64, 64, 3
+FAST_IRQ isr65, 65, 3
+FAST_IRQ isr66, 66, 3
+FAST_IRQ isr67, 67, 3
+FAST_IRQ isr68, 68, 3
+FAST_IRQ isr69, 69, 3
+FAST_IRQ isr70, 70, 3
+FAST_IRQ isr71, 71, 3
 
 ; Syscall interrupt (int 0x80)
 isr128:
@@ -149,12 +238,14 @@ isr_common_stub:
     mov ds, ax
     mov es, ax
     mov fs, ax
+    mov ax, 0x38        ; Per-CPU data segment (this_cpu)
     mov gs, ax
 
     push esp
     call isr_handler_c
     add esp, 4
 
+isr_return:
     popa
     pop gs
     pop fs
@@ -162,3 +253,105 @@ isr_common_stub:
     pop ds
     add esp, 8
     iretd
+
+; Load the kernel's segments unless FAST_IRQ interrupted ring 0, where
+; they already hold them. The frame starts past the return address.
+irq_enter:
+    test byte [esp + 4 + 60], 3         ; Saved CS
+    jnz .reload
+    test dword [esp + 4 + 64], 0x20000  ; Saved EFLAGS.VM
+    jnz .reload
+.trace:
+%if CONFIG_TRACE
+    cmp dword [trace_on], 0
+    jne .emit
+%endif
+    ret
+.reload:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov ax, 0x38        ; Per-CPU data segment (this_cpu)
+    mov gs, ax
+    jmp .trace
+%if CONFIG_TRACE
+.emit:
+    push dword [esp + 4 + 48]           ; Vector
+    push dword TRACE_IRQ_ENTER
+    call trace_emit
+    add esp, 8
+    ret
+%endif
+
+; Leave a FAST_IRQ frame, running pending softirqs first. Ring 0 code
+; gets its segments back untouched, as nothing in the kernel changes
+; them; otherwise pop the saved ones.
+irq_return:
+%if CONFIG_TRACE
+    cmp dword [trace_on], 0
+    je .traced
+    push dword [esp + 48]               ; Vector
+    push dword TRACE_IRQ_EXIT
+    call trace_emit
+    add esp, 8
+.traced:
+%endif
+    call softirq_run
+    test byte [esp + 60], 3
+    jnz isr_return
+    test dword [esp + 64], 0x20000
+    jnz isr_return
+    popa
+    add esp, 24         ; Segments, vector, error code
+    iretd
+
+; Leave the kernel through a saved frame: isr_return_to(registers_t *frame)
+; Used to start user tasks, whose first frame is built by hand.
+isr_return_to:
+    mov esp, [esp + 4]
+    jmp isr_return
+
+; Fast system call entry (SYSENTER, MSR_SYSENTER_EIP). The caller passes
+; its stack pointer in EBP and its resume address in ESI; the number and
+; arguments are as for int 0x80, and ECX and EDX come back clobbered.
+; The frame is the one isr128 builds, so fork and exec work unchanged, but
+; only the segments the kernel relies on are reloaded and the syscall
+; table is called directly.
+sysenter_entry:
+    push dword 0x23     ; SS
+    push ebp            ; User ESP
+    pushfd
+    or dword [esp], 0x200   ; SYSENTER cleared IF
+    push dword 0x1B     ; CS
+    push esi            ; EIP
+    push dword 0
+    push dword 128
+    push ds
+    push es
+    push fs
+    push gs
+    pusha
+
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ax, 0x38        ; Per-CPU data segment (this_cpu)
+    mov gs, ax
+
+    push esp
+    call syscall_dispatch
+    add esp, 4
+
+    ; Leave through the frame, which exec may have rewritten
+    cli
+    popa
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    add esp, 8
+    mov edx, [esp]      ; EIP
+    mov ecx, [esp + 12] ; User ESP
+    sti                 ; Takes effect after SYSEXIT
+    sysexit
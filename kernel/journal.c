@@ -0,0 +1,217 @@
+/*
+ * journal.c - Write-ahead log for filesystem metadata
+ *
+ * Commit protocol:
+ *   1. payload blocks are written to the log in one sequential command
+ *   2. the header (block list + checksum) is written; this is the commit point
+ *   3. blocks are copied to their home sectors (checkpoint)
+ *   4. the header is cleared
+ * Replay repeats steps 3-4 for a header whose checksum matches its payload.
+ *
+ * Once step 2 is on disk the transaction has happened: if step 3 or 4
+ * fails, the caller keeps its new metadata and the header stays for
+ * replay. Until the next commit finishes the checkpoint from the log,
+ * journal_read_block() serves the logged copies of those sectors.
+ */
+
+#include "journal.h"
+
+#include "disk.h"
+#include "string.h"
+
+static uint32_t log_lba;
+static uint32_t log_capacity;
+static uint32_t log_sequence;
+
+static journal_header_t header;
+static uint8_t staging[JOURNAL_MAX_BLOCKS * 512];
+static uint32_t staged_lba[JOURNAL_MAX_BLOCKS];
+static uint32_t staged_count;
+
+/* header describes a committed transaction not yet (fully) at home */
+static int home_pending;
+static uint8_t block_buf[512];
+
+static uint32_t stat_commits;
+static uint32_t stat_sectors;
+
+static int write_blocks(uint32_t lba, uint32_t count, const void *buf) {
+    stat_sectors += count;
+    return disk_write_sectors(lba, (uint8_t)count, buf);
+}
+
+static int clear_header(void) {
+    memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.sequence = log_sequence;
+    return write_blocks(log_lba, 1, &header);
+}
+
+/* Copy staged blocks home, merging runs of consecutive sectors */
+static int checkpoint(const uint32_t *lbas, uint32_t count, const uint8_t *payload) {
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t run = 1;
+        while (i + run < count && lbas[i + run] == lbas[i] + run) {
+            run++;
+        }
+        if (write_blocks(lbas[i], run, payload + i * 512u) != 0) {
+            return -1;
+        }
+        i += run;
+    }
+    return 0;
+}
+
+/* Finish a pending checkpoint from the log on disk, a block at a time, as
+ * staging already holds the next transaction */
+static int finish_pending(void) {
+    for (uint32_t i = 0; i < header.count; i++) {
+        if (disk_read_sectors(log_lba + 1 + i, 1, block_buf) != 0 ||
+            write_blocks(header.lba[i], 1, block_buf) != 0) {
+            return -1;
+        }
+    }
+    if (clear_header() != 0) {
+        return -1;
+    }
+    home_pending = 0;
+    return 0;
+}
+
+void journal_init(uint32_t lba, uint32_t sectors) {
+    log_lba = lba;
+    log_capacity = sectors > 1 ? sectors - 1 : 0;
+    if (log_capacity > JOURNAL_MAX_BLOCKS) {
+        log_capacity = JOURNAL_MAX_BLOCKS;
+    }
+    log_sequence = 0;
+    staged_count = 0;
+    home_pending = 0;
+}
+
+int journal_format(void) {
+    log_sequence = 0;
+    staged_count = 0;
+    home_pending = 0;
+    return clear_header();
+}
+
+int journal_replay(void) {
+    if (disk_read_sectors(log_lba, 1, &header) != 0) {
+        return -1;
+    }
+
+    if (header.magic != JOURNAL_MAGIC) {
+        /* Never formatted with a log: start one */
+        return clear_header() == 0 ? 0 : -1;
+    }
+
+    log_sequence = header.sequence;
+    if (header.count == 0) {
+        return 0;
+    }
+
+    uint32_t count = header.count;
+    if (count > log_capacity) {
+        return clear_header() == 0 ? 0 : -1;
+    }
+    if (disk_read_sectors(log_lba + 1, (uint8_t)count, staging) != 0) {
+        return -1;
+    }
+
+    if (journal_checksum(&header, staging) != header.checksum) {
+        /* Torn before the commit point: the old metadata is still intact */
+        return clear_header() == 0 ? 0 : -1;
+    }
+
+    if (checkpoint(header.lba, count, staging) != 0) {
+        return -1;
+    }
+    if (clear_header() != 0) {
+        return -1;
+    }
+    return (int)count;
+}
+
+void journal_begin(void) {
+    staged_count = 0;
+}
+
+int journal_add(uint32_t lba, const void *data) {
+    for (uint32_t i = 0; i < staged_count; i++) {
+        if (staged_lba[i] == lba) {
+            memcpy(staging + i * 512u, data, 512);
+            return 0;
+        }
+    }
+
+    if (staged_count >= log_capacity) {
+        return -1;
+    }
+
+    staged_lba[staged_count] = lba;
+    memcpy(staging + staged_count * 512u, data, 512);
+    staged_count++;
+    return 0;
+}
+
+int journal_commit(void) {
+    if (staged_count == 0) {
+        return 0;
+    }
+
+    uint32_t count = staged_count;
+    staged_count = 0;
+
+    /* The log still holds the only good copy of an earlier transaction */
+    if (home_pending && finish_pending() != 0) {
+        return -1;
+    }
+
+    if (write_blocks(log_lba + 1, count, staging) != 0) {
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = JOURNAL_MAGIC;
+    header.sequence = ++log_sequence;
+    header.count = count;
+    memcpy(header.lba, staged_lba, count * sizeof(uint32_t));
+    header.checksum = journal_checksum(&header, staging);
+    if (write_blocks(log_lba, 1, &header) != 0) {
+        return -1;
+    }
+
+    stat_commits++;
+
+    /* Committed: a failure from here on only delays the checkpoint, which
+     * the next commit or the next mount's replay finishes */
+    if (checkpoint(staged_lba, count, staging) != 0 || clear_header() != 0) {
+        home_pending = 1;
+    }
+    return 0;
+}
+
+int journal_read_block(uint32_t lba, void *buf) {
+    if (home_pending) {
+        for (uint32_t i = 0; i < header.count; i++) {
+            if (header.lba[i] == lba) {
+                return disk_read_sectors(log_lba + 1 + i, 1, buf);
+            }
+        }
+    }
+    return disk_read_sectors(lba, 1, buf);
+}
+
+void journal_abort(void) {
+    staged_count = 0;
+}
+
+uint32_t journal_commits(void) {
+    return stat_commits;
+}
+
+uint32_t journal_sectors_written(void) {
+    return stat_sectors;
+}
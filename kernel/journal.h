@@ -0,0 +1,73 @@
+/*
+ * journal.h - Write-ahead log for filesystem metadata
+ *
+ * Metadata sectors (FAT and directory) are staged in memory, written
+ * sequentially to a reserved log region, sealed with a checksummed header
+ * and only then copied to their home locations. A reset at any point leaves
+ * either the old or the new metadata on disk, never a mix of both.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+/* Log region layout: one header sector followed by payload sectors */
+#define JOURNAL_MAGIC 0x4A55534Fu /* "OSUJ" */
+#define JOURNAL_MAX_BLOCKS 63
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t count;                    /* 0 = no committed transaction */
+    uint32_t checksum;                 /* Over lba[] and payload */
+    uint32_t lba[JOURNAL_MAX_BLOCKS];  /* Home location of each payload block */
+    uint8_t reserved[512 - 16 - JOURNAL_MAX_BLOCKS * 4];
+} journal_header_t;
+
+/* FNV-1a over the block list and payload, salted with the sequence number */
+static inline uint32_t journal_checksum(const journal_header_t *hdr, const uint8_t *payload) {
+    uint32_t h = 2166136261u;
+    const uint8_t *p = (const uint8_t *)hdr->lba;
+    for (uint32_t i = 0; i < hdr->count * 4u; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    for (uint32_t i = 0; i < hdr->count * 512u; i++) {
+        h = (h ^ payload[i]) * 16777619u;
+    }
+    return h ^ hdr->sequence;
+}
+
+/* Attach the journal to its on-disk region (header + payload sectors) */
+void journal_init(uint32_t lba, uint32_t sectors);
+
+/* Write an empty header; used when a fresh volume is formatted */
+int journal_format(void);
+
+/* Apply a committed transaction left by an interrupted checkpoint.
+ * Returns number of blocks replayed, 0 if clean, -1 on I/O error. */
+int journal_replay(void);
+
+/* Start collecting blocks for a new transaction */
+void journal_begin(void);
+
+/* Stage one 512-byte block destined for lba. Re-adding an lba replaces it. */
+int journal_add(uint32_t lba, const void *data);
+
+/* Log, seal and checkpoint all staged blocks. Returns 0 once the
+ * transaction is committed, even if its checkpoint has to wait, and -1
+ * if it was not (the caller should roll back). */
+int journal_commit(void);
+
+/* Read one metadata sector as committed: from the log while a failed
+ * checkpoint has not yet put it home */
+int journal_read_block(uint32_t lba, void *buf);
+
+/* Drop all staged blocks */
+void journal_abort(void);
+
+/* Stats for diagnostics */
+uint32_t journal_commits(void);
+uint32_t journal_sectors_written(void);
+
+#endif /* JOURNAL_H */
@@ -4,9 +4,13 @@
 
 #include "idt.h"
 #include "io.h"
+#include "softirq.h"
+#include "sync.h"
 #include "vga.h"
+#include "wait.h"
 
 #define KBD_BUF_SIZE 256
+#define SCAN_BUF_SIZE 64
 #define PS2_DATA_PORT 0x60
 #define PS2_STATUS_PORT 0x64
 #define PS2_CMD_PORT 0x64
@@ -16,6 +20,19 @@ static volatile uint32_t kbd_head;
 static volatile uint32_t kbd_tail;
 static uint8_t shift_down;
 
+/* Scancodes from the IRQ handler, decoded by kbd_tasklet */
+static volatile uint8_t scan_buf[SCAN_BUF_SIZE];
+static volatile uint32_t scan_head;
+static volatile uint32_t scan_tail;
+
+/* Readers blocked in keyboard_getchar() */
+static wait_queue_t kbd_wait = WAIT_QUEUE_INIT;
+
+wait_queue_t input_wait = WAIT_QUEUE_INIT;
+
+/* Guards kbd_buf/kbd_head/kbd_tail against the IRQ handler */
+static spinlock_t kbd_lock = SPINLOCK_INIT;
+
 static const char map_normal[128] = {
     0, 27, '1', '2', '3', '4', '5', '6',
     '7', '8', '9', '0', '-', '=', '\b', '\t',
@@ -55,21 +72,26 @@ static const char map_shift[128] = {
 };
 
 static void enqueue_char(char c) {
+    uint32_t flags = spin_lock_irqsave(&kbd_lock);
     uint32_t next = (kbd_head + 1) % KBD_BUF_SIZE;
     if (next == kbd_tail) {
+        spin_unlock_irqrestore(&kbd_lock, flags);
         return;
     }
     kbd_buf[kbd_head] = c;
     kbd_head = next;
+    spin_unlock_irqrestore(&kbd_lock, flags);
 }
 
 static int dequeue_char(char *out) {
-    if (kbd_head == kbd_tail) {
-        return 0;
+    uint32_t flags = spin_lock_irqsave(&kbd_lock);
+    int ok = kbd_head != kbd_tail;
+    if (ok) {
+        *out = kbd_buf[kbd_tail];
+        kbd_tail = (kbd_tail + 1) % KBD_BUF_SIZE;
     }
-    *out = kbd_buf[kbd_tail];
-    kbd_tail = (kbd_tail + 1) % KBD_BUF_SIZE;
-    return 1;
+    spin_unlock_irqrestore(&kbd_lock, flags);
+    return ok;
 }
 
 static uint8_t extended_key = 0;
@@ -101,10 +123,7 @@ static void ps2_write_data(uint8_t val) {
     outb(PS2_DATA_PORT, val);
 }
 
-static void keyboard_irq_handler(registers_t *r) {
-    (void)r;
-    uint8_t scancode = inb(PS2_DATA_PORT);
-
+static void keyboard_decode(uint8_t scancode) {
     /* Handle extended key prefix */
     if (scancode == 0xE0) {
         extended_key = 1;
@@ -151,9 +170,34 @@ static void keyboard_irq_handler(registers_t *r) {
 
     if (ch) {
         enqueue_char(ch);
+        wake_up(&kbd_wait);
+        wake_up(&input_wait);
+    }
+}
+
+static void kbd_tasklet_fn(void *arg) {
+    (void)arg;
+    while (scan_tail != scan_head) {
+        uint8_t scancode = scan_buf[scan_tail];
+        scan_tail = (scan_tail + 1) % SCAN_BUF_SIZE;
+        keyboard_decode(scancode);
     }
 }
 
+static tasklet_t kbd_tasklet = TASKLET_INIT(kbd_tasklet_fn, 0);
+
+/* Only take the byte off the controller; decoding waits for the tasklet */
+static void keyboard_irq_handler(registers_t *r) {
+    (void)r;
+    uint8_t scancode = inb(PS2_DATA_PORT);
+    uint32_t next = (scan_head + 1) % SCAN_BUF_SIZE;
+    if (next != scan_tail) {
+        scan_buf[scan_head] = scancode;
+        scan_head = next;
+    }
+    tasklet_schedule(&kbd_tasklet);
+}
+
 void keyboard_init(void) {
     kbd_head = 0;
     kbd_tail = 0;
@@ -185,20 +229,26 @@ void keyboard_init(void) {
 
 /* Flush any pending keyboard input */
 void keyboard_flush(void) {
+    uint32_t flags = spin_lock_irqsave(&kbd_lock);
     kbd_head = 0;
     kbd_tail = 0;
+    spin_unlock_irqrestore(&kbd_lock, flags);
     extended_key = 0;
 }
 
+int keyboard_has_data(void) {
+    return kbd_head != kbd_tail;
+}
+
 char keyboard_getchar(void) {
     char c;
-    while (!dequeue_char(&c)) {
-        /* Enable interrupts and halt atomically to avoid race condition.
-         * Without sti before hlt, an interrupt could arrive after we check
-         * the buffer but before we halt, causing us to sleep forever. */
-        __asm__ volatile("sti; hlt");
+    for (;;) {
+        /* Block off the run queue until the IRQ handler queues a key */
+        wait_event(kbd_wait, kbd_head != kbd_tail);
+        if (dequeue_char(&c)) {
+            return c;
+        }
     }
-    return c;
 }
 
 void keyboard_readline(char *buf, size_t max_len) {
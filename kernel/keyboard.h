@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 
+#include "wait.h"
+
 /* Special key codes (use values > 127 to avoid ASCII conflicts) */
 #define KEY_UP      0x80
 #define KEY_DOWN    0x81
@@ -15,9 +17,14 @@
 #define KEY_DELETE  0x88
 
 void keyboard_init(void);
-char keyboard_getchar(void);
+char keyboard_getchar(void);             /* Blocks until a key arrives */
 void keyboard_readline(char *buf, size_t max_len);
 void keyboard_flush(void);
 int keyboard_try_getchar(char *out);
+int keyboard_has_data(void);
+
+/* Woken by both keyboard and mouse input, for readers of both (the GUI):
+ *     wait_event(input_wait, keyboard_has_data() || mouse_has_event());  */
+extern wait_queue_t input_wait;
 
 #endif
@@ -1,19 +1,29 @@
+#include "clock.h"
 #include "idt.h"
+#include "ioapic.h"
 #include "keyboard.h"
 #include "disk.h"
+#include "fpu.h"
 #include "gfxcon.h"
 #include "memory.h"
+#include "paging.h"
 #include "shell.h"
 #include "syscall.h"
 #include "tss.h"
 #include "vfs.h"
 #include "vga.h"
+#include "workqueue.h"
 #include "vesa.h"
 #include "v86.h"
 #include "timer.h"
+#include "lapic.h"
 #include "process.h"
+#include "serial.h"
+#include "smp.h"
 
 void kmain(void) {
+    serial_init();
+
     /* Initialize VESA first (before any vga_* calls) */
     vesa_init();
 
@@ -42,14 +52,40 @@ void kmain(void) {
     idt_init();
     keyboard_init();
     memory_init();
+    if (paging_init() == 0) {
+        vga_printf("Paging: %u MiB free in 4 KiB frames\n", frames_free() / 256u);
+    } else {
+        vga_puts("Paging: no PSE, kernel stacks without guard pages\n");
+    }
     disk_init();
     vfs_init();
 
+    /* x87/SSE with lazy per-task state */
+    fpu_init();
+
+    /* Calibrate the TSC against PIT channel 2 (no interrupts needed) */
+    clock_init();
+    if (clock_tsc_khz()) {
+        vga_printf("Clock: TSC %u MHz\n", clock_tsc_khz() / 1000u);
+    }
+
     /* Initialize timer (100Hz = 10ms per tick) */
     timer_init(100);
+    if (timer_is_tickless()) {
+        vga_printf("Timer: LAPIC one-shot %u kHz (tickless)\n", lapic_timer_khz());
+    }
 
-    /* Initialize process management */
+    /* Move ISA IRQs from the 8259s to the I/O APIC if there is one */
+    if (ioapic_init() == 0) {
+        vga_puts("IRQ: I/O APIC, local APIC EOI\n");
+    }
+
+    /* Initialize process management; the shell runs as pid 0 */
     process_init();
+    scheduler_init();
+
+    /* Threads for deferred work that may sleep */
+    workqueue_init();
 
     /* Initialize TSS for ring transitions */
     tss_init();
@@ -60,6 +96,12 @@ void kmain(void) {
     /* Initialize V86 mode for BIOS calls */
     v86_init();
 
+    /* Start the other CPUs; they share the run queues from here on */
+    uint32_t ncpus = smp_init();
+    if (ncpus > 1) {
+        vga_printf("SMP: %u CPUs online\n", ncpus);
+    }
+
     __asm__ volatile("sti");
 
     vga_puts("Ready.\n\n");
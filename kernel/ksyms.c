@@ -0,0 +1,35 @@
+/* ksyms.c - Kernel symbol lookup */
+
+#include "ksyms.h"
+
+extern uint8_t _text_end;
+
+int ksym_find(uint32_t addr) {
+    if (ksym_count == 0 || addr < ksyms[0].addr || addr >= (uint32_t)&_text_end) {
+        return -1;
+    }
+
+    /* Last symbol at or below addr */
+    uint32_t lo = 0;
+    uint32_t hi = ksym_count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ksyms[mid].addr <= addr) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (int)lo;
+}
+
+const char *ksym_lookup(uint32_t addr, uint32_t *offset) {
+    int i = ksym_find(addr);
+    if (i < 0) {
+        return 0;
+    }
+    if (offset) {
+        *offset = addr - ksyms[i].addr;
+    }
+    return ksym_names + ksyms[i].name;
+}
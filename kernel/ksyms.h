@@ -0,0 +1,30 @@
+/*
+ * ksyms.h - Kernel symbol table
+ *
+ * The tables are generated from the linked kernel by tools/mksyms.sh and
+ * linked into a second build of it (see Makefile): every text symbol in
+ * address order, with names packed in one string.
+ */
+
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t addr;
+    uint32_t name;      /* Offset in ksym_names */
+} ksym_t;
+
+extern const ksym_t ksyms[];
+extern const uint32_t ksym_count;
+extern const char ksym_names[];
+
+/* Index in ksyms of the function containing addr, or -1 outside kernel
+ * text (or before the table exists) */
+int ksym_find(uint32_t addr);
+
+/* Name of the function containing addr, with addr's offset into it, or 0 */
+const char *ksym_lookup(uint32_t addr, uint32_t *offset);
+
+#endif /* KSYMS_H */
@@ -0,0 +1,225 @@
+/*
+ * ktimer.c - Hierarchical timer wheel for kernel timers
+ *
+ * One wheel serves every CPU and only the BSP runs it. Callbacks are
+ * called with the wheel lock dropped, so they may add or cancel timers.
+ */
+
+#include "ktimer.h"
+
+#include "smp.h"
+#include "sync.h"
+#include "timer.h"
+
+#define UNIT_SHIFT  16u
+#define UNIT_NS     (1ull << UNIT_SHIFT)
+#define LEVEL_BITS  6u
+#define LEVEL_SIZE  (1u << LEVEL_BITS)
+#define LEVEL_MASK  (LEVEL_SIZE - 1u)
+#define LEVELS      5u
+
+/* Furthest a timer can be bucketed; later ones re-cascade at the top */
+#define MAX_DELTA   ((1ull << (LEVEL_BITS * LEVELS)) - 1u)
+
+static ktimer_t *wheel[LEVELS][LEVEL_SIZE];
+static uint64_t occupied[LEVELS];   /* Bit s set: slot s is non-empty */
+static uint64_t wheel_clk;          /* Next unit to process */
+static uint32_t pending_count;
+static ktimer_t *volatile running;  /* Callback in progress on the BSP */
+
+static spinlock_t ktimer_lock = SPINLOCK_INIT;
+
+/* Index of the lowest set bit at or above from, or -1 */
+static int next_bit(uint64_t bits, uint32_t from) {
+    if (from >= LEVEL_SIZE) {
+        return -1;
+    }
+    bits &= ~0ull << from;
+    uint32_t lo = (uint32_t)bits;
+    uint32_t hi = (uint32_t)(bits >> 32);
+    if (lo) {
+        return __builtin_ctz(lo);
+    }
+    if (hi) {
+        return 32 + __builtin_ctz(hi);
+    }
+    return -1;
+}
+
+static void enqueue(ktimer_t *t) {
+    uint64_t when = t->when < wheel_clk ? wheel_clk : t->when;
+    uint64_t delta = when - wheel_clk;
+    if (delta > MAX_DELTA) {
+        delta = MAX_DELTA;
+        when = wheel_clk + delta;
+    }
+
+    uint32_t level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << (LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    uint32_t slot = (uint32_t)(when >> (LEVEL_BITS * level)) & LEVEL_MASK;
+
+    ktimer_t **head = &wheel[level][slot];
+    t->next = *head;
+    if (t->next) {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+    t->level = (uint8_t)level;
+    t->slot = (uint8_t)slot;
+    occupied[level] |= 1ull << slot;
+}
+
+static void unlink(ktimer_t *t) {
+    *t->pprev = t->next;
+    if (t->next) {
+        t->next->pprev = t->pprev;
+    }
+    if (!wheel[t->level][t->slot]) {
+        occupied[t->level] &= ~(1ull << t->slot);
+    }
+    t->next = 0;
+    t->pprev = 0;
+}
+
+void ktimer_add(ktimer_t *t, uint64_t expires_ns, ktimer_fn fn, void *arg) {
+    uint32_t flags = spin_lock_irqsave(&ktimer_lock);
+
+    if (t->pprev) {
+        unlink(t);
+        pending_count--;
+    }
+    t->expires_ns = expires_ns;
+    t->when = (expires_ns + UNIT_NS - 1) >> UNIT_SHIFT;
+    t->fn = fn;
+    t->arg = arg;
+    enqueue(t);
+    pending_count++;
+
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+
+    /* The new timer may be earlier than the programmed timer event */
+    timer_reprogram();
+}
+
+int ktimer_cancel(ktimer_t *t) {
+    uint32_t flags = spin_lock_irqsave(&ktimer_lock);
+
+    int was_pending = t->pprev != 0;
+    if (was_pending) {
+        unlink(t);
+        pending_count--;
+    }
+
+    /* On an AP, t's callback may be running on the BSP right now: wait,
+     * so the caller can free t afterwards */
+    while (running == t && this_cpu()->id != 0) {
+        spin_unlock(&ktimer_lock);
+        __asm__ volatile("pause");
+        spin_lock(&ktimer_lock);
+    }
+
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+    return was_pending;
+}
+
+/* Re-bucket the level's slot that the clock just entered */
+static void cascade(uint32_t level) {
+    uint32_t slot = (uint32_t)(wheel_clk >> (LEVEL_BITS * level)) & LEVEL_MASK;
+    ktimer_t *t = wheel[level][slot];
+
+    wheel[level][slot] = 0;
+    occupied[level] &= ~(1ull << slot);
+    while (t) {
+        ktimer_t *next = t->next;
+        enqueue(t);
+        t = next;
+    }
+}
+
+uint64_t ktimer_next_expiry(void) {
+    uint32_t flags = spin_lock_irqsave(&ktimer_lock);
+    uint64_t best = UINT64_MAX;
+
+    if (pending_count) {
+        for (uint32_t level = 0; level < LEVELS; level++) {
+            if (!occupied[level]) {
+                continue;
+            }
+            uint32_t shift = LEVEL_BITS * level;
+            uint64_t base = wheel_clk >> shift;
+            uint32_t idx = (uint32_t)base & LEVEL_MASK;
+
+            /* A coarse level's current slot has cascaded unless the clock
+             * sits exactly on its boundary and has yet to process it */
+            uint32_t from = idx;
+            if (wheel_clk & ((1ull << shift) - 1)) {
+                from = idx + 1;
+            }
+            int pos = next_bit(occupied[level], from);
+            uint64_t window = base & ~(uint64_t)LEVEL_MASK;
+            if (pos < 0) {
+                pos = next_bit(occupied[level], 0);
+                window += LEVEL_SIZE;
+            }
+            uint64_t unit = (window | (uint32_t)pos) << shift;
+            if (unit < best) {
+                best = unit;
+            }
+        }
+    }
+
+    spin_unlock_irqrestore(&ktimer_lock, flags);
+    return best == UINT64_MAX ? best : best << UNIT_SHIFT;
+}
+
+void ktimer_run(uint64_t now_ns) {
+    uint64_t target = now_ns >> UNIT_SHIFT;
+
+    spin_lock(&ktimer_lock);
+    while (wheel_clk <= target) {
+        if (!pending_count) {
+            wheel_clk = target + 1;
+            break;
+        }
+
+        uint32_t idx = (uint32_t)wheel_clk & LEVEL_MASK;
+        if (idx == 0) {
+            for (uint32_t level = 1; level < LEVELS; level++) {
+                cascade(level);
+                if ((wheel_clk >> (LEVEL_BITS * level)) & LEVEL_MASK) {
+                    break;
+                }
+            }
+        }
+
+        ktimer_t *t;
+        while ((t = wheel[0][idx]) != 0) {
+            unlink(t);
+            pending_count--;
+            running = t;
+            spin_unlock(&ktimer_lock);
+            t->fn(t->arg);
+            spin_lock(&ktimer_lock);
+            running = 0;
+        }
+
+        /* Skip to the next occupied level-0 slot or the next cascade */
+        wheel_clk++;
+        uint32_t next = (uint32_t)wheel_clk & LEVEL_MASK;
+        if (next != 0) {
+            int pos = next_bit(occupied[0], next);
+            uint64_t skip = pos < 0 ? (wheel_clk | LEVEL_MASK) + 1
+                                    : (wheel_clk & ~(uint64_t)LEVEL_MASK) | (uint32_t)pos;
+            /* Units up to skip are empty, so stopping short is safe */
+            wheel_clk = skip <= target ? skip : target + 1;
+        }
+    }
+    spin_unlock(&ktimer_lock);
+}
+
+uint32_t ktimer_count(void) {
+    return pending_count;
+}
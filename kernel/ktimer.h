@@ -0,0 +1,51 @@
+/*
+ * ktimer.h - Hierarchical timer wheel for kernel timers
+ *
+ * Timers are bucketed by expiry into 5 levels of 64 slots; level n slots
+ * are 64^n wheel units wide (one unit is 2^16 ns, ~65.5 us). Insert and
+ * cancel are O(1); ktimer_run() is driven from the timer interrupt and
+ * cascades coarse slots down as their time approaches.
+ */
+
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include <stdint.h>
+
+typedef void (*ktimer_fn)(void *arg);
+
+/* Embed in the owner and keep it alive while pending */
+typedef struct ktimer {
+    struct ktimer *next;
+    struct ktimer **pprev;   /* Non-null while pending */
+    uint64_t expires_ns;
+    uint64_t when;           /* Expiry in wheel units (rounded up) */
+    ktimer_fn fn;
+    void *arg;
+    uint8_t level;
+    uint8_t slot;
+} ktimer_t;
+
+/* Call fn(arg) from interrupt context at or after expires_ns (clock_ns
+ * time). Re-adding a pending timer moves it. */
+void ktimer_add(ktimer_t *t, uint64_t expires_ns, ktimer_fn fn, void *arg);
+
+/* Returns 1 if t was pending and has been removed. Once it returns,
+ * t's callback is not running on any other CPU either. */
+int ktimer_cancel(ktimer_t *t);
+
+static inline int ktimer_pending(const ktimer_t *t) {
+    return t->pprev != 0;
+}
+
+/* Earliest time the wheel needs to run, or UINT64_MAX if it is empty.
+ * May be earlier than the first expiry when a coarse slot must cascade. */
+uint64_t ktimer_next_expiry(void);
+
+/* Fire every timer due at or before now_ns (BSP timer interrupt only) */
+void ktimer_run(uint64_t now_ns);
+
+/* Number of pending timers */
+uint32_t ktimer_count(void);
+
+#endif /* KTIMER_H */
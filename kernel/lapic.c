@@ -0,0 +1,143 @@
+/*
+ * lapic.c - Local APIC, its timer and inter-processor interrupts
+ * The registers are reached through the uncached identity map of their
+ * physical MMIO address, which is the same on every CPU.
+ */
+
+#include "lapic.h"
+
+#include "clock.h"
+#include "cpu.h"
+#include "timer.h"
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define APIC_BASE_ENABLE   (1u << 11)
+
+#define LAPIC_REG_ID       0x020
+#define LAPIC_REG_TPR      0x080
+#define LAPIC_REG_EOI      0x0B0
+#define LAPIC_REG_SVR      0x0F0
+#define LAPIC_REG_ICR_LO   0x300
+#define LAPIC_REG_ICR_HI   0x310
+#define LAPIC_REG_LVT_TIMER 0x320
+#define LAPIC_REG_TIMER_INIT 0x380
+#define LAPIC_REG_TIMER_CUR  0x390
+#define LAPIC_REG_TIMER_DIV  0x3E0
+
+#define LAPIC_SVR_ENABLE   (1u << 8)
+#define LAPIC_LVT_MASKED   (1u << 16)
+#define LAPIC_TIMER_DIV_16 0x3
+
+#define ICR_FIXED          0x00000u
+#define ICR_INIT           0x00500u
+#define ICR_STARTUP        0x00600u
+#define ICR_PENDING        (1u << 12)
+#define ICR_ASSERT         (1u << 14)
+
+#define CALIBRATE_MS 10u
+
+static volatile uint32_t *lapic_base;
+static uint32_t timer_khz;
+
+/* The EOI register, written directly by the IRQ stubs in isr.asm */
+volatile uint32_t *lapic_eoi_reg;
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic_base[reg / 4] = value;
+}
+
+int lapic_init(void) {
+    if ((cpuid_edx(1) & (CPUID_EDX_APIC | CPUID_EDX_MSR)) != (CPUID_EDX_APIC | CPUID_EDX_MSR)) {
+        return -1;
+    }
+
+    uint64_t base = rdmsr(IA32_APIC_BASE_MSR);
+    wrmsr(IA32_APIC_BASE_MSR, base | APIC_BASE_ENABLE);
+    lapic_base = (volatile uint32_t *)(uintptr_t)(base & 0xFFFFF000u);
+    lapic_eoi_reg = &lapic_base[LAPIC_REG_EOI / 4];
+
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    return 0;
+}
+
+int lapic_present(void) {
+    return lapic_base != 0;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_base ? lapic_read(LAPIC_REG_ID) >> 24 : 0;
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+int lapic_timer_calibrate(void) {
+    if (!lapic_base) {
+        return -1;
+    }
+
+    lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFFu);
+    timer_pit_wait_ms(CALIBRATE_MS);
+    uint32_t elapsed = 0xFFFFFFFFu - lapic_read(LAPIC_REG_TIMER_CUR);
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+
+    timer_khz = elapsed / CALIBRATE_MS;
+    return timer_khz ? 0 : -1;
+}
+
+uint32_t lapic_timer_khz(void) {
+    return timer_khz;
+}
+
+void lapic_timer_oneshot(uint64_t ns) {
+    /* count = ns * kHz / 10^6; callers keep ns under a few seconds */
+    uint32_t count = udiv64_32(ns * timer_khz, NSEC_PER_MSEC);
+    if (count == 0) {
+        count = 1;
+    }
+    lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_TIMER_VECTOR); /* One-shot, unmasked */
+    lapic_write(LAPIC_REG_TIMER_INIT, count);
+}
+
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_REG_TIMER_INIT, 0);
+}
+
+/* Write the ICR; the high half must not be separated from the low half
+ * by an interrupt that sends an IPI of its own */
+static void icr_send(uint32_t apic_id, uint32_t low) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+
+    while (lapic_read(LAPIC_REG_ICR_LO) & ICR_PENDING) {
+        __asm__ volatile("pause");
+    }
+    lapic_write(LAPIC_REG_ICR_HI, apic_id << 24);
+    lapic_write(LAPIC_REG_ICR_LO, low);
+
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    icr_send(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    icr_send(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void lapic_send_startup(uint32_t apic_id, uint32_t phys) {
+    icr_send(apic_id, ICR_STARTUP | ICR_ASSERT | ((phys >> 12) & 0xFF));
+}
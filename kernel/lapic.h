@@ -0,0 +1,47 @@
+/*
+ * lapic.h - Local APIC, its timer and inter-processor interrupts
+ */
+
+#ifndef LAPIC_H
+#define LAPIC_H
+
+#include <stdint.h>
+
+/* IDT vectors owned by the local APIC */
+#define LAPIC_TIMER_VECTOR    48
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+/* Detect and software-enable the executing CPU's local APIC; returns 0
+ * if present. Each processor calls it once for its own APIC. */
+int lapic_init(void);
+
+/* Check if the local APIC is enabled */
+int lapic_present(void);
+
+/* APIC ID of the executing CPU */
+uint32_t lapic_id(void);
+
+/* Signal end of interrupt for APIC-delivered vectors */
+void lapic_eoi(void);
+
+/* Measure the timer input clock against the PIT; returns 0 on success */
+int lapic_timer_calibrate(void);
+
+/* Timer input clock after divide-by-16, in kHz (0 if not calibrated) */
+uint32_t lapic_timer_khz(void);
+
+/* Fire LAPIC_TIMER_VECTOR once after ns nanoseconds */
+void lapic_timer_oneshot(uint64_t ns);
+
+/* Cancel a pending one-shot */
+void lapic_timer_stop(void);
+
+/* Send a fixed interrupt to the CPU with APIC ID apic_id */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/* INIT and STARTUP IPIs for waking an application processor; the
+ * startup code must sit at the 4 KiB aligned phys below 1 MiB */
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint32_t phys);
+
+#endif /* LAPIC_H */
@@ -1,10 +1,13 @@
 #include "memory.h"
 
+#include "sync.h"
+
 extern uint8_t _kernel_end;
 
 static uintptr_t heap_start;
 static uintptr_t heap_end;
 static uintptr_t heap_curr;
+static spinlock_t heap_lock = SPINLOCK_INIT;
 
 static uintptr_t align16(uintptr_t v) {
     return (v + 15u) & ~((uintptr_t)15u);
@@ -21,13 +24,16 @@ void *kmalloc(size_t size) {
         return 0;
     }
 
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
     uintptr_t begin = align16(heap_curr);
     uintptr_t end = align16(begin + size);
     if (end > heap_end) {
+        spin_unlock_irqrestore(&heap_lock, flags);
         return 0;
     }
 
     heap_curr = end;
+    spin_unlock_irqrestore(&heap_lock, flags);
     return (void *)begin;
 }
 
@@ -0,0 +1,125 @@
+/*
+ * mmap.c - Files mapped into user address spaces
+ *
+ * Areas are found by a linear scan of the task's few slots and placed
+ * first fit in [USER_MMAP_BASE, USER_MMAP_LIMIT). A page is looked up by
+ * inode, so the mapping stays with the file it was made for; one made
+ * before the file is rewritten may keep pages of the old contents.
+ */
+
+#include "mmap.h"
+
+#include "idt.h"
+#include "paging.h"
+#include "process.h"
+#include "string.h"
+#include "syscall.h"
+#include "vfs.h"
+#include "vm.h"
+
+/* First fit for pages; 0 if the region is full */
+static uint32_t find_gap(process_t *p, uint32_t pages) {
+    uint32_t va = USER_MMAP_BASE;
+    for (;;) {
+        uint32_t end = va + pages * PAGE_SIZE;
+        if (end > USER_MMAP_LIMIT || end < va) {
+            return 0;
+        }
+        int moved = 0;
+        for (int i = 0; i < MMAP_MAX_AREAS; i++) {
+            mmap_area_t *a = &p->maps[i];
+            uint32_t a_end = a->start + a->pages * PAGE_SIZE;
+            if (a->start && a->start < end && va < a_end) {
+                va = a_end;
+                moved = 1;
+            }
+        }
+        if (!moved) {
+            return va;
+        }
+    }
+}
+
+int mmap_file(const char *path, int flags) {
+    process_t *p = process_current();
+    if (!p->page_dir) {
+        return -1;
+    }
+
+    uint32_t ino;
+    size_t size;
+    if (vfs_lookup(path, &ino, &size) != 0 || size == 0) {
+        return -1;
+    }
+
+    mmap_area_t *slot = 0;
+    for (int i = 0; i < MMAP_MAX_AREAS && !slot; i++) {
+        if (!p->maps[i].start) {
+            slot = &p->maps[i];
+        }
+    }
+    uint32_t pages = (uint32_t)((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    uint32_t va = slot ? find_gap(p, pages) : 0;
+    if (!va) {
+        return -1;
+    }
+
+    slot->start = va;
+    slot->pages = pages;
+    slot->ino = ino;
+    slot->writable = (flags & MAP_WRITE) != 0;
+    return (int)va;
+}
+
+int mmap_unmap(uint32_t addr) {
+    process_t *p = process_current();
+    for (int i = 0; i < MMAP_MAX_AREAS; i++) {
+        mmap_area_t *a = &p->maps[i];
+        if (a->start && a->start == addr) {
+            for (uint32_t n = 0; n < a->pages; n++) {
+                vm_unmap(p->page_dir, a->start + n * PAGE_SIZE);
+            }
+            a->start = 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int mmap_fault(process_t *p, uint32_t addr, const registers_t *r) {
+    if (!p->page_dir || (r->err_code & PF_PRESENT)) {
+        return -1;  /* Present pages fault only on forbidden writes */
+    }
+
+    mmap_area_t *a = 0;
+    for (int i = 0; i < MMAP_MAX_AREAS && !a; i++) {
+        mmap_area_t *m = &p->maps[i];
+        if (m->start && addr >= m->start && addr - m->start < m->pages * PAGE_SIZE) {
+            a = m;
+        }
+    }
+    /* A miss may read the disk: only where the faulting code could sleep */
+    if (!a || ((r->err_code & PF_WRITE) && !a->writable) || !(r->eflags & 0x200)) {
+        return -1;
+    }
+    __asm__ volatile("sti");
+
+    uint32_t va = addr & ~(PAGE_SIZE - 1);
+    uint32_t frame = vfs_page(a->ino, (va - a->start) / PAGE_SIZE);
+    if (!frame) {
+        return -1;  /* The file shrank or went away */
+    }
+    if (vm_map_frame(p->page_dir, va, frame, a->writable) != 0) {
+        frame_free(frame);
+        return -1;
+    }
+    return 0;  /* A write faults once more and gets its own copy */
+}
+
+void mmap_inherit(process_t *child, process_t *parent) {
+    memcpy(child->maps, parent->maps, sizeof(child->maps));
+}
+
+void mmap_reset(process_t *p) {
+    memset(p->maps, 0, sizeof(p->maps));
+}
@@ -0,0 +1,42 @@
+/*
+ * mmap.h - Files mapped into user address spaces
+ *
+ * A mapping shows a file's page cache pages themselves, read-only, or
+ * copy-on-write for a private writable mapping; nothing is copied until
+ * a program writes. Pages are mapped on the first touch.
+ */
+
+#ifndef MMAP_H
+#define MMAP_H
+
+#include <stdint.h>
+
+/* Mappings per task */
+#define MMAP_MAX_AREAS 8
+
+typedef struct {
+    uint32_t start;             /* 0: unused */
+    uint32_t pages;
+    uint32_t ino;
+    int writable;               /* Private copy-on-write */
+} mmap_area_t;
+
+struct process;
+struct registers;
+
+/* Map the file at path into the current task; returns the address or -1.
+ * flags are MAP_* from syscall.h. */
+int mmap_file(const char *path, int flags);
+
+/* Remove the mapping starting at addr */
+int mmap_unmap(uint32_t addr);
+
+/* Fill in a missing page of a mapping of p; -1 if addr is not in one or
+ * the access is not allowed */
+int mmap_fault(struct process *p, uint32_t addr, const struct registers *r);
+
+/* fork: the child has the parent's mappings; exec: none are left */
+void mmap_inherit(struct process *child, struct process *parent);
+void mmap_reset(struct process *p);
+
+#endif /* MMAP_H */
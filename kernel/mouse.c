@@ -2,10 +2,15 @@
 
 #include "idt.h"
 #include "io.h"
+#include "keyboard.h"
+#include "softirq.h"
+#include "sync.h"
+#include "wait.h"
 
 #define PS2_DATA_PORT 0x60
 #define PS2_STATUS_PORT 0x64
 #define PS2_CMD_PORT 0x64
+#define MOUSE_BUF_SIZE 96    /* Bytes, 32 packets */
 
 static volatile int mouse_x = 0;
 static volatile int mouse_y = 0;
@@ -20,6 +25,14 @@ static int screen_h = 600;
 static uint8_t packet[3];
 static int packet_index = 0;
 
+/* Bytes from the IRQ handler, assembled into packets by mouse_tasklet */
+static volatile uint8_t byte_buf[MOUSE_BUF_SIZE];
+static volatile uint32_t byte_head;
+static volatile uint32_t byte_tail;
+
+/* A reader on another CPU must see a whole update */
+static spinlock_t mouse_lock = SPINLOCK_INIT;
+
 static void ps2_wait_read(void) {
     while ((inb(PS2_STATUS_PORT) & 0x01) == 0) {
         /* wait */
@@ -44,16 +57,7 @@ static uint8_t mouse_read(void) {
     return inb(PS2_DATA_PORT);
 }
 
-static void mouse_irq_handler(registers_t *r) {
-    (void)r;
-
-    uint8_t status = inb(PS2_STATUS_PORT);
-    if ((status & 0x20) == 0) {
-        return;
-    }
-
-    uint8_t data = inb(PS2_DATA_PORT);
-
+static void mouse_byte(uint8_t data) {
     if (packet_index == 0 && (data & 0x08) == 0) {
         return;
     }
@@ -68,6 +72,7 @@ static void mouse_irq_handler(registers_t *r) {
     int8_t dx = (int8_t)packet[1];
     int8_t dy = (int8_t)packet[2];
 
+    uint32_t flags = spin_lock_irqsave(&mouse_lock);
     int x = mouse_x + dx;
     int y = mouse_y - dy;
 
@@ -82,6 +87,37 @@ static void mouse_irq_handler(registers_t *r) {
     mouse_dx = dx;
     mouse_dy = dy;
     mouse_updated = 1;
+    spin_unlock_irqrestore(&mouse_lock, flags);
+    wake_up(&input_wait);
+}
+
+static void mouse_tasklet_fn(void *arg) {
+    (void)arg;
+    while (byte_tail != byte_head) {
+        uint8_t data = byte_buf[byte_tail];
+        byte_tail = (byte_tail + 1) % MOUSE_BUF_SIZE;
+        mouse_byte(data);
+    }
+}
+
+static tasklet_t mouse_tasklet = TASKLET_INIT(mouse_tasklet_fn, 0);
+
+/* Only take the byte off the controller; packets wait for the tasklet */
+static void mouse_irq_handler(registers_t *r) {
+    (void)r;
+
+    uint8_t status = inb(PS2_STATUS_PORT);
+    if ((status & 0x20) == 0) {
+        return;
+    }
+
+    uint8_t data = inb(PS2_DATA_PORT);
+    uint32_t next = (byte_head + 1) % MOUSE_BUF_SIZE;
+    if (next != byte_tail) {
+        byte_buf[byte_head] = data;
+        byte_head = next;
+    }
+    tasklet_schedule(&mouse_tasklet);
 }
 
 void mouse_set_bounds(int width, int height) {
@@ -130,7 +166,9 @@ int mouse_poll(mouse_state_t *out) {
     if (!out) {
         return 0;
     }
+    uint32_t flags = spin_lock_irqsave(&mouse_lock);
     if (!mouse_updated) {
+        spin_unlock_irqrestore(&mouse_lock, flags);
         return 0;
     }
     out->x = mouse_x;
@@ -139,5 +177,10 @@ int mouse_poll(mouse_state_t *out) {
     out->dx = mouse_dx;
     out->dy = mouse_dy;
     mouse_updated = 0;
+    spin_unlock_irqrestore(&mouse_lock, flags);
     return 1;
 }
+
+int mouse_has_event(void) {
+    return mouse_updated;
+}
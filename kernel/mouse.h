@@ -15,4 +15,8 @@ void mouse_init(void);
 void mouse_set_bounds(int width, int height);
 int mouse_poll(mouse_state_t *out);
 
+/* A packet arrived since the last mouse_poll(); input_wait (keyboard.h)
+ * is woken for each one */
+int mouse_has_event(void);
+
 #endif
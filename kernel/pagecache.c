@@ -0,0 +1,391 @@
+/*
+ * pagecache.c - File data cached in page frames
+ *
+ * Each cached file has an inode record in a hash table, holding a radix
+ * tree of 16-way nodes over its page indices. A tree of height 0 is just
+ * the page at index 0, which is all a file of this filesystem has today.
+ * Every page is also on one circular list swept by the clock hand:
+ * a page used since the hand last passed gets a second chance, pages
+ * whose frame has other shares (a program's mapping, a read in progress)
+ * are passed over.
+ *
+ * Records come from frames cut into equal objects, kept on a free list.
+ * pc_lock is a spinlock so that frame_alloc() can reclaim from any
+ * context; it only ever tries the lock. Once free frames run low, a
+ * worker thread sweeps in the background instead of the inserting task.
+ */
+
+#include "pagecache.h"
+
+#include "paging.h"
+#include "string.h"
+#include "sync.h"
+#include "workqueue.h"
+
+#define RADIX_SHIFT      4u
+#define RADIX_SLOTS      (1u << RADIX_SHIFT)
+#define RADIX_MASK       (RADIX_SLOTS - 1u)
+#define RADIX_MAX_HEIGHT 8u     /* 16^8 covers every 32-bit index */
+
+#define INODE_HASH_SIZE  64u    /* Power of two */
+
+/* Below this many free frames, a worker thread reclaims after inserts */
+#define LOW_FRAMES       256u
+#define RECLAIM_BATCH    32u
+
+typedef struct pc_node {
+    void *slots[RADIX_SLOTS];   /* Child nodes, or pages in the last level */
+    uint32_t count;             /* Slots in use */
+} pc_node_t;
+
+typedef struct pc_inode {
+    uint32_t ino;
+    uint32_t height;
+    void *root;
+    uint32_t pages;
+    struct pc_inode *hash_next;
+} pc_inode_t;
+
+typedef struct pc_page {
+    uint32_t frame;
+    uint32_t index;
+    pc_inode_t *inode;
+    struct pc_page *clock_next;
+    struct pc_page *clock_prev;
+    uint8_t referenced;         /* Used since the hand last passed */
+    uint8_t readahead;          /* Read ahead and not used yet */
+} pc_page_t;
+
+typedef union pc_obj {
+    pc_node_t node;
+    pc_inode_t inode;
+    pc_page_t page;
+    union pc_obj *free_next;
+} pc_obj_t;
+
+static spinlock_t pc_lock = SPINLOCK_INIT;
+static pc_obj_t *free_objs;
+static pc_inode_t *inode_hash[INODE_HASH_SIZE];
+static pc_page_t *clock_hand;
+static pagecache_stats_t stats;
+
+static void *obj_alloc(void) {
+    if (!free_objs) {
+        /* frame_alloc() may try to reclaim, which fails on pc_lock */
+        uint32_t f = frame_alloc();
+        if (!f) {
+            return 0;
+        }
+        pc_obj_t *o = (pc_obj_t *)f;
+        for (uint32_t i = 0; i < PAGE_SIZE / sizeof(pc_obj_t); i++) {
+            o[i].free_next = free_objs;
+            free_objs = &o[i];
+        }
+    }
+    pc_obj_t *o = free_objs;
+    free_objs = o->free_next;
+    memset(o, 0, sizeof(*o));
+    return o;
+}
+
+static void obj_free(void *p) {
+    pc_obj_t *o = (pc_obj_t *)p;
+    o->free_next = free_objs;
+    free_objs = o;
+}
+
+static int fits(uint32_t height, uint32_t index) {
+    return height >= RADIX_MAX_HEIGHT || (index >> (height * RADIX_SHIFT)) == 0;
+}
+
+static pc_inode_t *inode_find(uint32_t ino) {
+    pc_inode_t *in = inode_hash[ino & (INODE_HASH_SIZE - 1)];
+    while (in && in->ino != ino) {
+        in = in->hash_next;
+    }
+    return in;
+}
+
+static pc_inode_t *inode_get(uint32_t ino) {
+    pc_inode_t *in = inode_find(ino);
+    if (in) {
+        return in;
+    }
+    in = (pc_inode_t *)obj_alloc();
+    if (!in) {
+        return 0;
+    }
+    in->ino = ino;
+    in->hash_next = inode_hash[ino & (INODE_HASH_SIZE - 1)];
+    inode_hash[ino & (INODE_HASH_SIZE - 1)] = in;
+    stats.files++;
+    return in;
+}
+
+/* Free the nodes of a tree whose pages are already gone */
+static void tree_free(void *p, uint32_t height) {
+    if (!p || height == 0) {
+        return;
+    }
+    pc_node_t *n = (pc_node_t *)p;
+    for (uint32_t i = 0; i < RADIX_SLOTS; i++) {
+        tree_free(n->slots[i], height - 1);
+    }
+    obj_free(n);
+}
+
+static void inode_free(pc_inode_t *in) {
+    pc_inode_t **pp = &inode_hash[in->ino & (INODE_HASH_SIZE - 1)];
+    while (*pp != in) {
+        pp = &(*pp)->hash_next;
+    }
+    *pp = in->hash_next;
+    tree_free(in->root, in->height);
+    obj_free(in);
+    stats.files--;
+}
+
+/* The slot holding page index, or 0 if there is no path to it */
+static void **tree_slot(pc_inode_t *in, uint32_t index, pc_node_t **parent) {
+    *parent = 0;
+    if (!fits(in->height, index)) {
+        return 0;
+    }
+    void **slot = &in->root;
+    for (uint32_t h = in->height; h > 0; h--) {
+        if (!*slot) {
+            return 0;
+        }
+        *parent = (pc_node_t *)*slot;
+        slot = &(*parent)->slots[(index >> ((h - 1) * RADIX_SHIFT)) & RADIX_MASK];
+    }
+    return slot;
+}
+
+static pc_page_t *page_find(uint32_t ino, uint32_t index) {
+    pc_inode_t *in = inode_find(ino);
+    pc_node_t *parent;
+    void **slot = in ? tree_slot(in, index, &parent) : 0;
+    return slot ? (pc_page_t *)*slot : 0;
+}
+
+static int tree_insert(pc_inode_t *in, uint32_t index, pc_page_t *page) {
+    while (!fits(in->height, index)) {
+        if (in->root) {
+            pc_node_t *n = (pc_node_t *)obj_alloc();
+            if (!n) {
+                return -1;
+            }
+            n->slots[0] = in->root;
+            n->count = 1;
+            in->root = n;
+        }
+        in->height++;
+    }
+
+    pc_node_t *parent = 0;
+    void **slot = &in->root;
+    for (uint32_t h = in->height; h > 0; h--) {
+        if (!*slot) {
+            pc_node_t *n = (pc_node_t *)obj_alloc();
+            if (!n) {
+                return -1;
+            }
+            *slot = n;
+            if (parent) {
+                parent->count++;
+            }
+        }
+        parent = (pc_node_t *)*slot;
+        slot = &parent->slots[(index >> ((h - 1) * RADIX_SHIFT)) & RADIX_MASK];
+    }
+    if (*slot) {
+        return -1;
+    }
+    *slot = page;
+    if (parent) {
+        parent->count++;
+    }
+    return 0;
+}
+
+/* Take page off the clock and give back its frame and record */
+static void page_release(pc_page_t *pg) {
+    if (pg->clock_next == pg) {
+        clock_hand = 0;
+    } else {
+        pg->clock_prev->clock_next = pg->clock_next;
+        pg->clock_next->clock_prev = pg->clock_prev;
+        if (clock_hand == pg) {
+            clock_hand = pg->clock_next;
+        }
+    }
+    frame_free(pg->frame);
+    obj_free(pg);
+    stats.pages--;
+}
+
+static void page_evict(pc_page_t *pg) {
+    pc_inode_t *in = pg->inode;
+    pc_node_t *parent;
+    void **slot = tree_slot(in, pg->index, &parent);
+    *slot = 0;
+    if (parent) {
+        parent->count--;
+    }
+    page_release(pg);
+    if (--in->pages == 0) {
+        inode_free(in);
+    }
+}
+
+/* Release every page under p; the nodes go with inode_free() */
+static void tree_drop(void *p, uint32_t height) {
+    if (!p) {
+        return;
+    }
+    if (height == 0) {
+        page_release((pc_page_t *)p);
+        return;
+    }
+    pc_node_t *n = (pc_node_t *)p;
+    for (uint32_t i = 0; i < RADIX_SLOTS; i++) {
+        tree_drop(n->slots[i], height - 1);
+    }
+}
+
+static uint32_t reclaim_locked(uint32_t count) {
+    uint32_t freed = 0;
+    uint32_t budget = 2 * stats.pages;  /* Every page gets its second chance */
+    while (freed < count && clock_hand && budget-- > 0) {
+        pc_page_t *pg = clock_hand;
+        clock_hand = pg->clock_next;
+        if (frame_is_shared(pg->frame)) {
+            continue;  /* Freeing it would not free the frame */
+        }
+        if (pg->referenced) {
+            pg->referenced = 0;
+            continue;
+        }
+        page_evict(pg);
+        freed++;
+    }
+    stats.reclaimed += freed;
+    return freed;
+}
+
+/* Worker thread: sweep a batch at a time, interrupts on in between,
+ * until enough frames are free or nothing more can go */
+static void background_reclaim(void *arg) {
+    (void)arg;
+    uint32_t freed;
+    do {
+        uint32_t irq = spin_lock_irqsave(&pc_lock);
+        freed = frames_free() < LOW_FRAMES ? reclaim_locked(RECLAIM_BATCH) : 0;
+        spin_unlock_irqrestore(&pc_lock, irq);
+    } while (freed);
+}
+
+static work_t reclaim_work = WORK_INIT(background_reclaim, 0);
+
+uint32_t pagecache_lookup(uint32_t ino, uint32_t index, int flags) {
+    uint32_t irq = spin_lock_irqsave(&pc_lock);
+    pc_page_t *pg = page_find(ino, index);
+    uint32_t frame = 0;
+    if (pg) {
+        frame = pg->frame;
+        if (!(flags & PC_PROBE)) {
+            pg->referenced = 1;
+            stats.hits++;
+            if (pg->readahead) {
+                pg->readahead = 0;
+                stats.readahead_hits++;
+            }
+        }
+        if ((flags & PC_SHARE) && frame_share(frame) != 0) {
+            frame = 0;
+        }
+    } else if (!(flags & PC_PROBE)) {
+        stats.misses++;
+    }
+    spin_unlock_irqrestore(&pc_lock, irq);
+    return frame;
+}
+
+int pagecache_insert(uint32_t ino, uint32_t index, uint32_t frame, int flags) {
+    uint32_t irq = spin_lock_irqsave(&pc_lock);
+    pc_inode_t *in = inode_get(ino);
+    pc_page_t *pg = in ? (pc_page_t *)obj_alloc() : 0;
+    if (!pg || tree_insert(in, index, pg) != 0) {
+        if (pg) {
+            obj_free(pg);
+        }
+        if (in && in->pages == 0) {
+            inode_free(in);
+        }
+        spin_unlock_irqrestore(&pc_lock, irq);
+        return -1;
+    }
+
+    pg->frame = frame;
+    pg->index = index;
+    pg->inode = in;
+    pg->readahead = (flags & PC_READAHEAD) != 0;
+    pg->referenced = !pg->readahead;
+    in->pages++;
+    stats.pages++;
+    if (pg->readahead) {
+        stats.readahead++;
+    }
+
+    /* Just behind the hand: the last page it reaches */
+    if (clock_hand) {
+        pg->clock_next = clock_hand;
+        pg->clock_prev = clock_hand->clock_prev;
+        clock_hand->clock_prev->clock_next = pg;
+        clock_hand->clock_prev = pg;
+    } else {
+        pg->clock_next = pg->clock_prev = pg;
+        clock_hand = pg;
+    }
+
+    if (flags & PC_SHARE) {
+        frame_share(frame);  /* A new frame has room for shares */
+    }
+    spin_unlock_irqrestore(&pc_lock, irq);
+
+    if (frames_free() < LOW_FRAMES) {
+        work_queue(&reclaim_work);
+    }
+    return 0;
+}
+
+void pagecache_drop(uint32_t ino) {
+    uint32_t irq = spin_lock_irqsave(&pc_lock);
+    pc_inode_t *in = inode_find(ino);
+    if (in) {
+        tree_drop(in->root, in->height);
+        inode_free(in);
+    }
+    spin_unlock_irqrestore(&pc_lock, irq);
+}
+
+uint32_t pagecache_reclaim(uint32_t count) {
+    uint32_t irq;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(irq) : : "memory");
+    uint32_t freed = 0;
+    if (spin_trylock(&pc_lock)) {
+        freed = reclaim_locked(count);
+        spin_unlock(&pc_lock);
+    }
+    if (irq & 0x200) {
+        __asm__ volatile("sti");
+    }
+    return freed;
+}
+
+void pagecache_get_stats(pagecache_stats_t *s) {
+    uint32_t irq = spin_lock_irqsave(&pc_lock);
+    *s = stats;
+    spin_unlock_irqrestore(&pc_lock, irq);
+}
@@ -0,0 +1,47 @@
+/*
+ * pagecache.h - File data cached in page frames
+ *
+ * Pages are found by (inode, page index) through a radix tree per file.
+ * The cache owns one share of each frame it holds, so a page that is also
+ * mapped into a program outlives its eviction. It grows while memory is
+ * plentiful and gives pages back through a clock sweep when free frames
+ * run low, or when frame_alloc() finds none at all.
+ */
+
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+#include <stdint.h>
+
+/* pagecache_lookup() and pagecache_insert() flags */
+#define PC_SHARE     0x1    /* Take a share of the frame for the caller */
+#define PC_PROBE     0x4    /* Only look: no statistics, no reference */
+#define PC_READAHEAD 0x8    /* Inserted ahead of use */
+
+typedef struct {
+    uint32_t pages;             /* Cached now */
+    uint32_t files;             /* Inodes with cached pages */
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead;         /* Pages read ahead */
+    uint32_t readahead_hits;    /* ... and then used */
+    uint32_t reclaimed;         /* Evicted to free memory */
+} pagecache_stats_t;
+
+/* Cached frame of the page, or 0 */
+uint32_t pagecache_lookup(uint32_t ino, uint32_t index, int flags);
+
+/* Hand frame (one share of it) to the cache as that page; -1 if it is
+ * already cached or there is no memory, and the frame stays the caller's */
+int pagecache_insert(uint32_t ino, uint32_t index, uint32_t frame, int flags);
+
+/* Forget every page of ino, e.g. because the file changed */
+void pagecache_drop(uint32_t ino);
+
+/* Evict up to count unused pages; returns how many were freed. Safe from
+ * any context: it gives up if the cache is busy. */
+uint32_t pagecache_reclaim(uint32_t count);
+
+void pagecache_get_stats(pagecache_stats_t *s);
+
+#endif /* PAGECACHE_H */
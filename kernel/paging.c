@@ -0,0 +1,355 @@
+/*
+ * paging.c - Page frames, the kernel page directory and kernel stacks
+ */
+
+#include "paging.h"
+
+#include "cpu.h"
+#include "idt.h"
+#include "io.h"
+#include "mmap.h"
+#include "pagecache.h"
+#include "process.h"
+#include "smp.h"
+#include "string.h"
+#include "sync.h"
+#include "vga.h"
+#include "vm.h"
+
+#define FRAME_COUNT   (FRAME_LIMIT >> PAGE_SHIFT)
+#define KSTACK_TABLES (KSTACK_AREA_SIZE >> 22)
+#define KSTACK_SLOTS  (KSTACK_AREA_SIZE / (KSTACK_SLOT_PAGES * PAGE_SIZE))
+
+/* Everything at or above this is device memory: map it uncached */
+#define MMIO_BASE     0xE0000000u
+
+/* Cached file pages asked back when frames run out */
+#define FRAME_RECLAIM_BATCH 32u
+
+static uint32_t page_dir[1024] __attribute__((aligned(4096)));
+static uint32_t kstack_tables[KSTACK_TABLES][1024] __attribute__((aligned(4096)));
+
+static uint32_t frame_bitmap[FRAME_COUNT / 32];   /* Bit set: frame in use */
+static uint32_t frame_end;                        /* One past the last frame */
+static uint32_t frame_hint;                       /* Bitmap word to search first */
+static uint32_t free_count;
+static uint32_t total_count;
+static uint8_t *frame_shares;                     /* Owners beyond the first */
+
+static uint8_t kstack_slot_used[KSTACK_SLOTS];
+static int enabled;
+
+static spinlock_t frame_lock = SPINLOCK_INIT;
+static spinlock_t kstack_lock = SPINLOCK_INIT;
+
+static inline void invlpg(uint32_t addr) {
+    __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static uint8_t cmos_read(uint8_t reg) {
+    outb(0x70, reg);
+    return inb(0x71);
+}
+
+/* Top of RAM from the CMOS extended-memory counters */
+static uint32_t detect_memory_top(void) {
+    uint32_t blocks = cmos_read(0x34) | ((uint32_t)cmos_read(0x35) << 8);
+    if (blocks) {
+        return 0x01000000u + blocks * 0x10000u;   /* 64 KiB blocks above 16 MiB */
+    }
+    uint32_t kb = cmos_read(0x30) | ((uint32_t)cmos_read(0x31) << 8);
+    return 0x00100000u + kb * 1024u;
+}
+
+static void frames_init(void) {
+    uint32_t top = detect_memory_top();
+    if (top > FRAME_LIMIT) {
+        top = FRAME_LIMIT;
+    }
+
+    memset(frame_bitmap, 0xFF, sizeof(frame_bitmap));
+    frame_end = top >> PAGE_SHIFT;
+    frame_hint = FRAME_BASE >> (PAGE_SHIFT + 5);
+    free_count = 0;
+
+    for (uint32_t f = FRAME_BASE >> PAGE_SHIFT; f < frame_end; f++) {
+        frame_bitmap[f / 32] &= ~(1u << (f % 32));
+        free_count++;
+    }
+    total_count = free_count;
+
+    /* One byte per frame, kept in frames of its own */
+    uint32_t pages = (frame_end + PAGE_SIZE - 1) / PAGE_SIZE;
+    frame_shares = (uint8_t *)frame_alloc_contig(pages);
+    if (frame_shares) {
+        memset(frame_shares, 0, pages * PAGE_SIZE);
+    }
+}
+
+static uint32_t frame_take(void) {
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    uint32_t words = (frame_end + 31) / 32;
+    uint32_t phys = 0;
+
+    for (uint32_t n = 0; n < words && free_count; n++) {
+        uint32_t w = (frame_hint + n) % words;
+        if (frame_bitmap[w] != 0xFFFFFFFFu) {
+            uint32_t f = w * 32 + (uint32_t)__builtin_ctz(~frame_bitmap[w]);
+            if (f >= frame_end) {
+                continue;
+            }
+            frame_bitmap[w] |= 1u << (f % 32);
+            free_count--;
+            frame_hint = w;
+            phys = f << PAGE_SHIFT;
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return phys;
+}
+
+/* Out of frames: the page cache gives some back and the caller retries */
+static int frame_reclaim(void) {
+    return pagecache_reclaim(FRAME_RECLAIM_BATCH) != 0;
+}
+
+uint32_t frame_alloc(void) {
+    uint32_t phys = frame_take();
+    if (!phys && frame_reclaim()) {
+        phys = frame_take();
+    }
+    return phys;
+}
+
+static uint32_t frame_take_contig(uint32_t count) {
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    uint32_t run = 0;
+    uint32_t phys = 0;
+
+    for (uint32_t f = FRAME_BASE >> PAGE_SHIFT; f < frame_end && count; f++) {
+        if (frame_bitmap[f / 32] & (1u << (f % 32))) {
+            run = 0;
+            continue;
+        }
+        if (++run == count) {
+            uint32_t first = f + 1 - count;
+            for (uint32_t i = first; i <= f; i++) {
+                frame_bitmap[i / 32] |= 1u << (i % 32);
+            }
+            free_count -= count;
+            phys = first << PAGE_SHIFT;
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return phys;
+}
+
+uint32_t frame_alloc_contig(uint32_t count) {
+    uint32_t phys = frame_take_contig(count);
+    if (!phys && frame_reclaim()) {
+        phys = frame_take_contig(count);
+    }
+    return phys;
+}
+
+void frame_free(uint32_t phys) {
+    uint32_t f = phys >> PAGE_SHIFT;
+    if (phys < FRAME_BASE || f >= frame_end) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    if (frame_shares && frame_shares[f]) {
+        frame_shares[f]--;
+    } else if (frame_bitmap[f / 32] & (1u << (f % 32))) {
+        frame_bitmap[f / 32] &= ~(1u << (f % 32));
+        free_count++;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+}
+
+int frame_share(uint32_t phys) {
+    uint32_t f = phys >> PAGE_SHIFT;
+    if (!frame_shares || phys < FRAME_BASE || f >= frame_end) {
+        return -1;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&frame_lock);
+    int ret = -1;
+    if (frame_shares[f] < 0xFF) {
+        frame_shares[f]++;
+        ret = 0;
+    }
+    spin_unlock_irqrestore(&frame_lock, flags);
+    return ret;
+}
+
+int frame_is_shared(uint32_t phys) {
+    uint32_t f = phys >> PAGE_SHIFT;
+    return frame_shares && phys >= FRAME_BASE && f < frame_end && frame_shares[f] != 0;
+}
+
+uint32_t frames_free(void) {
+    return free_count;
+}
+
+uint32_t frames_total(void) {
+    return total_count;
+}
+
+static uint32_t *kstack_pte(uint32_t virt) {
+    uint32_t off = virt - KSTACK_AREA_BASE;
+    return &kstack_tables[off >> 22][(off >> PAGE_SHIFT) & 1023u];
+}
+
+int kstack_is_guard(uint32_t addr) {
+    if (!enabled || addr < KSTACK_AREA_BASE || addr - KSTACK_AREA_BASE >= KSTACK_AREA_SIZE) {
+        return 0;
+    }
+    return !(*kstack_pte(addr) & PAGE_PRESENT);
+}
+
+uint32_t kstack_alloc(uint32_t size) {
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0) {
+        pages = 1;
+    }
+    if (pages > KSTACK_SLOT_PAGES - 1) {
+        return 0;
+    }
+
+    /* Without paging there are no guard pages: hand out plain frames */
+    if (!enabled) {
+        return frame_alloc_contig(pages);
+    }
+
+    uint32_t flags = spin_lock_irqsave(&kstack_lock);
+    uint32_t slot = 0;
+    while (slot < KSTACK_SLOTS && kstack_slot_used[slot]) {
+        slot++;
+    }
+    if (slot == KSTACK_SLOTS) {
+        spin_unlock_irqrestore(&kstack_lock, flags);
+        return 0;
+    }
+    kstack_slot_used[slot] = 1;
+    spin_unlock_irqrestore(&kstack_lock, flags);
+
+    /* Map the top pages of the slot; the pages below stay unmapped */
+    uint32_t top = KSTACK_AREA_BASE + (slot + 1) * KSTACK_SLOT_PAGES * PAGE_SIZE;
+    uint32_t base = top - pages * PAGE_SIZE;
+    for (uint32_t va = base; va < top; va += PAGE_SIZE) {
+        uint32_t frame = frame_alloc();
+        if (!frame) {
+            kstack_free(base, va - base);
+            return 0;
+        }
+        *kstack_pte(va) = frame | PAGE_PRESENT | PAGE_WRITE;
+        invlpg(va);
+    }
+    return base;
+}
+
+void kstack_free(uint32_t base, uint32_t size) {
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    if (!enabled) {
+        for (uint32_t i = 0; i < pages; i++) {
+            frame_free(base + i * PAGE_SIZE);
+        }
+        return;
+    }
+
+    /* Other CPUs may still cache the mappings: the frames are reused
+     * only after every TLB has dropped them */
+    uint32_t frames[KSTACK_SLOT_PAGES];
+    for (uint32_t i = 0; i < pages; i++) {
+        uint32_t *pte = kstack_pte(base + i * PAGE_SIZE);
+        frames[i] = (*pte & PAGE_PRESENT) ? *pte & ~(PAGE_SIZE - 1) : 0;
+        *pte = 0;
+    }
+    smp_tlb_shootdown(base, pages);
+    for (uint32_t i = 0; i < pages; i++) {
+        if (frames[i]) {
+            frame_free(frames[i]);
+        }
+    }
+
+    uint32_t slot = (base - KSTACK_AREA_BASE) / (KSTACK_SLOT_PAGES * PAGE_SIZE);
+    uint32_t flags = spin_lock_irqsave(&kstack_lock);
+    kstack_slot_used[slot] = 0;
+    spin_unlock_irqrestore(&kstack_lock, flags);
+}
+
+static void page_fault_handler(registers_t *r) {
+    uint32_t addr;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(addr));
+    process_t *p = process_current();
+    if (p && vm_fault(p->page_dir, addr, r->err_code) == 0) {
+        return;  /* Copy-on-write resolved */
+    }
+    if (p && mmap_fault(p, addr, r) == 0) {
+        return;  /* Mapped file page filled in */
+    }
+
+    if (kstack_is_guard(addr)) {
+        vga_printf("Kernel stack overflow: pid %u (%s) at %x\n",
+                   p ? p->pid : 0, p ? p->name : "?", addr);
+    } else {
+        vga_printf("Page fault at %x eip=%x err=%x\n", addr, r->eip, r->err_code);
+    }
+
+    /* Tasks die; the boot context has nowhere to go */
+    if (p && p->pid != 0) {
+        process_exit(-1);
+    }
+    for (;;) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+int paging_init(void) {
+    frames_init();
+
+    if (!(cpuid_edx(1) & CPUID_EDX_PSE)) {
+        return -1;
+    }
+
+    /* Identity map all 4 GiB with 4 MiB pages, user accessible as before
+     * paging (V86 and the user mode test run out of kernel memory); user
+     * address spaces copy this without the user bit */
+    for (uint32_t i = 0; i < 1024; i++) {
+        uint32_t base = i << 22;
+        page_dir[i] = base | PAGE_PRESENT | PAGE_WRITE | PAGE_USER | PAGE_LARGE;
+        if (base >= MMIO_BASE) {
+            page_dir[i] |= PAGE_PCD | PAGE_PWT;
+        }
+    }
+
+    /* The kernel stack area replaces its part of the identity map */
+    memset(kstack_tables, 0, sizeof(kstack_tables));
+    for (uint32_t t = 0; t < KSTACK_TABLES; t++) {
+        page_dir[(KSTACK_AREA_BASE >> 22) + t] = (uint32_t)kstack_tables[t] | PAGE_PRESENT | PAGE_WRITE;
+    }
+
+    idt_register_handler(14, page_fault_handler);
+
+    write_cr4(read_cr4() | CR4_PSE);
+    write_cr3((uint32_t)page_dir);
+    /* WP: kernel writes to user pages honour copy-on-write too */
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+    enabled = 1;
+    return 0;
+}
+
+int paging_enabled(void) {
+    return enabled;
+}
+
+uint32_t paging_kernel_dir(void) {
+    return (uint32_t)page_dir;
+}
@@ -0,0 +1,66 @@
+/*
+ * paging.h - Page frames, the kernel page directory and kernel stacks
+ *
+ * Physical memory stays identity mapped with 4 MiB pages, so existing
+ * code keeps using physical addresses. Kernel stacks live in a separate
+ * 4 KiB-mapped area where every stack has unmapped guard pages below it.
+ */
+
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+#define PAGE_SIZE    4096u
+#define PAGE_SHIFT   12u
+
+/* Page table entry flags */
+#define PAGE_PRESENT 0x001u
+#define PAGE_WRITE   0x002u
+#define PAGE_USER    0x004u
+#define PAGE_PWT     0x008u
+#define PAGE_PCD     0x010u
+#define PAGE_LARGE   0x080u
+
+/* Frames above the heap are handed out by frame_alloc() */
+#define FRAME_BASE   0x00400000u
+#define FRAME_LIMIT  0x10000000u    /* Track at most 256 MiB */
+
+/* Kernel stack area: slots of KSTACK_SLOT_PAGES, stack at the top */
+#define KSTACK_AREA_BASE  0xD0000000u
+#define KSTACK_AREA_SIZE  0x01000000u   /* 16 MiB */
+#define KSTACK_SLOT_PAGES 16u
+#define KSTACK_MAX_SIZE   ((KSTACK_SLOT_PAGES - 1u) * PAGE_SIZE)
+
+/* Detect memory, build the page directory and enable paging.
+ * Returns -1 (and leaves paging off) if the CPU lacks 4 MiB pages. */
+int paging_init(void);
+
+int paging_enabled(void);
+
+/* Physical address of the kernel page directory */
+uint32_t paging_kernel_dir(void);
+
+/* 4 KiB physical frames; 0 on failure */
+uint32_t frame_alloc(void);
+uint32_t frame_alloc_contig(uint32_t count);
+
+/* A frame may have several owners (copy-on-write); frame_free() drops
+ * one and frees the frame with the last */
+void frame_free(uint32_t phys);
+int frame_share(uint32_t phys);       /* Add an owner; -1 if at the limit */
+int frame_is_shared(uint32_t phys);
+uint32_t frames_free(void);
+uint32_t frames_total(void);
+
+/* Kernel stack of size bytes (rounded to pages, at most KSTACK_MAX_SIZE).
+ * Returns the lowest usable address, or 0. */
+uint32_t kstack_alloc(uint32_t size);
+
+/* Once APs are up, call with interrupts enabled and no spinlock held */
+void kstack_free(uint32_t base, uint32_t size);
+
+/* 1 if addr is in an unmapped page of the kernel stack area */
+int kstack_is_guard(uint32_t addr);
+
+#endif /* PAGING_H */
@@ -0,0 +1,119 @@
+/*
+ * pci.c - PCI configuration space and message signalled interrupts
+ *
+ * An address written to 0xCF8 selects the dword that 0xCFC then reads
+ * or writes, so the two accesses are kept together under pci_lock.
+ */
+
+#include "pci.h"
+
+#include "io.h"
+#include "lapic.h"
+#include "smp.h"
+#include "sync.h"
+
+#define PCI_CONFIG_ADDR    0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+#define PCI_CONFIG_ENABLE  0x80000000u
+
+#define PCI_REG_ID         0x00
+#define PCI_REG_COMMAND    0x04   /* Status in the high half */
+#define PCI_REG_CAP_PTR    0x34
+
+#define PCI_COMMAND_INTX_OFF (1u << 10)
+#define PCI_STATUS_CAP_LIST  (1u << 20)
+
+#define PCI_CAP_MSI        0x05
+#define PCI_CAP_MAX        48     /* Bounds a looping list */
+
+/* MSI capability: control in the high half of the first dword */
+#define MSI_CONTROL_ENABLE (1u << 16)
+#define MSI_CONTROL_MME    (7u << 20)   /* Multiple messages enabled */
+#define MSI_CONTROL_64BIT  (1u << 23)
+#define MSI_ADDR_BASE      0xFEE00000u  /* Local APIC, destination << 12 */
+
+static spinlock_t pci_lock = SPINLOCK_INIT;
+static uint32_t msi_used;       /* One bit per vector from PCI_MSI_VECTOR_BASE */
+
+uint32_t pci_read32(uint32_t dev, uint8_t offset) {
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDR, PCI_CONFIG_ENABLE | dev << 8 | (offset & 0xFCu));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_lock, flags);
+    return value;
+}
+
+void pci_write32(uint32_t dev, uint8_t offset, uint32_t value) {
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDR, PCI_CONFIG_ENABLE | dev << 8 | (offset & 0xFCu));
+    outl(PCI_CONFIG_DATA, value);
+    spin_unlock_irqrestore(&pci_lock, flags);
+}
+
+int pci_find(uint16_t vendor, uint16_t device, uint32_t *dev) {
+    uint32_t want = (uint32_t)device << 16 | vendor;
+    for (uint32_t d = 0; d < PCI_DEV(256, 0, 0); d++) {
+        if (pci_read32(d, PCI_REG_ID) == want) {
+            *dev = d;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint8_t pci_find_cap(uint32_t dev, uint8_t id) {
+    if (!(pci_read32(dev, PCI_REG_COMMAND) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+    uint8_t off = (uint8_t)(pci_read32(dev, PCI_REG_CAP_PTR) & 0xFC);
+    for (int i = 0; i < PCI_CAP_MAX && off; i++) {
+        uint32_t cap = pci_read32(dev, off);
+        if ((cap & 0xFF) == id) {
+            return off;
+        }
+        off = (uint8_t)((cap >> 8) & 0xFC);
+    }
+    return 0;
+}
+
+static int msi_alloc(void) {
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    int vector = -1;
+    for (int i = 0; i < PCI_MSI_VECTORS; i++) {
+        if (!(msi_used & (1u << i))) {
+            msi_used |= 1u << i;
+            vector = PCI_MSI_VECTOR_BASE + i;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&pci_lock, flags);
+    return vector;
+}
+
+int pci_msi_enable(uint32_t dev, uint32_t cpu, interrupt_handler_t handler) {
+    uint8_t cap = pci_find_cap(dev, PCI_CAP_MSI);
+    if (!cap || !lapic_present() || cpu >= MAX_CPUS || !cpus[cpu].online) {
+        return -1;
+    }
+    int vector = msi_alloc();
+    if (vector < 0) {
+        return -1;
+    }
+    idt_register_handler((uint8_t)vector, handler);
+
+    /* Fixed delivery, edge triggered, physical destination; one message */
+    uint32_t control = pci_read32(dev, cap) & ~(MSI_CONTROL_ENABLE | MSI_CONTROL_MME);
+    pci_write32(dev, cap, control);
+    pci_write32(dev, cap + 4, MSI_ADDR_BASE | cpus[cpu].apic_id << 12);
+    if (control & MSI_CONTROL_64BIT) {
+        pci_write32(dev, cap + 8, 0);
+        pci_write32(dev, cap + 12, (uint32_t)vector);
+    } else {
+        pci_write32(dev, cap + 8, (uint32_t)vector);
+    }
+    pci_write32(dev, cap, control | MSI_CONTROL_ENABLE);
+
+    uint32_t command = pci_read32(dev, PCI_REG_COMMAND) & 0xFFFFu;
+    pci_write32(dev, PCI_REG_COMMAND, command | PCI_COMMAND_INTX_OFF);
+    return vector;
+}
@@ -0,0 +1,38 @@
+/*
+ * pci.h - PCI configuration space and message signalled interrupts
+ *
+ * Configuration space is reached through mechanism #1 (ports 0xCF8 and
+ * 0xCFC). A device using MSI writes its vector straight to a local APIC,
+ * so it takes no I/O APIC input and can be steered to any CPU.
+ */
+
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#include "idt.h"
+
+/* Vectors handed out to MSI devices; isr.asm has a stub for each */
+#define PCI_MSI_VECTOR_BASE 64
+#define PCI_MSI_VECTORS     8
+
+/* A device function as bus << 8 | slot << 3 | function */
+#define PCI_DEV(bus, slot, func) \
+    ((uint32_t)(bus) << 8 | (uint32_t)(slot) << 3 | (uint32_t)(func))
+
+uint32_t pci_read32(uint32_t dev, uint8_t offset);
+void pci_write32(uint32_t dev, uint8_t offset, uint32_t value);
+
+/* First function with the given IDs; returns 0 and sets *dev if found */
+int pci_find(uint16_t vendor, uint16_t device, uint32_t *dev);
+
+/* Offset of capability id in dev's list, 0 if it has none */
+uint8_t pci_find_cap(uint32_t dev, uint8_t id);
+
+/* Give dev a free MSI vector aimed at cpus[cpu], with handler attached,
+ * and turn off its INTx line. Returns the vector, or -1 if dev has no
+ * MSI capability, no vector is left or there is no local APIC. */
+int pci_msi_enable(uint32_t dev, uint32_t cpu, interrupt_handler_t handler);
+
+#endif /* PCI_H */
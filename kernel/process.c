@@ -1,67 +1,502 @@
 /*
  * process.c - Process management implementation
+ *
+ * Each CPU has its own run queue: one FIFO per priority and a bitmap of
+ * non-empty ones, so picking the next task is O(1). A task keeps the CPU
+ * while no ready task has an equal or higher priority; equal priorities
+ * round-robin when the time slice (longer for higher priorities) ends.
+ *
+ * The owner takes work from the head of its queues; an idle CPU steals
+ * from the tail of the busiest one, and a CPU with tasks waiting pushes
+ * some to the least loaded CPU every few scheduler ticks. A task only
+ * runs on CPUs in its affinity mask. Wakeups go to the least loaded
+ * allowed CPU, the task's last one on a tie.
+ *
+ * A CPU's run queue lock guards its queues and the state of every task
+ * whose cpu field names it; the field itself only changes with that lock
+ * held. The lock is held across context_switch() and dropped by the task
+ * switched to, so no CPU can pick up a task whose registers are still
+ * being saved. task_lock guards the task lists and is taken before any
+ * run queue lock; two run queue locks are taken in index order.
+ *
+ * TCBs come from the heap and are recycled through a free list; kernel
+ * stacks come from the guard-paged stack area. Exited tasks are reaped by
+ * an idle task (or when a new task is created), never from schedule().
+ *
+ * User tasks have a parent, which collects their exit code with
+ * process_wait(); they stay zombies until then, or until the parent is
+ * gone. Kernel threads have no parent and are reaped as soon as they exit.
  */
 
 #include "process.h"
+#include "clock.h"
+#include "file.h"
+#include "fpu.h"
+#include "idt.h"
 #include "memory.h"
+#include "paging.h"
+#include "smp.h"
+#include "softirq.h"
 #include "string.h"
+#include "sync.h"
+#include "timer.h"
+#include "trace.h"
+#include "tss.h"
 #include "vga.h"
+#include "vm.h"
+
+/* Scheduler ticks between load-balancing passes */
+#define BALANCE_TICKS 4
+
+/* Per-CPU ready deques, one FIFO per priority */
+typedef struct {
+    spinlock_t lock;
+    process_t *head[PRIORITY_LEVELS];
+    process_t *tail[PRIORITY_LEVELS];
+    uint32_t bitmap;                 /* Bit n set: head[n] non-empty */
+    uint32_t nr_ready;
+    uint32_t balance_ticks;
+    process_t *migrate;              /* Switched out, leaving this CPU */
+} runqueue_t;
+
+/* Every task, in creation order, and PID lookup */
+static process_t kernel_task;
+static process_t *all_tasks;
+static process_t **all_tail = &all_tasks;
+static process_t *pid_hash[PID_HASH_SIZE];
+static process_t *free_tcbs;         /* Reaped TCBs, linked by all_next */
 
-/* Process table */
-static process_t process_table[MAX_PROCESSES];
-static process_t *current_process = 0;
 static uint32_t next_pid = 1;
 static int scheduler_enabled = 0;
 
-/* Initialize process management */
-void process_init(void) {
-    /* Clear all process slots */
-    memset(process_table, 0, sizeof(process_table));
-    current_process = 0;
-    next_pid = 1;
-    scheduler_enabled = 0;
+/* Guards the task lists, the free list and next_pid */
+static spinlock_t task_lock = SPINLOCK_INIT;
+
+static runqueue_t runqueues[MAX_CPUS];
+
+/* Parents waiting in process_wait() */
+static wait_queue_t child_wq = WAIT_QUEUE_INIT;
+
+/* Ticks per slice by priority */
+static const uint8_t slice_ticks[PRIORITY_LEVELS] = {20, 10, 8, 6, 4, 3, 2, 1};
+
+static void idle_loop(void);
+static runqueue_t *schedule_locked(void);
+static process_t *find_process(uint32_t pid);
+
+static inline int is_idle(process_t *p) {
+    return cpus[p->cpu].idle == p;
+}
+
+static inline int cpu_allowed(const process_t *p, uint32_t cpu) {
+    return (p->affinity >> cpu) & 1u;
+}
+
+static inline runqueue_t *this_rq(void) {
+    return &runqueues[this_cpu()->id];
+}
+
+/* Disable interrupts and lock this CPU's run queue */
+static runqueue_t *rq_lock_this(uint32_t *flags) {
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(*flags) : : "memory");
+    runqueue_t *rq = this_rq();
+    spin_lock(&rq->lock);
+    return rq;
+}
+
+static void rq_lock_pair(runqueue_t *a, runqueue_t *b) {
+    if (a == b) {
+        spin_lock(&a->lock);
+    } else if (a < b) {
+        spin_lock(&a->lock);
+        spin_lock(&b->lock);
+    } else {
+        spin_lock(&b->lock);
+        spin_lock(&a->lock);
+    }
 }
 
-/* Find a free process slot */
-static process_t *find_free_slot(void) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_UNUSED) {
-            return &process_table[i];
+static void rq_unlock_pair(runqueue_t *a, runqueue_t *b) {
+    spin_unlock(&a->lock);
+    if (a != b) {
+        spin_unlock(&b->lock);
+    }
+}
+
+/* Lock the run queue p belongs to (interrupts off) */
+static runqueue_t *task_rq_lock(process_t *p) {
+    for (;;) {
+        runqueue_t *rq = &runqueues[p->cpu];
+        spin_lock(&rq->lock);
+        if (rq == &runqueues[p->cpu]) {
+            return rq;
         }
+        spin_unlock(&rq->lock);
     }
-    return 0;
 }
 
-/* Find process by PID */
-static process_t *find_process(uint32_t pid) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid == pid &&
-            process_table[i].state != PROCESS_UNUSED) {
-            return &process_table[i];
+/* Lock p's run queue and dst (interrupts off); returns p's */
+static runqueue_t *task_rq_lock_pair(process_t *p, runqueue_t *dst) {
+    for (;;) {
+        runqueue_t *rq = &runqueues[p->cpu];
+        rq_lock_pair(rq, dst);
+        if (rq == &runqueues[p->cpu]) {
+            return rq;
         }
+        rq_unlock_pair(rq, dst);
     }
-    return 0;
 }
 
-/* Wrapper to handle process exit when entry function returns */
+static void rq_enqueue(runqueue_t *rq, process_t *p) {
+    uint32_t prio = p->priority;
+    p->run_next = 0;
+    p->run_prev = rq->tail[prio];
+    if (rq->tail[prio]) {
+        rq->tail[prio]->run_next = p;
+    } else {
+        rq->head[prio] = p;
+    }
+    rq->tail[prio] = p;
+    rq->bitmap |= 1u << prio;
+    rq->nr_ready++;
+}
+
+static void rq_remove(runqueue_t *rq, process_t *p) {
+    uint32_t prio = p->priority;
+    if (p->run_prev) {
+        p->run_prev->run_next = p->run_next;
+    } else {
+        rq->head[prio] = p->run_next;
+    }
+    if (p->run_next) {
+        p->run_next->run_prev = p->run_prev;
+    } else {
+        rq->tail[prio] = p->run_prev;
+    }
+    p->run_next = 0;
+    p->run_prev = 0;
+    if (!rq->head[prio]) {
+        rq->bitmap &= ~(1u << prio);
+    }
+    rq->nr_ready--;
+}
+
+/* Highest ready priority; only valid when bitmap != 0 */
+static inline uint32_t rq_best(const runqueue_t *rq) {
+    return (uint32_t)__builtin_ctz(rq->bitmap);
+}
+
+/* Mark p READY and queue it on its CPU (idle tasks are never queued) */
+static void make_ready(process_t *p) {
+    p->state = PROCESS_READY;
+    if (!is_idle(p)) {
+        rq_enqueue(&runqueues[p->cpu], p);
+    }
+}
+
+/* Tasks running or waiting on cpu (read without its lock: a hint) */
+static uint32_t cpu_load(uint32_t cpu) {
+    process_t *cur = cpus[cpu].current;
+    return runqueues[cpu].nr_ready + (cur && !is_idle(cur) ? 1u : 0u);
+}
+
+/* Least loaded online CPU in mask, preferring p's last one on a tie */
+static uint32_t select_cpu(process_t *p, uint32_t mask) {
+    uint32_t best = p->cpu;
+    uint32_t best_load = UINT32_MAX;
+    if (((mask >> p->cpu) & 1u) && cpus[p->cpu].online) {
+        best_load = cpu_load(p->cpu);
+    }
+
+    for (uint32_t i = 0; i < MAX_CPUS && best_load; i++) {
+        if (((mask >> i) & 1u) && cpus[i].online) {
+            uint32_t load = cpu_load(i);
+            if (load < best_load) {
+                best = i;
+                best_load = load;
+            }
+        }
+    }
+    return best;
+}
+
+/* Move READY task p from src to dst's CPU; both locked */
+static void move_task(process_t *p, runqueue_t *src, runqueue_t *dst) {
+    rq_remove(src, p);
+    p->cpu = (uint32_t)(dst - runqueues);
+    rq_enqueue(dst, p);
+}
+
+/* Move up to n READY tasks allowed on dst's CPU from the tail of src's
+ * queues, best priority first; both locked. Returns how many moved. */
+static uint32_t pull_tasks(runqueue_t *src, runqueue_t *dst, uint32_t n) {
+    uint32_t cpu = (uint32_t)(dst - runqueues);
+    uint32_t moved = 0;
+
+    for (uint32_t prio = 0; prio < PRIORITY_LEVELS && moved < n; prio++) {
+        process_t *p = src->tail[prio];
+        while (p && moved < n) {
+            process_t *prev = p->run_prev;
+            if (cpu_allowed(p, cpu)) {
+                move_task(p, src, dst);
+                moved++;
+            }
+            p = prev;
+        }
+    }
+    return moved;
+}
+
+/* p was just queued on its CPU: preempt that CPU if p beats what runs
+ * there, else wake an idle CPU allowed to steal it */
+static void kick_cpu(process_t *p) {
+    cpu_t *c = &cpus[p->cpu];
+    process_t *cur = c->current;
+
+    if (!cur || is_idle(cur) || p->priority < cur->priority) {
+        c->need_resched = 1;
+        smp_send_resched(c);
+        return;
+    }
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        cpu_t *o = &cpus[i];
+        if (o != c && o->online && cpu_allowed(p, i) && o->current && is_idle(o->current)) {
+            smp_send_resched(o);
+            return;
+        }
+    }
+
+    /* Nobody free: c must start slicing between equals */
+    if (!c->slicing) {
+        smp_send_resched(c);
+    }
+}
+
+/* Idle CPU: take half of the busiest run queue's waiting tasks. Called
+ * from the idle task with interrupts off and no lock held. */
+static uint32_t steal_work(void) {
+    uint32_t self = this_cpu()->id;
+    uint32_t victim = self;
+    uint32_t most = 0;
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (i != self && cpus[i].online && runqueues[i].nr_ready > most) {
+            victim = i;
+            most = runqueues[i].nr_ready;
+        }
+    }
+    if (victim == self) {
+        return 0;
+    }
+
+    runqueue_t *src = &runqueues[victim];
+    runqueue_t *dst = &runqueues[self];
+    rq_lock_pair(src, dst);
+    uint32_t moved = pull_tasks(src, dst, (src->nr_ready + 1) / 2);
+    rq_unlock_pair(src, dst);
+    return moved;
+}
+
+/* Busy CPU, from its scheduler tick: push waiting tasks to the least
+ * loaded CPU until the two are within one task of each other */
+static void balance_push(void) {
+    uint32_t self = this_cpu()->id;
+    uint32_t load = cpu_load(self);
+    uint32_t target = self;
+    uint32_t least = load;
+
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (i != self && cpus[i].online && cpu_load(i) < least) {
+            target = i;
+            least = cpu_load(i);
+        }
+    }
+    if (target == self || least + 1 >= load) {
+        return;
+    }
+
+    runqueue_t *src = &runqueues[self];
+    runqueue_t *dst = &runqueues[target];
+    rq_lock_pair(src, dst);
+    uint32_t moved = 0;
+    load = cpu_load(self);
+    least = cpu_load(target);
+    if (load > least + 1) {
+        moved = pull_tasks(src, dst, (load - least) / 2);
+    }
+    rq_unlock_pair(src, dst);
+
+    if (moved) {
+        cpus[target].need_resched = 1;
+        smp_send_resched(&cpus[target]);
+    }
+}
+
+/* After a switch, on the new task's stack with this CPU's run queue
+ * locked: queue a task that may no longer run here on a CPU that may
+ * run it, now that its registers are saved */
+static void finish_switch(void) {
+    runqueue_t *rq = this_rq();
+    process_t *p = rq->migrate;
+    if (!p) {
+        return;
+    }
+    rq->migrate = 0;
+
+    runqueue_t *dst = &runqueues[select_cpu(p, p->affinity)];
+    spin_unlock(&rq->lock);
+    rq_lock_pair(rq, dst);
+    if (p->killed) {
+        p->state = PROCESS_ZOMBIE;
+    } else {
+        p->cpu = (uint32_t)(dst - runqueues);
+        make_ready(p);
+        kick_cpu(p);
+    }
+    if (dst != rq) {
+        spin_unlock(&dst->lock);
+    }
+}
+
+static void task_insert(process_t *p) {
+    p->all_next = 0;
+    *all_tail = p;
+    all_tail = &p->all_next;
+
+    process_t **bucket = &pid_hash[p->pid & (PID_HASH_SIZE - 1)];
+    p->hash_next = *bucket;
+    *bucket = p;
+}
+
+static void task_remove(process_t *p) {
+    process_t **pp = &pid_hash[p->pid & (PID_HASH_SIZE - 1)];
+    while (*pp && *pp != p) {
+        pp = &(*pp)->hash_next;
+    }
+    if (*pp) {
+        *pp = p->hash_next;
+    }
+
+    pp = &all_tasks;
+    while (*pp && *pp != p) {
+        pp = &(*pp)->all_next;
+    }
+    if (*pp) {
+        *pp = p->all_next;
+        if (all_tail == &p->all_next) {
+            all_tail = pp;
+        }
+    }
+}
+
+/* Free the stacks and TCBs of exited tasks nobody will wait for. Taking
+ * a zombie's run queue lock waits out the switch away from it; its timer,
+ * wait entry, address space and stack are released with the locks
+ * dropped (the stack needs a TLB shootdown). A zombie kept for its parent
+ * that died without process_exit() (killed) is reported here. */
+static void reap_zombies(void) {
+    process_t *dead = 0;
+    int report = 0;
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+
+    process_t *p = all_tasks;
+    while (p) {
+        process_t *next = p->all_next;
+        if (p->state == PROCESS_ZOMBIE) {
+            if (p->ppid == PID_NONE || !find_process(p->ppid)) {
+                spin_unlock(&task_rq_lock(p)->lock);
+                task_remove(p);
+                p->all_next = dead;
+                dead = p;
+            } else if (!p->exited) {
+                p->exited = 1;
+                report = 1;
+            }
+        }
+        p = next;
+    }
+
+    spin_unlock_irqrestore(&task_lock, flags);
+    if (report) {
+        wake_up(&child_wq);
+    }
+    if (!dead) {
+        return;
+    }
+
+    process_t *last = dead;
+    for (p = dead; p; p = p->all_next) {
+        ktimer_cancel(&p->sleep_timer);
+        wait_abort(p);
+        file_close_all(p);
+        vm_destroy(p->page_dir);
+        kstack_free(p->stack_base, p->stack_size);
+        p->state = PROCESS_UNUSED;
+        last = p;
+    }
+
+    flags = spin_lock_irqsave(&task_lock);
+    last->all_next = free_tcbs;
+    free_tcbs = dead;
+    spin_unlock_irqrestore(&task_lock, flags);
+}
+
+/* First code a new task runs: finish the switch that started it */
 static void process_wrapper(void (*entry)(void)) {
+    finish_switch();
+    spin_unlock(&this_rq()->lock);
+    __asm__ volatile("sti");
+
     entry();
     process_exit(0);
 }
 
-/* Create a new process */
-int process_create(const char *name, void (*entry)(void)) {
-    process_t *p = find_free_slot();
+/* First code of a user task: leave through the frame at its stack top */
+static void user_entry(void) {
+    process_t *p = process_current();
+    isr_return_to((registers_t *)(p->stack_base + p->stack_size) - 1);
+}
+
+/* Allocate a TCB and stack laid out for context_switch() to start entry,
+ * with reserve bytes left free at the top; the task is not yet listed or
+ * runnable */
+static process_t *task_alloc(const char *name, void (*entry)(void), uint32_t stack_size,
+                             uint32_t reserve) {
+    if (stack_size < 64 || stack_size > KSTACK_MAX_SIZE) {
+        return 0;
+    }
+    stack_size = (stack_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    uint32_t stack = kstack_alloc(stack_size);
+    if (!stack) {
+        return 0;  /* Out of stack slots or frames */
+    }
+
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    process_t *p = free_tcbs;
+    if (p) {
+        free_tcbs = p->all_next;
+    }
+    spin_unlock_irqrestore(&task_lock, flags);
+
+    if (!p) {
+        p = (process_t *)kmalloc(sizeof(process_t));
+    }
     if (!p) {
-        return -1;  /* No free slots */
+        kstack_free(stack, stack_size);
+        return 0;
     }
 
     /* Initialize process */
     memset(p, 0, sizeof(process_t));
-    p->pid = next_pid++;
-    p->state = PROCESS_READY;
-    p->priority = 1;
-    p->time_slice = 10;  /* Default time slice */
+    p->stack_base = stack;
+    p->stack_size = stack_size;
+    p->priority = PRIORITY_DEFAULT;
+    p->time_slice = slice_ticks[PRIORITY_DEFAULT];
+    p->affinity = CPU_MASK_ALL;
+    p->ppid = PID_NONE;
+    fpu_task_init(p);
 
     /* Copy name */
     size_t len = strlen(name);
@@ -73,13 +508,13 @@ int process_create(const char *name, void (*entry)(void)) {
      * Stack grows downward, so we start at the top
      * The stack needs to look like context_switch will restore from it
      */
-    uint32_t *sp = &p->stack[PROCESS_STACK_SIZE / 4 - 1];
+    uint32_t *sp = (uint32_t *)(stack + stack_size - reserve) - 1;
 
     /* Push entry point address for process_wrapper */
     *sp-- = (uint32_t)entry;        /* Argument to wrapper */
     *sp-- = 0;                       /* Fake return address */
     *sp-- = (uint32_t)process_wrapper; /* EIP - entry point */
-    *sp-- = 0x202;                   /* EFLAGS - interrupts enabled */
+    *sp-- = 0x002;                   /* EFLAGS - off until the run queue is unlocked */
     *sp-- = 0;                       /* EAX */
     *sp-- = 0;                       /* ECX */
     *sp-- = 0;                       /* EDX */
@@ -90,21 +525,174 @@ int process_create(const char *name, void (*entry)(void)) {
     *sp = 0;                         /* EDI */
 
     p->stack_ptr = sp;
+    return p;
+}
+
+/* Initialize process management */
+void process_init(void) {
+    all_tasks = 0;
+    all_tail = &all_tasks;
+    free_tcbs = 0;
+    memset(pid_hash, 0, sizeof(pid_hash));
+    memset(runqueues, 0, sizeof(runqueues));
+    next_pid = 1;
+    scheduler_enabled = 0;
+
+    /* The boot context becomes pid 0 and keeps the boot stack; its
+     * registers are saved on the first switch away */
+    cpu_t *cpu = this_cpu();
+    process_t *k = &kernel_task;
+    memset(k, 0, sizeof(process_t));
+    k->pid = 0;
+    k->state = PROCESS_RUNNING;
+    k->priority = PRIORITY_DEFAULT;
+    k->time_slice = slice_ticks[PRIORITY_DEFAULT];
+    k->cpu = cpu->id;
+    k->affinity = CPU_MASK_ALL;
+    k->ppid = PID_NONE;
+    fpu_task_init(k);
+    memcpy(k->name, "kernel", 7);
+    task_insert(k);
+    cpu->current = k;
+    cpu->online = 1;
+
+    /* Runs only when every other task is blocked */
+    process_create_idle(cpu);
+}
+
+/* Find a live process by PID (task_lock held) */
+static process_t *find_process(uint32_t pid) {
+    process_t *p = pid_hash[pid & (PID_HASH_SIZE - 1)];
+    while (p) {
+        if (p->pid == pid && p->state != PROCESS_ZOMBIE) {
+            return p;
+        }
+        p = p->hash_next;
+    }
+    return 0;
+}
+
+/* Create a new process with the default stack size */
+int process_create(const char *name, void (*entry)(void)) {
+    return process_create_stack(name, entry, PROCESS_STACK_SIZE);
+}
+
+/* List a new task and queue it on the least loaded CPU */
+static int task_start(process_t *p) {
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    p->pid = next_pid++;
+    p->cpu = this_cpu()->id;
+    p->cpu = select_cpu(p, p->affinity);
+    int pid = (int)p->pid;
+    task_insert(p);
+
+    runqueue_t *rq = &runqueues[p->cpu];
+    spin_lock(&rq->lock);
+    make_ready(p);
+    kick_cpu(p);
+    spin_unlock(&rq->lock);
+    spin_unlock_irqrestore(&task_lock, flags);
+
+    /* A tickless timer must start slicing now that someone is waiting */
+    timer_reprogram();
+
+    return pid;
+}
+
+/* Create a new process with a stack_size-byte kernel stack */
+int process_create_stack(const char *name, void (*entry)(void), uint32_t stack_size) {
+    reap_zombies();
+
+    process_t *p = task_alloc(name, entry, stack_size, 0);
+    if (!p) {
+        return -1;
+    }
+    return task_start(p);
+}
+
+/* Create a child of the current task that enters ring 3 through frame,
+ * running in the address space page_dir (0: the kernel's). On success the
+ * task owns page_dir. */
+int process_create_user(const char *name, uint32_t page_dir, const registers_t *frame) {
+    reap_zombies();
+
+    process_t *p = task_alloc(name, user_entry, PROCESS_STACK_SIZE, sizeof(registers_t));
+    if (!p) {
+        return -1;
+    }
+    memcpy((registers_t *)(p->stack_base + p->stack_size) - 1, frame, sizeof(registers_t));
+    p->page_dir = page_dir;
+    p->user = 1;
+    p->ppid = process_current()->pid;
+    file_inherit(p, process_current());
+    if (process_current()->user) {
+        /* A user task's child is its fork: the ring is at the same place
+         * in the copied address space */
+        p->ring = process_current()->ring;
+        p->ring_entries = process_current()->ring_entries;
+        mmap_inherit(p, process_current());
+    }
+    return task_start(p);
+}
+
+/* Create cpu's idle task; it is never queued and never moves */
+uint32_t process_create_idle(cpu_t *cpu) {
+    char name[] = "idle0";
+    name[4] = (char)('0' + cpu->id);
 
-    return (int)p->pid;
+    process_t *p = task_alloc(name, idle_loop, PROCESS_STACK_SIZE, 0);
+    if (!p) {
+        return 0;
+    }
+    p->priority = PRIORITY_LEVELS - 1;
+    p->cpu = cpu->id;
+    p->affinity = 1u << cpu->id;
+    p->state = PROCESS_READY;
+
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    p->pid = next_pid++;
+    task_insert(p);
+    cpu->idle = p;
+    spin_unlock_irqrestore(&task_lock, flags);
+
+    return p->stack_base + p->stack_size;
 }
 
 /* Exit current process */
 void process_exit(int exit_code) {
-    if (!current_process) {
+    process_t *p = process_current();
+    if (!p) {
         return;
     }
 
-    current_process->state = PROCESS_ZOMBIE;
-    current_process->exit_code = exit_code;
+    file_close_all(p);
+    __asm__ volatile("cli");
+    ktimer_cancel(&p->sleep_timer);
 
-    /* Yield to let scheduler pick another process */
-    schedule();
+    /* Leave the address space before tearing it down */
+    if (p->page_dir) {
+        uint32_t dir = p->page_dir;
+        p->page_dir = 0;
+        vm_switch(0);
+        vm_destroy(dir);
+    }
+
+    /* Tell a waiting parent, which collects us once we are a zombie */
+    p->exit_code = exit_code;
+    __atomic_store_n(&p->exited, 1, __ATOMIC_SEQ_CST);
+    if (p->ppid != PID_NONE) {
+        wake_up(&child_wq);
+    }
+
+    /* Switch away for good without dropping the lock: the task must be
+     * off this CPU before a reaper can see it as a zombie */
+    runqueue_t *rq = this_rq();
+    spin_lock(&rq->lock);
+    p->state = PROCESS_ZOMBIE;
+    if (scheduler_enabled) {
+        rq = schedule_locked();
+    }
+    spin_unlock(&rq->lock);
 
     /* Should never reach here */
     while(1) {
@@ -117,142 +705,494 @@ void process_yield(void) {
     schedule();
 }
 
+/* 1 if the current task has a child matching pid (any if negative) that
+ * has exited, or no such child at all */
+static int child_exited(process_t *self, int pid) {
+    int children = 0;
+    int done = 0;
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    for (process_t *c = all_tasks; c && !done; c = c->all_next) {
+        if (c->ppid == self->pid && (pid < 0 || c->pid == (uint32_t)pid)) {
+            children++;
+            done = c->exited || c->state == PROCESS_ZOMBIE;
+        }
+    }
+    spin_unlock_irqrestore(&task_lock, flags);
+    return done || !children;
+}
+
+/* Wait for a child of the current task (pid, or any if negative) to exit
+ * and let it be reaped. Returns its pid and stores its exit code, or
+ * returns -1 if there is no such child. */
+int process_wait(int pid, int *status) {
+    process_t *self = process_current();
+
+    for (;;) {
+        int children = 0;
+        process_t *done = 0;
+        uint32_t flags = spin_lock_irqsave(&task_lock);
+        for (process_t *c = all_tasks; c && !done; c = c->all_next) {
+            if (c->ppid == self->pid && (pid < 0 || c->pid == (uint32_t)pid)) {
+                children++;
+                if (c->exited || c->state == PROCESS_ZOMBIE) {
+                    done = c;
+                }
+            }
+        }
+
+        /* An exiting child is a few instructions (with interrupts off)
+         * from being switched away for good: look again until it is */
+        int zombie = 0;
+        if (done) {
+            runqueue_t *rq = task_rq_lock(done);
+            zombie = done->state == PROCESS_ZOMBIE;
+            spin_unlock(&rq->lock);
+        }
+        if (zombie) {
+            int ret = (int)done->pid;
+            int code = done->exit_code;
+            done->ppid = PID_NONE;  /* The reaper's now */
+            spin_unlock_irqrestore(&task_lock, flags);
+            if (status) {
+                *status = code;
+            }
+            return ret;
+        }
+
+        spin_unlock_irqrestore(&task_lock, flags);
+        if (!children) {
+            return -1;
+        }
+        if (done) {
+            __asm__ volatile("pause");
+        } else {
+            wait_event(child_wq, child_exited(self, pid));
+        }
+    }
+}
+
 /* Get current process */
 process_t *process_current(void) {
-    return current_process;
+    return this_cpu()->current;
 }
 
-/* Kill a process by PID */
+/* Kill a process by PID. A task running on another CPU exits there at
+ * its next reschedule, which an IPI brings forward. */
 int process_kill(uint32_t pid) {
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+
     process_t *p = find_process(pid);
-    if (!p) {
+    if (!p || p == &kernel_task || is_idle(p)) {
+        spin_unlock_irqrestore(&task_lock, flags);
         return -1;
     }
 
-    p->state = PROCESS_ZOMBIE;
-    p->exit_code = -1;
+    runqueue_t *rq = task_rq_lock(p);
+    spin_unlock(&task_lock);
 
-    /* If killing current process, schedule another */
-    if (p == current_process) {
-        schedule();
+    p->killed = 1;
+    p->exit_code = -1;
+    int self = 0;
+    if (p->state == PROCESS_RUNNING) {
+        cpu_t *c = &cpus[p->cpu];
+        self = c == this_cpu();
+        c->need_resched = 1;
+        smp_send_resched(c);
+    } else {
+        /* Its timer, wait entry and address space go with the reaper */
+        if (p->state == PROCESS_READY) {
+            rq_remove(rq, p);
+        }
+        p->state = PROCESS_ZOMBIE;
+        p->exited = 1;
     }
 
+    spin_unlock_irqrestore(&rq->lock, flags);
+    if (self) {
+        process_exit(-1);  /* Killing ourselves */
+    }
+    wake_up(&child_wq);
     return 0;
 }
 
-/* Clean up zombie processes */
-static void cleanup_zombies(void) {
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_ZOMBIE) {
-            process_table[i].state = PROCESS_UNUSED;
-            process_table[i].pid = 0;
-        }
+/* Change a task's priority; it takes effect at once for queued tasks */
+int process_set_priority(uint32_t pid, uint32_t priority) {
+    if (priority >= PRIORITY_LEVELS) {
+        return -1;
     }
-}
 
-/* Simple round-robin scheduler */
-void schedule(void) {
-    if (!scheduler_enabled) {
-        return;
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    process_t *p = find_process(pid);
+    if (!p || is_idle(p)) {
+        spin_unlock_irqrestore(&task_lock, flags);
+        return -1;
     }
 
-    cleanup_zombies();
+    runqueue_t *rq = task_rq_lock(p);
+    spin_unlock(&task_lock);
 
-    /* Find next runnable process */
-    process_t *next = 0;
-    int start = 0;
+    if (p->state == PROCESS_READY) {
+        rq_remove(rq, p);
+        p->priority = priority;
+        rq_enqueue(rq, p);
+        kick_cpu(p);
+    } else {
+        p->priority = priority;
+    }
+    if (p->time_slice > slice_ticks[priority]) {
+        p->time_slice = slice_ticks[priority];
+    }
 
-    if (current_process) {
-        /* Start searching from after current process */
-        for (int i = 0; i < MAX_PROCESSES; i++) {
-            if (&process_table[i] == current_process) {
-                start = i + 1;
-                break;
-            }
+    /* The task running there may now be outranked */
+    cpu_t *c = &cpus[p->cpu];
+    if (rq->bitmap && rq_best(rq) < c->current->priority) {
+        c->need_resched = 1;
+        smp_send_resched(c);
+    }
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return 0;
+}
+
+/* Restrict a task to the CPUs in mask. A queued task moves at once; a
+ * running one moves when its CPU next reschedules. */
+int process_set_affinity(uint32_t pid, uint32_t mask) {
+    uint32_t online = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (cpus[i].online) {
+            online |= 1u << i;
         }
     }
+    if (!(mask & online)) {
+        return -1;
+    }
 
-    /* Search for next ready process */
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        int idx = (start + i) % MAX_PROCESSES;
-        if (process_table[idx].state == PROCESS_READY) {
-            next = &process_table[idx];
-            break;
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    process_t *p = find_process(pid);
+    if (!p || is_idle(p)) {
+        spin_unlock_irqrestore(&task_lock, flags);
+        return -1;
+    }
+
+    runqueue_t *dst = &runqueues[select_cpu(p, mask)];
+    runqueue_t *rq = task_rq_lock_pair(p, dst);
+    spin_unlock(&task_lock);
+
+    p->affinity = mask;
+    int self = 0;
+    if (!cpu_allowed(p, p->cpu)) {
+        if (p->state == PROCESS_READY) {
+            move_task(p, rq, dst);
+            kick_cpu(p);
+        } else if (p->state == PROCESS_RUNNING) {
+            cpu_t *c = &cpus[p->cpu];
+            self = c == this_cpu();
+            c->need_resched = 1;
+            smp_send_resched(c);
         }
+        /* A blocked task is placed when it wakes */
     }
 
-    /* If no process found, try to run current if it's still ready */
-    if (!next && current_process && current_process->state == PROCESS_RUNNING) {
-        return;  /* Keep running current */
+    rq_unlock_pair(rq, dst);
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+    if (self) {
+        schedule();
     }
+    return 0;
+}
 
-    if (!next) {
-        /* No runnable processes - idle */
-        return;
+/* Pick the next task for this CPU and switch to it. Called with this
+ * CPU's run queue locked and interrupts off; across the switch the lock
+ * is released by whichever task runs next (see process_wrapper). Returns
+ * the run queue now locked, which is another CPU's if the task moved. */
+static runqueue_t *schedule_locked(void) {
+    cpu_t *cpu = this_cpu();
+    runqueue_t *rq = &runqueues[cpu->id];
+    process_t *old = cpu->current;
+    process_t *next;
+    cpu->need_resched = 0;
+
+    /* Killed just as it blocked (schedule() catches the rest): never run
+     * again; the reaper tells any parent */
+    if (old->killed) {
+        old->state = PROCESS_ZOMBIE;
+    }
+
+    int stay = old->state == PROCESS_RUNNING && !is_idle(old) && cpu_allowed(old, cpu->id);
+    if (stay && (!rq->bitmap || rq_best(rq) > old->priority)) {
+        return rq;  /* Nothing of equal or higher priority is waiting */
     }
 
-    /* Perform context switch */
-    process_t *old = current_process;
+    if (rq->bitmap) {
+        next = rq->head[rq_best(rq)];
+        rq_remove(rq, next);
+    } else if (stay || (old->state == PROCESS_RUNNING && is_idle(old))) {
+        return rq;  /* Idle keeps running */
+    } else {
+        next = cpu->idle;  /* Everyone is blocked, gone or moving */
+    }
 
-    if (old && old->state == PROCESS_RUNNING) {
-        old->state = PROCESS_READY;
+    if (old->state == PROCESS_RUNNING) {
+        if (is_idle(old) || cpu_allowed(old, cpu->id)) {
+            make_ready(old);
+        } else {
+            rq->migrate = old;  /* Queued elsewhere by finish_switch() */
+        }
     }
 
     next->state = PROCESS_RUNNING;
-    current_process = next;
+    next->cpu = cpu->id;
+    cpu->current = next;
 
-    if (old && old != next) {
+    if (old != next) {
+        TRACE(TRACE_SCHED_SWITCH, old->pid);
+        fpu_switch(old, next);
+        vm_switch(next->page_dir);
+        tss_set_kernel_stack(next->user ? next->stack_base + next->stack_size : 0);
         context_switch(&old->stack_ptr, next->stack_ptr);
-    } else if (!old) {
-        /* First process to run - just switch to it */
-        context_switch((uint32_t **)&old, next->stack_ptr);
+        finish_switch();
+    }
+    return this_rq();
+}
+
+/* Priority-queue scheduler */
+void schedule(void) {
+    if (!scheduler_enabled) {
+        return;
+    }
+
+    /* Killed while running: exit properly, telling any parent */
+    process_t *p = process_current();
+    if (p->killed && !is_idle(p)) {
+        process_exit(-1);
     }
+
+    uint32_t flags;
+    rq_lock_this(&flags);
+    runqueue_t *rq = schedule_locked();
+    spin_unlock_irqrestore(&rq->lock, flags);
 }
 
 /* Initialize scheduler */
 void scheduler_init(void) {
     scheduler_enabled = 1;
+    timer_reprogram();
+}
+
+/* Become this AP's idle task and start taking work */
+void scheduler_start_ap(void) {
+    cpu_t *cpu = this_cpu();
+
+    runqueue_t *rq = this_rq();
+    spin_lock(&rq->lock);
+    cpu->idle->state = PROCESS_RUNNING;
+    cpu->current = cpu->idle;
+    spin_unlock(&rq->lock);
+
+    timer_reprogram();
+    __asm__ volatile("sti");
+    idle_loop();
+}
+
+/* 1 if a tick could preempt the current task for another ready one */
+int scheduler_wants_tick(void) {
+    return scheduler_enabled && this_rq()->bitmap != 0;
 }
 
 /* Called from timer interrupt */
 void scheduler_tick(void) {
-    if (!scheduler_enabled || !current_process) {
+    if (!scheduler_enabled) {
+        return;
+    }
+
+    cpu_t *cpu = this_cpu();
+    runqueue_t *rq = this_rq();
+    process_t *p = cpu->current;
+    if (!p) {
+        return;
+    }
+    p->total_ticks++;
+
+    /* Softirqs are running on this task's stack: switch once they are
+     * done (softirq_run() checks) */
+    if (cpu->in_softirq) {
+        cpu->need_resched = 1;
+        return;
+    }
+
+    if (is_idle(p)) {
+        if (rq->bitmap) {
+            schedule();
+        }
         return;
     }
 
-    current_process->total_ticks++;
+    /* Others are waiting here: spread them out */
+    if (rq->bitmap && ++rq->balance_ticks >= BALANCE_TICKS) {
+        rq->balance_ticks = 0;
+        balance_push();
+    }
+
+    if (p->time_slice > 0) {
+        p->time_slice--;
+    }
+
+    if (p->time_slice == 0) {
+        p->time_slice = slice_ticks[p->priority];
+        schedule();
+    } else if (cpu->need_resched || p->killed) {
+        schedule();
+    }
+}
 
-    if (current_process->time_slice > 0) {
-        current_process->time_slice--;
+/* Another CPU queued work or killed our task: re-arm the slice timer and
+ * switch if asked to */
+void scheduler_resched(void) {
+    timer_reprogram();
+
+    cpu_t *cpu = this_cpu();
+    process_t *p = cpu->current;
+    if (cpu->in_softirq) {
+        cpu->need_resched = 1;
+        return;
     }
+    if (scheduler_enabled && p && (cpu->need_resched || p->killed || is_idle(p))) {
+        schedule();
+    }
+}
 
-    if (current_process->time_slice == 0) {
-        current_process->time_slice = 10;  /* Reset time slice */
+/* Halt until an interrupt makes some task ready or another CPU has
+ * work to spare */
+static void idle_loop(void) {
+    for (;;) {
+        reap_zombies();
+
+        __asm__ volatile("cli");
+        softirq_run();
+        if (!this_rq()->bitmap && !this_cpu()->softirq_pending && !steal_work()) {
+            /* sti takes effect after hlt starts: no lost wakeup */
+            __asm__ volatile("sti; hlt");
+        }
+        __asm__ volatile("sti");
         schedule();
     }
 }
 
+int process_can_block(void) {
+    process_t *p = process_current();
+    return scheduler_enabled && p && !is_idle(p);
+}
+
+/* Make a blocked task runnable on the least loaded CPU it may use
+ * (safe from interrupt context) */
+void process_wake(process_t *p) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+
+    for (;;) {
+        uint32_t target = select_cpu(p, p->affinity);
+        runqueue_t *dst = &runqueues[target];
+        runqueue_t *rq = task_rq_lock_pair(p, dst);
+
+        int retry = 0;
+        if (p->state == PROCESS_BLOCKED) {
+            if (cpu_allowed(p, target)) {
+                p->cpu = target;
+                make_ready(p);
+                kick_cpu(p);
+            } else {
+                retry = 1;  /* Affinity changed under us */
+            }
+        }
+
+        rq_unlock_pair(rq, dst);
+        if (!retry) {
+            break;
+        }
+    }
+
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+    timer_reprogram();
+}
+
+static void sleep_expired(void *arg) {
+    process_wake((process_t *)arg);
+}
+
+/* Block the current task until process_wake() or, if deadline_ns is
+ * non-zero, until clock_ns() reaches it. Call with interrupts disabled.
+ * The task is marked blocked and switched away under one hold of its
+ * run queue lock, so a wakeup racing in from another CPU cannot be lost. */
+void process_block_locked(uint64_t deadline_ns, spinlock_t *lock) {
+    process_t *p = process_current();
+
+    runqueue_t *rq = this_rq();
+    spin_lock(&rq->lock);
+    p->state = PROCESS_BLOCKED;
+    if (lock) {
+        spin_unlock(lock);
+    }
+    if (deadline_ns) {
+        ktimer_add(&p->sleep_timer, deadline_ns, sleep_expired, p);
+    }
+    rq = schedule_locked();
+    spin_unlock(&rq->lock);
+
+    if (deadline_ns) {
+        ktimer_cancel(&p->sleep_timer);
+    }
+    if (lock) {
+        spin_lock(lock);
+    }
+}
+
+void process_block(uint64_t deadline_ns) {
+    process_block_locked(deadline_ns, 0);
+}
+
+/* Block the current task until clock_ns() reaches deadline_ns */
+void process_sleep_until(uint64_t deadline_ns) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+
+    while (clock_ns() < deadline_ns) {
+        process_block(deadline_ns);
+    }
+
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+}
+
 /* List all processes (for debugging/ps command) */
 void process_list(void) {
-    vga_puts("PID  STATE    NAME\n");
-    vga_puts("---- -------- ----------------\n");
-
-    for (int i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state != PROCESS_UNUSED) {
-            vga_print_dec(process_table[i].pid);
-            vga_puts("    ");
-
-            switch (process_table[i].state) {
-                case PROCESS_READY:   vga_puts("READY   "); break;
-                case PROCESS_RUNNING: vga_puts("RUNNING "); break;
-                case PROCESS_BLOCKED: vga_puts("BLOCKED "); break;
-                case PROCESS_ZOMBIE:  vga_puts("ZOMBIE  "); break;
-                default:              vga_puts("?       "); break;
-            }
+    vga_puts("PID  STATE    PRI CPU NAME\n");
+    vga_puts("---- -------- --- --- ----------------\n");
 
-            vga_puts(" ");
-            vga_puts(process_table[i].name);
-            vga_puts("\n");
+    uint32_t flags = spin_lock_irqsave(&task_lock);
+    for (process_t *p = all_tasks; p; p = p->all_next) {
+        vga_print_dec(p->pid);
+        vga_puts("    ");
+
+        switch (p->state) {
+            case PROCESS_READY:   vga_puts("READY   "); break;
+            case PROCESS_RUNNING: vga_puts("RUNNING "); break;
+            case PROCESS_BLOCKED: vga_puts("BLOCKED "); break;
+            case PROCESS_ZOMBIE:  vga_puts("ZOMBIE  "); break;
+            default:              vga_puts("?       "); break;
         }
+
+        vga_puts(" ");
+        vga_print_dec(p->priority);
+        vga_puts("   ");
+        vga_print_dec(p->cpu);
+        vga_puts("   ");
+        vga_puts(p->name);
+        vga_puts("\n");
     }
+    spin_unlock_irqrestore(&task_lock, flags);
 }
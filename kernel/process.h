@@ -9,12 +9,36 @@
 #include <stdint.h>
 #include <stddef.h>
 
-/* Maximum number of processes */
-#define MAX_PROCESSES 16
+#include "fpu.h"
+#include "ktimer.h"
+#include "mmap.h"
+#include "wait.h"
 
-/* Process stack size (4KB per process) */
+struct cpu;
+struct file;
+struct registers;
+struct spinlock;
+
+/* Default kernel stack size; process_create_stack() takes up to
+ * KSTACK_MAX_SIZE, and each stack has unmapped guard pages below it */
 #define PROCESS_STACK_SIZE 4096
 
+/* PID hash buckets (power of two) */
+#define PID_HASH_SIZE 64
+
+/* Scheduling priorities: 0 is highest */
+#define PRIORITY_LEVELS  8
+#define PRIORITY_DEFAULT 1
+
+/* Affinity mask allowing every CPU */
+#define CPU_MASK_ALL 0xFFFFFFFFu
+
+/* Descriptors per task */
+#define PROCESS_MAX_FDS 16
+
+/* Parent of tasks nobody waits for */
+#define PID_NONE 0xFFFFFFFFu
+
 /* Process states */
 typedef enum {
     PROCESS_UNUSED = 0,   /* Slot is free */
@@ -39,31 +63,77 @@ typedef struct {
 } cpu_context_t;
 
 /* Task Control Block (TCB) */
-typedef struct {
+typedef struct process {
     uint32_t pid;                      /* Process ID */
     process_state_t state;             /* Current state */
     cpu_context_t context;             /* Saved CPU context */
-    uint32_t stack[PROCESS_STACK_SIZE / 4]; /* Kernel stack */
+    uint32_t stack_base;               /* Lowest address of the kernel stack */
+    uint32_t stack_size;               /* Kernel stack size in bytes */
     uint32_t *stack_ptr;               /* Current stack pointer */
     char name[32];                     /* Process name */
     uint32_t priority;                 /* Priority (0 = highest) */
     uint32_t time_slice;               /* Remaining time slice */
     uint32_t total_ticks;              /* Total CPU ticks used */
     int exit_code;                     /* Exit code when terminated */
+    uint32_t cpu;                      /* CPU it runs, is queued or last ran on */
+    uint32_t affinity;                 /* Bit n set: may run on CPU n */
+    volatile int killed;               /* Exit at the next reschedule */
+    volatile int exited;               /* Exit code final, parent told */
+    uint32_t ppid;                     /* Waiting parent, or PID_NONE */
+    uint32_t page_dir;                 /* User address space, 0: kernel's */
+    int user;                          /* Runs in ring 3 */
+    struct file *files[PROCESS_MAX_FDS]; /* Open descriptors */
+    uint32_t bounce;                   /* Frame staging file I/O, or 0 */
+    uint32_t ring;                     /* Submission ring in user memory */
+    uint32_t ring_entries;
+    mmap_area_t maps[MMAP_MAX_AREAS];  /* Mapped files */
+    ktimer_t sleep_timer;              /* Wakeup for process_block deadlines */
+    wait_entry_t *wait_entry;          /* Set while queued on wait_queue */
+    wait_queue_t *wait_queue;
+    struct process *run_next;          /* Ready queue links */
+    struct process *run_prev;
+    struct process *hash_next;         /* PID hash chain */
+    struct process *all_next;          /* List of every task */
+    int fpu_used;                      /* fpu holds its state once set */
+    uint32_t fpu_cpu;                  /* CPU that last loaded fpu */
+    fpu_state_t fpu;                   /* FXSAVE area */
 } process_t;
 
 /* Process management functions */
 void process_init(void);
 int process_create(const char *name, void (*entry)(void));
+int process_create_stack(const char *name, void (*entry)(void), uint32_t stack_size);
 void process_exit(int exit_code);
 void process_yield(void);
 process_t *process_current(void);
 int process_kill(uint32_t pid);
+int process_set_priority(uint32_t pid, uint32_t priority);
+int process_set_affinity(uint32_t pid, uint32_t mask);
+
+/* User tasks: children of the creating task, collected by process_wait() */
+int process_create_user(const char *name, uint32_t page_dir, const struct registers *frame);
+int process_wait(int pid, int *status);
+
+/* Blocking: a sleeping task is PROCESS_BLOCKED until its timer fires */
+int process_can_block(void);
+void process_block(uint64_t deadline_ns);   /* IRQs off; 0 = no deadline */
+/* Like process_block for a caller holding lock, which is dropped once the
+ * task is marked blocked and taken again before returning */
+void process_block_locked(uint64_t deadline_ns, struct spinlock *lock);
+void process_sleep_until(uint64_t deadline_ns);
+void process_wake(process_t *p);
 
 /* Scheduler functions */
 void scheduler_init(void);
 void schedule(void);
 void scheduler_tick(void);           /* Called from timer interrupt */
+int scheduler_wants_tick(void);      /* Another task is ready on this CPU */
+void scheduler_resched(void);        /* Reschedule IPI from another CPU */
+
+/* Per-CPU idle tasks: process_create_idle() returns the top of the new
+ * task's stack, which an AP boots on before scheduler_start_ap() */
+uint32_t process_create_idle(struct cpu *cpu);
+void scheduler_start_ap(void);
 
 /* Context switch (implemented in assembly) */
 extern void context_switch(uint32_t **old_sp, uint32_t *new_sp);
@@ -0,0 +1,191 @@
+/*
+ * prof.c - Sampling profiler
+ *
+ * Each CPU writes only its own ring, from its timer interrupt, so taking
+ * a sample needs no lock. The ring keeps the newest PROF_RING samples;
+ * head counts every sample taken, so older ones show up as overwritten.
+ * Reports and dumps read the rings only once sampling has stopped.
+ */
+
+#include "prof.h"
+
+#include "clock.h"
+#include "fs.h"
+#include "ksyms.h"
+#include "paging.h"
+#include "smp.h"
+#include "timer.h"
+#include "vfs.h"
+#include "vga.h"
+
+#define PROF_RING 2048u    /* Samples kept per CPU; a power of two */
+
+typedef struct {
+    uint32_t eip[PROF_RING];
+    uint32_t head;          /* Samples taken; the next goes in eip[head % PROF_RING] */
+    uint64_t next_ns;       /* When the next one is due */
+} prof_ring_t;
+
+static prof_ring_t rings[MAX_CPUS];
+static volatile int prof_on;
+static uint64_t prof_period_ns;
+
+static uint32_t ring_kept(const prof_ring_t *ring) {
+    return ring->head < PROF_RING ? ring->head : PROF_RING;
+}
+
+/* i-th oldest sample still in the ring */
+static uint32_t ring_sample(const prof_ring_t *ring, uint32_t i) {
+    return ring->eip[(ring->head - ring_kept(ring) + i) & (PROF_RING - 1)];
+}
+
+uint32_t prof_start(uint32_t hz) {
+    if (hz == 0) {
+        hz = PROF_DEFAULT_HZ;
+    }
+    if (hz > PROF_MAX_HZ) {
+        hz = PROF_MAX_HZ;
+    }
+    if (!timer_is_tickless() && hz > TIMER_FREQ) {
+        hz = TIMER_FREQ;
+    }
+
+    prof_on = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    prof_period_ns = NSEC_PER_SEC / hz;
+    uint64_t now = clock_ns();
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        rings[i].head = 0;
+        rings[i].next_ns = now;
+    }
+    __atomic_store_n(&prof_on, 1, __ATOMIC_SEQ_CST);
+
+    /* Idle CPUs may have their timers armed a second out */
+    timer_reprogram();
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        smp_send_resched(&cpus[i]);
+    }
+    return hz;
+}
+
+void prof_stop(void) {
+    __atomic_store_n(&prof_on, 0, __ATOMIC_SEQ_CST);
+}
+
+int prof_active(void) {
+    return prof_on;
+}
+
+void prof_tick(const registers_t *r, uint64_t now) {
+    if (!prof_on) {
+        return;
+    }
+    prof_ring_t *ring = &rings[this_cpu()->id];
+    if (now < ring->next_ns) {
+        return;
+    }
+
+    /* Skip samples missed while interrupts were off rather than bunch them */
+    ring->next_ns += prof_period_ns;
+    if (ring->next_ns <= now) {
+        ring->next_ns = now + prof_period_ns;
+    }
+    ring->eip[ring->head & (PROF_RING - 1)] = r->eip;
+    ring->head++;
+}
+
+uint64_t prof_next_ns(void) {
+    if (!prof_on) {
+        return UINT64_MAX;
+    }
+    return rings[this_cpu()->id].next_ns;
+}
+
+int prof_report(uint32_t top) {
+    if (prof_on) {
+        return -1;
+    }
+
+    /* One counter per symbol, then one for everything outside kernel text */
+    uint32_t slots = ksym_count + 1;
+    uint32_t pages = (slots * sizeof(uint32_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t *counts = (uint32_t *)frame_alloc_contig(pages);
+    if (!counts) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < slots; i++) {
+        counts[i] = 0;
+    }
+
+    uint32_t total = 0;
+    uint32_t lost = 0;
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        const prof_ring_t *ring = &rings[c];
+        uint32_t kept = ring_kept(ring);
+        for (uint32_t i = 0; i < kept; i++) {
+            int sym = ksym_find(ring_sample(ring, i));
+            counts[sym < 0 ? ksym_count : (uint32_t)sym]++;
+        }
+        total += kept;
+        lost += ring->head - kept;
+    }
+
+    vga_printf("%u samples", total);
+    if (lost) {
+        vga_printf(", %u older ones overwritten", lost);
+    }
+    vga_putc('\n');
+
+    /* Repeatedly take the largest remaining count; top is small */
+    for (uint32_t n = 0; n < top && total; n++) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i < slots; i++) {
+            if (counts[i] > counts[best]) {
+                best = i;
+            }
+        }
+        if (counts[best] == 0) {
+            break;
+        }
+        uint32_t tenths = counts[best] * 1000u / total;
+        vga_printf("%u.%u%%  %u  %s\n", tenths / 10u, tenths % 10u, counts[best],
+                   best == ksym_count ? "[user]" : ksym_names + ksyms[best].name);
+        counts[best] = 0;
+    }
+
+    for (uint32_t i = 0; i < pages; i++) {
+        frame_free((uint32_t)counts + i * PAGE_SIZE);
+    }
+    return 0;
+}
+
+int prof_dump(const char *path) {
+    if (prof_on) {
+        return -1;
+    }
+    uint32_t *out = (uint32_t *)frame_alloc();
+    if (!out) {
+        return -1;
+    }
+
+    /* Newest samples first from each CPU in turn, so every CPU gets an
+     * equal share when they do not all fit */
+    uint32_t max = FS_MAX_FILE_SIZE / sizeof(uint32_t);
+    uint32_t n = 0;
+    for (uint32_t age = 0; n < max; age++) {
+        uint32_t taken = n;
+        for (uint32_t c = 0; c < MAX_CPUS && n < max; c++) {
+            uint32_t kept = ring_kept(&rings[c]);
+            if (age < kept) {
+                out[n++] = ring_sample(&rings[c], kept - 1 - age);
+            }
+        }
+        if (n == taken) {
+            break;
+        }
+    }
+
+    int ret = vfs_write_raw(path, (const char *)out, n * sizeof(uint32_t));
+    frame_free((uint32_t)out);
+    return ret < 0 ? -1 : (int)n;
+}
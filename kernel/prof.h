@@ -0,0 +1,39 @@
+/*
+ * prof.h - Sampling profiler
+ *
+ * While running, the timer interrupt on every CPU records the EIP it
+ * interrupted into that CPU's ring at the chosen rate. Reports name the
+ * kernel function for each sample; dumps keep the raw addresses for
+ * tools/prof2folded.sh.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+#include "idt.h"
+
+#define PROF_DEFAULT_HZ 1000
+#define PROF_MAX_HZ     10000
+
+/* Clear the rings and sample at hz (0 for the default). In PIT mode the
+ * rate is capped at the tick rate. Returns the rate used. */
+uint32_t prof_start(uint32_t hz);
+void prof_stop(void);
+int prof_active(void);
+
+/* From the timer interrupt, interrupts off: sample r if due at now */
+void prof_tick(const registers_t *r, uint64_t now);
+
+/* When this CPU's next sample is due; UINT64_MAX while stopped */
+uint64_t prof_next_ns(void);
+
+/* Print the top functions by samples; -1 while running */
+int prof_report(uint32_t top);
+
+/* Write samples as little-endian 32-bit EIPs, at most one file's worth,
+ * shared evenly between CPUs. Returns the count or -1. */
+int prof_dump(const char *path);
+
+#endif /* PROF_H */
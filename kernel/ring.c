@@ -0,0 +1,78 @@
+/*
+ * ring.c - Batched syscall submission rings
+ *
+ * The ring lives in program memory, so the kernel trusts nothing in it:
+ * the size is kept in the task, indices are masked, and each request is
+ * copied out before it is looked at. Requests are handed to the same
+ * sys_* functions the trap path uses, which check their buffers.
+ */
+
+#include "ring.h"
+
+#include "process.h"
+
+int ring_setup(ring_t *ring, uint32_t entries) {
+    if (entries == 0 || entries > RING_MAX_ENTRIES || (entries & (entries - 1))) {
+        return -1;
+    }
+
+    process_t *p = process_current();
+    ring->sq_head = ring->sq_tail = 0;
+    ring->cq_head = ring->cq_tail = 0;
+    ring->entries = entries;
+    p->ring = (uint32_t)ring;
+    p->ring_entries = entries;
+    return 0;
+}
+
+static int ring_execute(const ring_sqe_t *sqe) {
+    switch (sqe->op) {
+    case RING_OP_NOP:
+        return 0;
+    case RING_OP_READ:
+        return sys_read(sqe->fd, (char *)sqe->addr, sqe->len);
+    case RING_OP_WRITE:
+        return sys_write(sqe->fd, (const char *)sqe->addr, sqe->len);
+    case RING_OP_SLEEP:
+        sys_sleep(sqe->len);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+int ring_enter(uint32_t to_submit) {
+    process_t *p = process_current();
+    ring_t *ring = (ring_t *)p->ring;
+    if (!ring) {
+        return -1;
+    }
+
+    uint32_t entries = p->ring_entries;
+    uint32_t mask = entries - 1;
+    ring_sqe_t *sqes = (ring_sqe_t *)(ring + 1);
+    ring_cqe_t *cqes = (ring_cqe_t *)(sqes + entries);
+
+    uint32_t head = ring->sq_head;
+    uint32_t tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    uint32_t cq_tail = ring->cq_tail;
+    uint32_t done = 0;
+
+    while (done < to_submit && head != tail) {
+        if (cq_tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) >= entries) {
+            break;  /* No room to report it: leave it queued */
+        }
+
+        ring_sqe_t sqe = sqes[head & mask];
+        head++;
+        __atomic_store_n(&ring->sq_head, head, __ATOMIC_RELEASE);
+
+        ring_cqe_t *cqe = &cqes[cq_tail & mask];
+        cqe->user_data = sqe.user_data;
+        cqe->res = ring_execute(&sqe);
+        cq_tail++;
+        __atomic_store_n(&ring->cq_tail, cq_tail, __ATOMIC_RELEASE);
+        done++;
+    }
+    return (int)done;
+}
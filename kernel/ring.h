@@ -0,0 +1,25 @@
+/*
+ * ring.h - Batched syscall submission rings
+ *
+ * A program registers a ring_t in its own memory (see syscall.h) and then
+ * submits many requests per kernel entry; the ring is consumed on the
+ * caller's stack, request by request, through the ordinary syscalls.
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+
+#include "syscall.h"
+
+/* Make ring (already checked to lie in the caller's memory) the current
+ * task's ring and empty it; -1 if entries is not a power of two up to
+ * RING_MAX_ENTRIES */
+int ring_setup(ring_t *ring, uint32_t entries);
+
+/* Run up to to_submit queued requests, posting a completion for each;
+ * returns how many were consumed, or -1 without a ring */
+int ring_enter(uint32_t to_submit);
+
+#endif /* RING_H */
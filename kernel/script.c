@@ -2,7 +2,11 @@
 
 #include <stddef.h>
 
+#include "bench.h"
+#include "fs.h"
 #include "keyboard.h"
+#include "paging.h"
+#include "shell.h"
 #include "string.h"
 #include "vfs.h"
 #include "vga.h"
@@ -91,15 +95,19 @@ static int execute_line(const char *line) {
             vga_puts("append failed\n");
         }
     } else if (strcmp(cmd, "cat") == 0) {
-        size_t len;
-        const char *data = vfs_read_ptr(args, &len);
-        if (data) {
-            vga_puts(data);
-            if (len == 0 || data[len - 1] != '\n') {
-                vga_putc('\n');
-            }
-        } else {
+        char chunk[256];
+        char last = '\0';
+        size_t off = 0;
+        int got;
+        while ((got = vfs_read_at(args, off, chunk, sizeof(chunk))) > 0) {
+            vga_write(chunk, (size_t)got);
+            last = chunk[got - 1];
+            off += (size_t)got;
+        }
+        if (got < 0 && off == 0) {
             vga_puts("file not found\n");
+        } else if (last != '\n') {
+            vga_putc('\n');
         }
     } else if (strcmp(cmd, "mkdir") == 0) {
         if (vfs_mkdir(args) != 0) {
@@ -116,16 +124,18 @@ static int execute_line(const char *line) {
             vga_puts("directory not found\n");
         }
     } else if (strcmp(cmd, "pwd") == 0) {
-        vga_puts(vfs_getcwd());
+        char cwd[FS_MAX_PATH];
+        vfs_getcwd(cwd, sizeof(cwd));
+        vga_puts(cwd);
         vga_putc('\n');
     } else if (strcmp(cmd, "clear") == 0) {
         vga_clear();
     } else if (strcmp(cmd, "ls") == 0) {
-        const char *name;
+        char name[FS_MAX_NAME + 1];
         size_t len;
         int is_dir;
         size_t idx = 0;
-        while (vfs_list_dir_entry(idx, &name, &len, &is_dir)) {
+        while (vfs_list_dir_entry(idx, name, &len, &is_dir)) {
             vga_puts(name);
             if (is_dir) {
                 vga_puts("  <DIR>\n");
@@ -136,6 +146,10 @@ static int execute_line(const char *line) {
             }
             idx++;
         }
+    } else if (strcmp(cmd, "bench") == 0) {
+        bench_run(args);
+    } else if (strcmp(cmd, "poweroff") == 0) {
+        shell_poweroff();
     } else if (cmd[0] != '\0') {
         vga_puts("unknown command: ");
         vga_puts(cmd);
@@ -151,15 +165,17 @@ int script_run(const char *filename) {
         return -1;
     }
 
-    /* Read file content */
+    /* Run from the cached page itself; our share of it outlives any
+     * rewrite of the file by the lines being run */
+    uint32_t frame;
     size_t file_len;
-    const char *content = vfs_read_ptr(filename, &file_len);
-    if (!content) {
+    if (vfs_get_page(filename, &frame, &file_len) != 0) {
         vga_puts("script not found: ");
         vga_puts(filename);
         vga_putc('\n');
         return -1;
     }
+    const char *content = (const char *)frame;
 
     /* Process line by line */
     const char *p = content;
@@ -183,5 +199,8 @@ int script_run(const char *filename) {
         execute_line(line);
     }
 
+    if (frame) {
+        frame_free(frame);
+    }
     return 0;
 }
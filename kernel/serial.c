@@ -0,0 +1,65 @@
+/*
+ * serial.c - 16550 UART (COM1) output
+ */
+
+#include "serial.h"
+
+#include <stdint.h>
+
+#include "io.h"
+
+#define COM1 0x3F8
+#define UART_DATA     (COM1 + 0)
+#define UART_IER      (COM1 + 1)
+#define UART_FCR      (COM1 + 2)
+#define UART_LCR      (COM1 + 3)
+#define UART_MCR      (COM1 + 4)
+#define UART_LSR      (COM1 + 5)
+#define UART_SCRATCH  (COM1 + 7)
+
+#define LSR_THR_EMPTY 0x20
+
+static int present;
+
+int serial_init(void) {
+    /* Probe the scratch register: absent UARTs read back 0xFF */
+    outb(UART_SCRATCH, 0x5A);
+    if (inb(UART_SCRATCH) != 0x5A) {
+        present = 0;
+        return -1;
+    }
+
+    outb(UART_IER, 0x00);   /* No interrupts */
+    outb(UART_LCR, 0x80);   /* DLAB on */
+    outb(UART_DATA, 0x01);  /* Divisor 1 = 115200 baud */
+    outb(UART_IER, 0x00);
+    outb(UART_LCR, 0x03);   /* 8N1, DLAB off */
+    outb(UART_FCR, 0xC7);   /* Enable and clear FIFOs */
+    outb(UART_MCR, 0x03);   /* DTR + RTS */
+
+    present = 1;
+    return 0;
+}
+
+int serial_present(void) {
+    return present;
+}
+
+void serial_putc(char c) {
+    if (!present) {
+        return;
+    }
+    if (c == '\n') {
+        serial_putc('\r');
+    }
+    while ((inb(UART_LSR) & LSR_THR_EMPTY) == 0) {
+        /* wait */
+    }
+    outb(UART_DATA, (uint8_t)c);
+}
+
+void serial_puts(const char *s) {
+    while (*s) {
+        serial_putc(*s++);
+    }
+}
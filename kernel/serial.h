@@ -0,0 +1,18 @@
+/*
+ * serial.h - 16550 UART (COM1) output
+ * Used for machine-readable output when running headless under QEMU
+ */
+
+#ifndef SERIAL_H
+#define SERIAL_H
+
+/* Initialize COM1 at 115200 8N1; returns 0 if a UART answered */
+int serial_init(void);
+
+/* Check if COM1 was detected */
+int serial_present(void);
+
+void serial_putc(char c);
+void serial_puts(const char *s);
+
+#endif /* SERIAL_H */
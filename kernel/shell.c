@@ -2,16 +2,24 @@
 
 #include <stdint.h>
 
+#include "bench.h"
 #include "editor.h"
+#include "exec.h"
+#include "fs.h"
 #include "gui.h"
+#include "idt.h"
 #include "io.h"
+#include "ioapic.h"
 #include "keyboard.h"
 #include "lang.h"
 #include "memory.h"
+#include "pagecache.h"
 #include "process.h"
+#include "prof.h"
 #include "string.h"
 #include "syscall.h"
 #include "timer.h"
+#include "trace.h"
 #include "v86.h"
 #include "vesa.h"
 #include "vfs.h"
@@ -89,6 +97,7 @@ static void cmd_help(void) {
     vga_puts("  clear               clear screen\n");
     vga_puts("  echo TEXT           print text\n");
     vga_puts("  mem                 heap stats\n");
+    vga_puts("  cache               page cache stats\n");
     vga_puts("  history             command history\n");
     vga_puts("  lang                forth REPL\n");
     vga_puts("  python              CosyPy REPL\n");
@@ -108,10 +117,18 @@ static void cmd_help(void) {
     vga_puts("  ps                  list processes\n");
     vga_puts("  spawn NAME          spawn demo process\n");
     vga_puts("  kill PID            kill process\n");
+    vga_puts("  nice PID PRIO       set priority (0 highest, 7 lowest)\n");
+    vga_puts("  affinity PID MASK   limit to CPUs in MASK (bit n = CPU n)\n");
+    vga_puts("  irqcpu IRQ CPU      deliver ISA IRQ to CPU (I/O APIC)\n");
     vga_puts("  usermode            test user mode syscalls\n");
+    vga_puts("  exec FILE           run ELF program and wait for it\n");
     vga_puts("  gui                 launch GUI demo\n");
     vga_puts("  gfx                 alias for gui\n");
+    vga_puts("  bench [disk|fs|syscall|irq] disk/fs throughput, syscall/irq cost\n");
+    vga_puts("  prof start [HZ]|stop|report [N]|dump FILE  sampling profiler\n");
+    vga_puts("  trace start|stop|dump NAME  event trace to NAME.0, NAME.1, ...\n");
     vga_puts("  reboot              reboot machine\n");
+    vga_puts("  poweroff            power off machine\n");
 }
 
 /* User mode test program - uses syscalls */
@@ -179,32 +196,44 @@ static void user_program(void) {
     );
 }
 
+/* Wait for a user task and report how it ended */
+static void wait_child(int pid) {
+    int status = 0;
+    if (process_wait(pid, &status) == pid) {
+        vga_printf("[pid %u exited with status %d]\n", (uint32_t)pid, status);
+    }
+}
+
 static void cmd_usermode(void) {
     vga_puts("Entering user mode...\n");
 
-    /* Set up user stack */
+    /* The test runs in the kernel's address space, one at a time */
     static uint8_t user_stack[4096] __attribute__((aligned(16)));
-    uint32_t user_esp = (uint32_t)&user_stack[sizeof(user_stack) - 16];
 
-    /* Jump to user mode using iret */
-    /* Push: SS, ESP, EFLAGS, CS, EIP */
-    __asm__ volatile(
-        "mov $0x23, %%ax\n\t"    /* User data segment (0x20 | 3) */
-        "mov %%ax, %%ds\n\t"
-        "mov %%ax, %%es\n\t"
-        "mov %%ax, %%fs\n\t"
-        "mov %%ax, %%gs\n\t"
-
-        "push $0x23\n\t"         /* SS */
-        "push %0\n\t"            /* ESP */
-        "pushf\n\t"              /* EFLAGS */
-        "orl $0x200, (%%esp)\n\t" /* Enable interrupts */
-        "push $0x1B\n\t"         /* CS (0x18 | 3) */
-        "push %1\n\t"            /* EIP */
-        "iret\n\t"
-        : : "r"(user_esp), "r"((uint32_t)user_program)
-        : "eax"
-    );
+    registers_t frame;
+    exec_user_frame(&frame, (uint32_t)user_program, (uint32_t)&user_stack[sizeof(user_stack) - 16]);
+
+    int pid = process_create_user("usermode", 0, &frame);
+    if (pid < 0) {
+        vga_puts("usermode: cannot create task\n");
+        return;
+    }
+    wait_child(pid);
+}
+
+static void cmd_exec(const char *args) {
+    if (!args || !*args) {
+        vga_puts("Usage: exec FILE\n");
+        return;
+    }
+    int pid = exec_spawn(args);
+    if (pid < 0) {
+        vga_puts("exec: cannot load ");
+        vga_puts(args);
+        vga_puts("\n");
+        return;
+    }
+    wait_child(pid);
 }
 
 /* Demo process: prints a counter */
@@ -275,6 +304,114 @@ static void cmd_kill(char *args) {
     }
 }
 
+static void cmd_nice(char *args) {
+    char *prio = args;
+    while (*prio && *prio != ' ') {
+        prio++;
+    }
+    while (*prio == ' ') {
+        prio++;
+    }
+    if (*args == '\0' || *prio == '\0') {
+        vga_puts("usage: nice PID PRIO\n");
+        return;
+    }
+    if (process_set_priority((uint32_t)atoi(args), (uint32_t)atoi(prio)) == 0) {
+        vga_puts("priority set\n");
+    } else {
+        vga_puts("bad pid or priority\n");
+    }
+}
+
+static void cmd_affinity(char *args) {
+    char *mask = args;
+    while (*mask && *mask != ' ') {
+        mask++;
+    }
+    while (*mask == ' ') {
+        mask++;
+    }
+    if (*args == '\0' || *mask == '\0') {
+        vga_puts("usage: affinity PID MASK\n");
+        return;
+    }
+    if (process_set_affinity((uint32_t)atoi(args), (uint32_t)atoi(mask)) == 0) {
+        vga_puts("affinity set\n");
+    } else {
+        vga_puts("bad pid or no online CPU in mask\n");
+    }
+}
+
+static void cmd_irqcpu(char *args) {
+    char *cpu = args;
+    while (*cpu && *cpu != ' ') {
+        cpu++;
+    }
+    while (*cpu == ' ') {
+        cpu++;
+    }
+    if (*args == '\0' || *cpu == '\0') {
+        vga_puts("usage: irqcpu IRQ CPU\n");
+        return;
+    }
+    if (irq_set_cpu((uint8_t)atoi(args), (uint32_t)atoi(cpu)) == 0) {
+        vga_puts("irq routed\n");
+    } else {
+        vga_puts("no I/O APIC route or CPU offline\n");
+    }
+}
+
+#define PROF_REPORT_TOP 15
+
+static void cmd_prof(char *args) {
+    char *sub;
+    char *rest;
+    split_first_arg(args, &sub, &rest);
+
+    if (strcmp(sub, "start") == 0) {
+        uint32_t hz = prof_start(*rest ? (uint32_t)atoi(rest) : 0);
+        vga_printf("sampling at %u Hz\n", hz);
+    } else if (strcmp(sub, "stop") == 0) {
+        prof_stop();
+    } else if (strcmp(sub, "report") == 0) {
+        if (prof_report(*rest ? (uint32_t)atoi(rest) : PROF_REPORT_TOP) != 0) {
+            vga_puts("stop the profiler first\n");
+        }
+    } else if (strcmp(sub, "dump") == 0 && *rest) {
+        int n = prof_dump(rest);
+        if (n < 0) {
+            vga_puts("profiler running or write failed\n");
+        } else {
+            vga_printf("%d samples written\n", n);
+        }
+    } else {
+        vga_puts("usage: prof start [HZ] | stop | report [N] | dump FILE\n");
+    }
+}
+
+static void cmd_trace(char *args) {
+    char *sub;
+    char *rest;
+    split_first_arg(args, &sub, &rest);
+
+    if (strcmp(sub, "start") == 0) {
+        if (trace_start() != 0) {
+            vga_puts("built without tracepoints (TRACE=0)\n");
+        }
+    } else if (strcmp(sub, "stop") == 0) {
+        vga_printf("%u events kept\n", trace_stop());
+    } else if (strcmp(sub, "dump") == 0 && *rest) {
+        int files = trace_dump(rest);
+        if (files < 0) {
+            vga_puts("tracing, bad name or write failed\n");
+        } else {
+            vga_printf("%d files written\n", files);
+        }
+    } else {
+        vga_puts("usage: trace start | stop | dump NAME\n");
+    }
+}
+
 static void cmd_gui(void) {
     if (!vesa_enabled) {
         vga_puts("GUI requires VESA 800x600x32 mode.\n");
@@ -304,6 +441,40 @@ static void cmd_mem(void) {
     vga_puts(" bytes\n");
 }
 
+static void cmd_cache(void) {
+    pagecache_stats_t s;
+    pagecache_get_stats(&s);
+    uint32_t lookups = s.hits + s.misses;
+
+    vga_puts("pages:      ");
+    vga_print_dec(s.pages);
+    vga_puts(" in ");
+    vga_print_dec(s.files);
+    vga_puts(" files\n");
+
+    vga_puts("hits:       ");
+    vga_print_dec(s.hits);
+    vga_puts(" / ");
+    vga_print_dec(lookups);
+    vga_puts(" (");
+    vga_print_dec(lookups ? s.hits * 100u / lookups : 0);
+    vga_puts("%)\n");
+
+    vga_puts("misses:     ");
+    vga_print_dec(s.misses);
+    vga_putc('\n');
+
+    vga_puts("read ahead: ");
+    vga_print_dec(s.readahead);
+    vga_puts(", used ");
+    vga_print_dec(s.readahead_hits);
+    vga_putc('\n');
+
+    vga_puts("reclaimed:  ");
+    vga_print_dec(s.reclaimed);
+    vga_putc('\n');
+}
+
 static void cmd_history(void) {
     for (size_t i = 0; i < history_count; i++) {
         vga_print_dec((uint32_t)i);
@@ -314,12 +485,12 @@ static void cmd_history(void) {
 }
 
 static void cmd_ls(void) {
-    const char *name;
+    char name[FS_MAX_NAME + 1];
     size_t len;
     int is_dir;
     size_t i = 0;
 
-    while (vfs_list_dir_entry(i, &name, &len, &is_dir)) {
+    while (vfs_list_dir_entry(i, name, &len, &is_dir)) {
         vga_puts(name);
         if (is_dir) {
             vga_puts("  <DIR>\n");
@@ -336,7 +507,9 @@ static void cmd_ls(void) {
 }
 
 static void cmd_pwd(void) {
-    vga_puts(vfs_getcwd());
+    char cwd[FS_MAX_PATH];
+    vfs_getcwd(cwd, sizeof(cwd));
+    vga_puts(cwd);
     vga_putc('\n');
 }
 
@@ -382,14 +555,21 @@ static void cmd_cat(char *args) {
         vga_puts("usage: cat FILE\n");
         return;
     }
-    size_t len;
-    const char *data = vfs_read_ptr(args, &len);
-    if (!data) {
+    /* A chunk at a time, each copied out under the fs lock */
+    char chunk[256];
+    char last = '\0';
+    size_t off = 0;
+    int got;
+    while ((got = vfs_read_at(args, off, chunk, sizeof(chunk))) > 0) {
+        vga_write(chunk, (size_t)got);
+        last = chunk[got - 1];
+        off += (size_t)got;
+    }
+    if (got < 0 && off == 0) {
         vga_puts("file not found\n");
         return;
     }
-    vga_puts(data);
-    if (len == 0 || data[len - 1] != '\n') {
+    if (last != '\n') {
         vga_putc('\n');
     }
 }
@@ -466,6 +646,17 @@ static void cmd_reboot(void) {
     }
 }
 
+void shell_poweroff(void) {
+    vga_puts("Powering off...\n");
+    __asm__ volatile("cli");
+    outw(0x604, 0x2000);   /* QEMU PIIX4 ACPI PM1a_CNT: SLP_TYP=0, SLP_EN */
+    outw(0xB004, 0x2000);  /* Bochs and older QEMU */
+    outb(0xF4, 0x00);      /* isa-debug-exit, if configured */
+    for (;;) {
+        __asm__ volatile("hlt");
+    }
+}
+
 /* Forward declarations for script and CosyPy - will be implemented in separate files */
 extern void cospy_repl(void);
 extern int cospy_run_file(const char *filename);
@@ -498,10 +689,19 @@ static void cmd_pyrun(char *args) {
 void shell_run(void) {
     char line[SHELL_LINE_MAX];
 
+    /* Unattended runs (e.g. make bench) drop a script into the image */
+    uint32_t autorun_ino;
+    size_t autorun_len;
+    if (vfs_lookup("AUTORUN.SH", &autorun_ino, &autorun_len) == 0) {
+        script_run("AUTORUN.SH");
+    }
+
     vga_puts("Type 'help' for commands.\n");
     for (;;) {
         /* Show current directory in prompt */
-        vga_puts(vfs_getcwd());
+        char cwd[FS_MAX_PATH];
+        vfs_getcwd(cwd, sizeof(cwd));
+        vga_puts(cwd);
         vga_puts("> ");
         keyboard_readline(line, sizeof(line));
 
@@ -536,6 +736,8 @@ void shell_run(void) {
             vga_putc('\n');
         } else if (strcmp(cmd, "mem") == 0) {
             cmd_mem();
+        } else if (strcmp(cmd, "cache") == 0) {
+            cmd_cache();
         } else if (strcmp(cmd, "history") == 0) {
             cmd_history();
         } else if (strcmp(cmd, "lang") == 0) {
@@ -574,14 +776,30 @@ void shell_run(void) {
             cmd_spawn(args);
         } else if (strcmp(cmd, "kill") == 0) {
             cmd_kill(args);
+        } else if (strcmp(cmd, "nice") == 0) {
+            cmd_nice(args);
+        } else if (strcmp(cmd, "affinity") == 0) {
+            cmd_affinity(args);
+        } else if (strcmp(cmd, "irqcpu") == 0) {
+            cmd_irqcpu(args);
         } else if (strcmp(cmd, "gui") == 0) {
             cmd_gui();
         } else if (strcmp(cmd, "gfx") == 0) {
             cmd_gui();
         } else if (strcmp(cmd, "usermode") == 0) {
             cmd_usermode();
+        } else if (strcmp(cmd, "exec") == 0) {
+            cmd_exec(args);
+        } else if (strcmp(cmd, "bench") == 0) {
+            bench_run(args);
+        } else if (strcmp(cmd, "prof") == 0) {
+            cmd_prof(args);
+        } else if (strcmp(cmd, "trace") == 0) {
+            cmd_trace(args);
         } else if (strcmp(cmd, "reboot") == 0) {
             cmd_reboot();
+        } else if (strcmp(cmd, "poweroff") == 0) {
+            shell_poweroff();
         } else {
             vga_puts("Unknown command. Try 'help'.\n");
         }
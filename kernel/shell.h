@@ -3,4 +3,7 @@
 
 void shell_run(void);
 
+/* Power off the machine (QEMU/Bochs ACPI ports), halting if that fails */
+void shell_poweroff(void);
+
 #endif
@@ -0,0 +1,192 @@
+/*
+ * smp.c - Multiprocessor bring-up, IPIs and TLB shootdown
+ *
+ * Application processors are woken with INIT-SIPI-SIPI into the real-mode
+ * trampoline in smpboot.asm, copied below 1 MiB. One AP boots at a time,
+ * so a single parameter block carries its page directory, stack and CPU
+ * index. Each AP's boot stack is the kernel stack of its idle task, which
+ * it becomes once its GDT, TSS and local APIC are set up.
+ */
+
+#include "smp.h"
+
+#include "acpi.h"
+#include "clock.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "idt.h"
+#include "lapic.h"
+#include "paging.h"
+#include "process.h"
+#include "string.h"
+#include "sync.h"
+#include "syscall.h"
+#include "timer.h"
+#include "tss.h"
+
+/* Must match AP_TRAMPOLINE_BASE in smpboot.asm */
+#define AP_TRAMPOLINE 0x6000u
+
+/* Ranges larger than this flush the whole TLB */
+#define TLB_FLUSH_ALL_PAGES 32u
+
+typedef struct {
+    uint32_t cr3;         /* 0: leave paging off */
+    uint32_t cr4;
+    uint32_t stack;       /* Initial ESP */
+    uint32_t cpu;         /* Index passed to ap_main */
+} ap_boot_params_t;
+
+extern uint8_t ap_trampoline[];
+extern uint8_t ap_trampoline_end[];
+extern uint8_t ap_boot_params[];
+
+cpu_t cpus[MAX_CPUS];
+static volatile uint32_t online_count = 1;
+
+static spinlock_t tlb_lock = SPINLOCK_INIT;
+static volatile uint32_t tlb_addr;
+static volatile uint32_t tlb_pages;
+static volatile uint32_t tlb_acks;
+
+static void flush_range(uint32_t addr, uint32_t pages) {
+    if (pages > TLB_FLUSH_ALL_PAGES) {
+        write_cr3(read_cr3());
+        return;
+    }
+    for (uint32_t i = 0; i < pages; i++) {
+        __asm__ volatile("invlpg (%0)" : : "r"(addr + i * PAGE_SIZE) : "memory");
+    }
+}
+
+static void resched_ipi_handler(registers_t *r) {
+    (void)r;
+    lapic_eoi();
+    scheduler_resched();
+}
+
+static void tlb_ipi_handler(registers_t *r) {
+    (void)r;
+    flush_range(tlb_addr, tlb_pages);
+    __atomic_fetch_sub(&tlb_acks, 1, __ATOMIC_SEQ_CST);
+    lapic_eoi();
+}
+
+/* Entered from the trampoline on the AP's idle stack, interrupts off */
+void ap_main(uint32_t id) {
+    cpu_t *cpu = &cpus[id];
+
+    idt_init_ap(id);
+    tss_init();
+    fpu_init();
+    syscall_init_cpu();
+    lapic_init();
+
+    __atomic_fetch_add(&online_count, 1, __ATOMIC_SEQ_CST);
+    cpu->online = 1;
+    scheduler_start_ap();
+}
+
+static int start_ap(uint32_t id, uint32_t apic_id) {
+    cpu_t *cpu = &cpus[id];
+    cpu->id = id;
+    cpu->apic_id = apic_id;
+
+    uint32_t stack = process_create_idle(cpu);
+    if (!stack) {
+        return -1;
+    }
+
+    ap_boot_params_t *params =
+        (ap_boot_params_t *)(AP_TRAMPOLINE + (uint32_t)(ap_boot_params - ap_trampoline));
+    params->cr3 = paging_enabled() ? read_cr3() : 0;
+    params->cr4 = read_cr4();
+    params->stack = stack;
+    params->cpu = id;
+
+    lapic_send_init(apic_id);
+    clock_delay_us(10000);
+
+    /* A second STARTUP is only needed if the first was lost */
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_startup(apic_id, AP_TRAMPOLINE);
+        uint64_t deadline = clock_ns() + (attempt ? 100u * NSEC_PER_MSEC : 200u * NSEC_PER_USEC);
+        while (!cpu->online && clock_ns() < deadline) {
+            __asm__ volatile("pause");
+        }
+    }
+
+    /* A late AP would still find its idle stack, so it is not freed */
+    return cpu->online ? 0 : -1;
+}
+
+uint32_t smp_init(void) {
+    cpus[0].apic_id = lapic_id();
+    if (!timer_is_tickless() || acpi_init() != 0) {
+        return online_count;
+    }
+
+    idt_register_handler(IPI_RESCHED_VECTOR, resched_ipi_handler);
+    idt_register_handler(IPI_TLB_VECTOR, tlb_ipi_handler);
+
+    memcpy((void *)AP_TRAMPOLINE, ap_trampoline, (size_t)(ap_trampoline_end - ap_trampoline));
+
+    uint32_t next_id = 1;
+    for (uint32_t i = 0; i < acpi_cpu_count() && next_id < MAX_CPUS; i++) {
+        uint32_t apic_id = acpi_cpu_apic_id(i);
+        if (apic_id != cpus[0].apic_id && start_ap(next_id, apic_id) == 0) {
+            next_id++;
+        }
+    }
+    return online_count;
+}
+
+uint32_t smp_cpu_count(void) {
+    return online_count;
+}
+
+void smp_send_resched(cpu_t *cpu) {
+    if (cpu->online && cpu != this_cpu()) {
+        lapic_send_ipi(cpu->apic_id, IPI_RESCHED_VECTOR);
+    }
+}
+
+void smp_tlb_shootdown(uint32_t addr, uint32_t pages) {
+    if (online_count < 2) {
+        flush_range(addr, pages);
+        return;
+    }
+
+    /* Contend with interrupts on so a waiting sender's IPI is still
+     * answered, then stay on this CPU until every other one has flushed */
+    spin_lock(&tlb_lock);
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+
+    flush_range(addr, pages);
+    tlb_addr = addr;
+    tlb_pages = pages;
+
+    cpu_t *self = this_cpu();
+    uint32_t targets = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (cpus[i].online && &cpus[i] != self) {
+            targets++;
+        }
+    }
+    tlb_acks = targets;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (cpus[i].online && &cpus[i] != self) {
+            lapic_send_ipi(cpus[i].apic_id, IPI_TLB_VECTOR);
+        }
+    }
+
+    while (tlb_acks) {
+        __asm__ volatile("pause");
+    }
+
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+    spin_unlock(&tlb_lock);
+}
@@ -0,0 +1,65 @@
+/*
+ * smp.h - Multiprocessor bring-up and per-CPU state
+ *
+ * Every CPU has its own GDT whose PERCPU_SELECTOR descriptor is based at
+ * its cpu_t, and kernel code runs with %gs loaded from it, so this_cpu()
+ * is a single load that stays correct when a task moves between CPUs.
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+#define MAX_CPUS 8
+
+/* GDT selector of the per-CPU data segment (%gs) */
+#define PERCPU_SELECTOR 0x38
+
+/* Inter-processor interrupt vectors */
+#define IPI_RESCHED_VECTOR 49
+#define IPI_TLB_VECTOR     50
+
+struct process;
+struct tasklet;
+
+typedef struct cpu {
+    struct cpu *self;                /* %gs:0 */
+    uint32_t id;                     /* Index in cpus[]; 0 is the BSP */
+    uint32_t apic_id;
+    volatile int online;
+    struct process *current;         /* Task running here */
+    struct process *idle;            /* Runs when nothing else is ready */
+    volatile int need_resched;       /* A better task is waiting */
+    uint64_t next_sched_tick;        /* Tickless: time of the next slice tick */
+    volatile int slicing;            /* Tickless: a slice tick is armed */
+    struct process *fpu_owner;       /* Task whose state the FPU holds */
+    volatile int fpu_live;           /* CR0.TS clear: fpu_owner may dirty it */
+    volatile uint32_t softirq_pending; /* Raised softirqs, bit n = number n */
+    int in_softirq;                  /* Running them on this CPU */
+    struct tasklet *tasklets;        /* Scheduled here, not yet run */
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+
+static inline cpu_t *this_cpu(void) {
+    cpu_t *c;
+    __asm__ volatile("movl %%gs:0, %0" : "=r"(c));
+    return c;
+}
+
+/* Start every application processor listed in the MADT; returns the
+ * number of CPUs online. Needs the LAPIC timer and the scheduler. */
+uint32_t smp_init(void);
+
+/* CPUs online (1 until smp_init) */
+uint32_t smp_cpu_count(void);
+
+/* Ask cpu to look at its run queue */
+void smp_send_resched(cpu_t *cpu);
+
+/* Invalidate [addr, addr + pages * 4 KiB) here and on every other CPU.
+ * Call with interrupts enabled and no spinlock held. */
+void smp_tlb_shootdown(uint32_t addr, uint32_t pages);
+
+#endif /* SMP_H */
@@ -0,0 +1,75 @@
+; smpboot.asm - Application processor startup trampoline
+;
+; smp_init() copies ap_trampoline..ap_trampoline_end to AP_TRAMPOLINE_BASE
+; and fills in ap_boot_params there before sending the STARTUP IPI, whose
+; vector is the page number. The AP starts in real mode at BASE:0 with
+; CS = BASE >> 4, so everything here is addressed relative to BASE.
+
+[BITS 16]
+
+%define AP_TRAMPOLINE_BASE 0x6000      ; Must match AP_TRAMPOLINE in smp.c
+%define TRAMP(label) (AP_TRAMPOLINE_BASE + (label - ap_trampoline))
+
+[GLOBAL ap_trampoline]
+[GLOBAL ap_trampoline_end]
+[GLOBAL ap_boot_params]
+[EXTERN ap_main]
+
+section .text
+
+ap_trampoline:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [TRAMP(tramp_gdt_ptr)]
+
+    mov eax, cr0
+    or eax, 1                   ; PE
+    mov cr0, eax
+    jmp dword 0x08:TRAMP(.protected)
+
+[BITS 32]
+.protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; Share the BSP's page directory (4 MiB pages need CR4.PSE first)
+    mov eax, [TRAMP(ap_cr3)]
+    test eax, eax
+    jz .no_paging
+    mov ecx, [TRAMP(ap_cr4)]
+    mov cr4, ecx
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000          ; PG | WP (copy-on-write needs WP)
+    mov cr0, eax
+.no_paging:
+
+    ; The stack may live in the paged kernel stack area
+    mov esp, [TRAMP(ap_stack)]
+    push dword [TRAMP(ap_cpu)]
+    push dword 0                ; ap_main never returns
+    mov eax, ap_main            ; Absolute: the copy runs elsewhere
+    jmp eax
+
+align 8
+tramp_gdt:
+    dq 0                        ; Null
+    dq 0x00CF9A000000FFFF       ; 0x08: flat code
+    dq 0x00CF92000000FFFF       ; 0x10: flat data
+tramp_gdt_ptr:
+    dw tramp_gdt_ptr - tramp_gdt - 1
+    dd TRAMP(tramp_gdt)
+
+align 4
+ap_boot_params:
+ap_cr3:   dd 0
+ap_cr4:   dd 0
+ap_stack: dd 0
+ap_cpu:   dd 0
+ap_trampoline_end:
@@ -0,0 +1,107 @@
+/*
+ * softirq.c - Deferred interrupt work: softirqs and tasklets
+ *
+ * Pending bits and scheduled tasklets are per CPU, in cpu_t, and only
+ * touched by their own CPU with interrupts off. While softirqs run,
+ * cpu->in_softirq keeps a nested IRQ from running them again and keeps
+ * the scheduler from switching away from the stack they run on: a
+ * reschedule asked for meanwhile happens once they finish.
+ */
+
+#include "softirq.h"
+
+#include "process.h"
+#include "smp.h"
+
+/* Rounds over newly raised softirqs before leaving them to the next IRQ
+ * or the idle loop, so a busy device cannot hold up the task it hit */
+#define SOFTIRQ_RESTARTS 8
+
+#define TASKLET_SCHED   0x1         /* Queued on some CPU */
+#define TASKLET_RUNNING 0x2
+
+static void tasklet_action(void);
+
+static softirq_fn softirq_handlers[SOFTIRQ_MAX] = {
+    [SOFTIRQ_TASKLET] = tasklet_action,
+};
+
+void softirq_register(uint32_t nr, softirq_fn fn) {
+    if (nr < SOFTIRQ_MAX) {
+        softirq_handlers[nr] = fn;
+    }
+}
+
+void softirq_raise(uint32_t nr) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    this_cpu()->softirq_pending |= 1u << nr;
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+}
+
+/* Put t on this CPU's list and raise SOFTIRQ_TASKLET */
+static void tasklet_queue(tasklet_t *t) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    cpu_t *cpu = this_cpu();
+    t->next = cpu->tasklets;
+    cpu->tasklets = t;
+    cpu->softirq_pending |= 1u << SOFTIRQ_TASKLET;
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+}
+
+void tasklet_schedule(tasklet_t *t) {
+    if (!(__atomic_fetch_or(&t->state, TASKLET_SCHED, __ATOMIC_SEQ_CST) & TASKLET_SCHED)) {
+        tasklet_queue(t);
+    }
+}
+
+static void tasklet_action(void) {
+    __asm__ volatile("cli");
+    cpu_t *cpu = this_cpu();
+    tasklet_t *list = cpu->tasklets;
+    cpu->tasklets = 0;
+    __asm__ volatile("sti");
+
+    while (list) {
+        tasklet_t *t = list;
+        list = t->next;
+        if (__atomic_fetch_or(&t->state, TASKLET_RUNNING, __ATOMIC_SEQ_CST) & TASKLET_RUNNING) {
+            tasklet_queue(t);  /* Running on another CPU: try again later */
+            continue;
+        }
+        /* Cleared first, so the IRQ can schedule it again while it runs */
+        __atomic_fetch_and(&t->state, ~TASKLET_SCHED, __ATOMIC_SEQ_CST);
+        t->fn(t->arg);
+        __atomic_fetch_and(&t->state, ~TASKLET_RUNNING, __ATOMIC_SEQ_CST);
+    }
+}
+
+void softirq_run(void) {
+    cpu_t *cpu = this_cpu();
+    if (cpu->in_softirq || !cpu->softirq_pending) {
+        return;
+    }
+    cpu->in_softirq = 1;
+
+    for (int round = 0; round < SOFTIRQ_RESTARTS && cpu->softirq_pending; round++) {
+        uint32_t pending = cpu->softirq_pending;
+        cpu->softirq_pending = 0;
+        __asm__ volatile("sti");
+        for (uint32_t nr = 0; pending; nr++, pending >>= 1) {
+            if ((pending & 1u) && softirq_handlers[nr]) {
+                softirq_handlers[nr]();
+            }
+        }
+        __asm__ volatile("cli");
+    }
+
+    cpu->in_softirq = 0;
+    if (cpu->need_resched) {
+        scheduler_resched();
+    }
+}
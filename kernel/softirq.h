@@ -0,0 +1,46 @@
+/*
+ * softirq.h - Deferred interrupt work: softirqs and tasklets
+ *
+ * An IRQ handler does only what needs interrupts off (reading the device)
+ * and raises a softirq or schedules a tasklet for the rest. Both run on
+ * the same CPU as the IRQ stub leaves, with interrupts enabled, before
+ * the interrupted code resumes, or from the idle loop. They must not
+ * sleep; work that may sleep goes to a worker thread (workqueue.h).
+ */
+
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+
+/* Softirq numbers, run lowest first */
+#define SOFTIRQ_TASKLET 0
+#define SOFTIRQ_MAX     8
+
+typedef void (*softirq_fn)(void);
+
+/* A tasklet runs fn(arg) once per tasklet_schedule(), never on two CPUs
+ * at a time; keep it alive while scheduled */
+typedef struct tasklet {
+    struct tasklet *next;
+    void (*fn)(void *arg);
+    void *arg;
+    volatile uint32_t state;        /* TASKLET_* bits in softirq.c */
+} tasklet_t;
+
+#define TASKLET_INIT(fn, arg) { 0, (fn), (arg), 0 }
+
+void softirq_register(uint32_t nr, softirq_fn fn);
+
+/* Mark softirq nr pending on this CPU; safe from any context */
+void softirq_raise(uint32_t nr);
+
+/* Run t on this CPU soon; a tasklet already waiting to run stays queued
+ * once */
+void tasklet_schedule(tasklet_t *t);
+
+/* Run pending softirqs unless this CPU already is. Call with interrupts
+ * off (the IRQ stubs and the idle loop do); returns with them off. */
+void softirq_run(void);
+
+#endif /* SOFTIRQ_H */
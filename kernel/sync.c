@@ -0,0 +1,114 @@
+/*
+ * sync.c - Sleeping locks built on wait queues
+ */
+
+#include "sync.h"
+
+#include "process.h"
+
+void mutex_init(mutex_t *m) {
+    m->lock.locked = 0;
+    m->owner = 0;
+    wait_queue_init(&m->waiters);
+}
+
+void mutex_lock(mutex_t *m) {
+    uint32_t flags = spin_lock_irqsave(&m->lock);
+    while (m->owner) {
+        wait_sleep_locked(&m->waiters, &m->lock);
+    }
+    m->owner = process_current();
+    spin_unlock_irqrestore(&m->lock, flags);
+}
+
+int mutex_trylock(mutex_t *m) {
+    uint32_t flags = spin_lock_irqsave(&m->lock);
+    int ok = m->owner == 0;
+    if (ok) {
+        m->owner = process_current();
+    }
+    spin_unlock_irqrestore(&m->lock, flags);
+    return ok;
+}
+
+void mutex_unlock(mutex_t *m) {
+    uint32_t flags = spin_lock_irqsave(&m->lock);
+    m->owner = 0;
+    wake_up_one(&m->waiters);
+    spin_unlock_irqrestore(&m->lock, flags);
+}
+
+void sem_init(semaphore_t *s, uint32_t count) {
+    s->lock.locked = 0;
+    s->count = count;
+    wait_queue_init(&s->waiters);
+}
+
+void sem_down(semaphore_t *s) {
+    uint32_t flags = spin_lock_irqsave(&s->lock);
+    while (s->count == 0) {
+        wait_sleep_locked(&s->waiters, &s->lock);
+    }
+    s->count--;
+    spin_unlock_irqrestore(&s->lock, flags);
+}
+
+int sem_trydown(semaphore_t *s) {
+    uint32_t flags = spin_lock_irqsave(&s->lock);
+    int ok = s->count > 0;
+    if (ok) {
+        s->count--;
+    }
+    spin_unlock_irqrestore(&s->lock, flags);
+    return ok;
+}
+
+void sem_up(semaphore_t *s) {
+    uint32_t flags = spin_lock_irqsave(&s->lock);
+    s->count++;
+    wake_up_one(&s->waiters);
+    spin_unlock_irqrestore(&s->lock, flags);
+}
+
+void rwlock_init(rwlock_t *rw) {
+    rw->lock.locked = 0;
+    rw->readers = 0;
+    rw->writers_waiting = 0;
+    rw->writer = 0;
+    wait_queue_init(&rw->waiters);
+}
+
+void read_lock(rwlock_t *rw) {
+    uint32_t flags = spin_lock_irqsave(&rw->lock);
+    while (rw->writer || rw->writers_waiting) {
+        wait_sleep_locked(&rw->waiters, &rw->lock);
+    }
+    rw->readers++;
+    spin_unlock_irqrestore(&rw->lock, flags);
+}
+
+void read_unlock(rwlock_t *rw) {
+    uint32_t flags = spin_lock_irqsave(&rw->lock);
+    if (--rw->readers == 0) {
+        wake_up(&rw->waiters);
+    }
+    spin_unlock_irqrestore(&rw->lock, flags);
+}
+
+void write_lock(rwlock_t *rw) {
+    uint32_t flags = spin_lock_irqsave(&rw->lock);
+    rw->writers_waiting++;
+    while (rw->writer || rw->readers) {
+        wait_sleep_locked(&rw->waiters, &rw->lock);
+    }
+    rw->writers_waiting--;
+    rw->writer = 1;
+    spin_unlock_irqrestore(&rw->lock, flags);
+}
+
+void write_unlock(rwlock_t *rw) {
+    uint32_t flags = spin_lock_irqsave(&rw->lock);
+    rw->writer = 0;
+    wake_up(&rw->waiters);
+    spin_unlock_irqrestore(&rw->lock, flags);
+}
@@ -0,0 +1,110 @@
+/*
+ * sync.h - Spinlocks, mutexes, semaphores and reader-writer locks
+ *
+ * Spinlocks guard short critical sections and state shared with interrupt
+ * handlers; the irqsave variants also keep the local CPU from being
+ * interrupted while the lock is held. Mutexes, semaphores and RW locks
+ * sleep on a wait queue and may only be used from task context.
+ */
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+
+#include "wait.h"
+
+struct process;
+
+typedef struct spinlock {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(spinlock_t *l) {
+    uint32_t v;
+    for (;;) {
+        v = 1;
+        __asm__ volatile("xchgl %0, %1" : "+r"(v), "+m"(l->locked) : : "memory");
+        if (v == 0) {
+            return;
+        }
+        while (l->locked) {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+static inline void spin_unlock(spinlock_t *l) {
+    __asm__ volatile("" : : : "memory");
+    l->locked = 0;
+}
+
+static inline int spin_trylock(spinlock_t *l) {
+    uint32_t v = 1;
+    __asm__ volatile("xchgl %0, %1" : "+r"(v), "+m"(l->locked) : : "memory");
+    return v == 0;
+}
+
+/* Disable interrupts, then take the lock; returns the saved EFLAGS */
+static inline uint32_t spin_lock_irqsave(spinlock_t *l) {
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    spin_lock(l);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *l, uint32_t flags) {
+    spin_unlock(l);
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+}
+
+/* Sleeping mutex; not recursive */
+typedef struct {
+    spinlock_t lock;
+    struct process *owner;
+    wait_queue_t waiters;
+} mutex_t;
+
+#define MUTEX_INIT { SPINLOCK_INIT, 0, WAIT_QUEUE_INIT }
+
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+int mutex_trylock(mutex_t *m);      /* 1 if acquired */
+void mutex_unlock(mutex_t *m);
+
+/* Counting semaphore */
+typedef struct {
+    spinlock_t lock;
+    uint32_t count;
+    wait_queue_t waiters;
+} semaphore_t;
+
+#define SEMAPHORE_INIT(n) { SPINLOCK_INIT, (n), WAIT_QUEUE_INIT }
+
+void sem_init(semaphore_t *s, uint32_t count);
+void sem_down(semaphore_t *s);
+int sem_trydown(semaphore_t *s);    /* 1 if decremented */
+void sem_up(semaphore_t *s);        /* Safe from interrupt context */
+
+/* Sleeping reader-writer lock; waiting writers block new readers */
+typedef struct {
+    spinlock_t lock;
+    uint32_t readers;
+    uint32_t writers_waiting;
+    int writer;
+    wait_queue_t waiters;
+} rwlock_t;
+
+#define RWLOCK_INIT { SPINLOCK_INIT, 0, 0, 0, WAIT_QUEUE_INIT }
+
+void rwlock_init(rwlock_t *rw);
+void read_lock(rwlock_t *rw);
+void read_unlock(rwlock_t *rw);
+void write_lock(rwlock_t *rw);
+void write_unlock(rwlock_t *rw);
+
+#endif /* SYNC_H */
@@ -1,107 +1,227 @@
 /*
  * syscall.c - System Call Handler
+ *
+ * Programs enter through int 0x80 or, where the CPU has it, SYSENTER;
+ * both save a registers_t frame and index one syscall table. Syscalls run
+ * with interrupts enabled, on the calling task's kernel stack, so they may
+ * block and be preempted like any kernel code.
  */
 
 #include "syscall.h"
+#include "cpu.h"
+#include "exec.h"
+#include "file.h"
+#include "fs.h"
 #include "idt.h"
-#include "vga.h"
-#include "keyboard.h"
+#include "mmap.h"
 #include "timer.h"
 #include "process.h"
+#include "ring.h"
+#include "string.h"
+#include "trace.h"
+#include "tss.h"
+#include "vm.h"
 
-/* Current process PID (simple implementation) */
-static int current_pid = 1;
+extern void sysenter_entry(void);
 
-/* Syscall handler called from assembly */
-void syscall_handler(registers_t *regs) {
-    uint32_t syscall_num = regs->eax;
+/* Buffers from a program with its own address space must lie in it; the
+ * built-in usermode test runs out of kernel memory */
+static int user_buffer_ok(const void *buf, size_t len) {
+    process_t *p = process_current();
+    return !p->page_dir || vm_user_range((uint32_t)buf, len);
+}
+
+/* Copy a program's NUL-terminated path into kpath[FS_MAX_PATH] */
+static int copy_path(char *kpath, const char *path) {
+    size_t len = 0;
+    while (len < FS_MAX_PATH && user_buffer_ok(path + len, 1) && path[len]) {
+        kpath[len] = path[len];
+        len++;
+    }
+    if (len == 0 || len == FS_MAX_PATH || !user_buffer_ok(path + len, 1)) {
+        return -1;
+    }
+    kpath[len] = '\0';
+    return 0;
+}
+
+/* The table takes the saved frame; these unpack the arguments */
+static int sc_exit(registers_t *r) {
+    sys_exit((int)r->ebx);
+    return 0;
+}
+
+static int sc_write(registers_t *r) {
+    return sys_write((int)r->ebx, (const char *)r->ecx, (size_t)r->edx);
+}
+
+static int sc_read(registers_t *r) {
+    return sys_read((int)r->ebx, (char *)r->ecx, (size_t)r->edx);
+}
+
+static int sc_getpid(registers_t *r) {
+    (void)r;
+    return sys_getpid();
+}
+
+static int sc_sleep(registers_t *r) {
+    sys_sleep(r->ebx);
+    return 0;
+}
 
-    switch (syscall_num) {
-        case SYS_EXIT:
-            sys_exit((int)regs->ebx);
-            break;
+static int sc_yield(registers_t *r) {
+    (void)r;
+    sys_yield();
+    return 0;
+}
+
+static int sc_exec(registers_t *r) {
+    return sys_exec(r, (const char *)r->ebx);
+}
 
-        case SYS_WRITE:
-            regs->eax = (uint32_t)sys_write(
-                (int)regs->ebx,
-                (const char *)regs->ecx,
-                (size_t)regs->edx
-            );
-            break;
+static int sc_wait(registers_t *r) {
+    return sys_wait((int)r->ebx, (int *)r->ecx);
+}
 
-        case SYS_READ:
-            regs->eax = (uint32_t)sys_read(
-                (int)regs->ebx,
-                (char *)regs->ecx,
-                (size_t)regs->edx
-            );
-            break;
+static int sc_open(registers_t *r) {
+    return sys_open((const char *)r->ebx, (int)r->ecx);
+}
 
-        case SYS_GETPID:
-            regs->eax = (uint32_t)sys_getpid();
-            break;
+static int sc_close(registers_t *r) {
+    return sys_close((int)r->ebx);
+}
 
-        case SYS_SLEEP:
-            sys_sleep(regs->ebx);
-            break;
+static int sc_lseek(registers_t *r) {
+    return sys_lseek((int)r->ebx, (int)r->ecx, (int)r->edx);
+}
 
-        case SYS_YIELD:
-            sys_yield();
-            break;
+static int sc_stat(registers_t *r) {
+    return sys_stat((const char *)r->ebx, (stat_t *)r->ecx);
+}
 
-        default:
-            regs->eax = (uint32_t)-1;  /* Unknown syscall */
-            break;
+static int sc_readdir(registers_t *r) {
+    return sys_readdir((int)r->ebx, (dirent_t *)r->ecx);
+}
+
+static int sc_writev(registers_t *r) {
+    return sys_writev((int)r->ebx, (const iovec_t *)r->ecx, (int)r->edx);
+}
+
+static int sc_ring_setup(registers_t *r) {
+    return sys_ring_setup((ring_t *)r->ebx, r->ecx);
+}
+
+static int sc_ring_enter(registers_t *r) {
+    return sys_ring_enter(r->ebx);
+}
+
+static int sc_mmap(registers_t *r) {
+    return sys_mmap((const char *)r->ebx, (int)r->ecx);
+}
+
+static int sc_munmap(registers_t *r) {
+    return sys_munmap(r->ebx);
+}
+
+typedef int (*syscall_fn_t)(registers_t *r);
+
+static const syscall_fn_t syscall_table[SYS_COUNT] = {
+    [SYS_EXIT]       = sc_exit,
+    [SYS_WRITE]      = sc_write,
+    [SYS_READ]       = sc_read,
+    [SYS_GETPID]     = sc_getpid,
+    [SYS_SLEEP]      = sc_sleep,
+    [SYS_YIELD]      = sc_yield,
+    [SYS_EXEC]       = sc_exec,
+    [SYS_FORK]       = sys_fork,
+    [SYS_WAIT]       = sc_wait,
+    [SYS_OPEN]       = sc_open,
+    [SYS_CLOSE]      = sc_close,
+    [SYS_LSEEK]      = sc_lseek,
+    [SYS_STAT]       = sc_stat,
+    [SYS_READDIR]    = sc_readdir,
+    [SYS_WRITEV]     = sc_writev,
+    [SYS_RING_SETUP] = sc_ring_setup,
+    [SYS_RING_ENTER] = sc_ring_enter,
+    [SYS_MMAP]       = sc_mmap,
+    [SYS_MUNMAP]     = sc_munmap,
+};
+
+static int sysenter_available;
+
+/* Both entry paths end here: int 0x80 through the interrupt handler
+ * table, SYSENTER straight from sysenter_entry */
+void syscall_dispatch(registers_t *regs) {
+    __asm__ volatile("sti");
+
+    uint32_t n = regs->eax;
+    TRACE(TRACE_SYSCALL_ENTER, n);
+    if (n < SYS_COUNT && syscall_table[n]) {
+        regs->eax = (uint32_t)syscall_table[n](regs);
+    } else {
+        regs->eax = (uint32_t)-1;  /* Unknown syscall */
+    }
+    TRACE(TRACE_SYSCALL_EXIT, regs->eax);
+}
+
+/* CPUID's SEP bit is wrong on the first Pentium Pro steppings */
+static int cpu_has_sysenter(void) {
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    uint32_t family = (a >> 8) & 0xF;
+    uint32_t model = (a >> 4) & 0xF;
+    uint32_t stepping = a & 0xF;
+    if (family == 6 && model < 3 && stepping < 3) {
+        return 0;
     }
+    return (d & CPUID_EDX_SEP) != 0;
 }
 
 void syscall_init(void) {
     /* Register int 0x80 handler */
-    idt_register_handler(0x80, syscall_handler);
+    idt_register_handler(0x80, syscall_dispatch);
 
     /* Make int 0x80 callable from ring 3 */
     extern void idt_set_gate_ring3(uint8_t n);
     idt_set_gate_ring3(0x80);
-}
 
-void sys_exit(int status) {
-    vga_puts("[Process exited with status ");
-    vga_print_dec((uint32_t)status);
-    vga_puts("]\n");
+    sysenter_available = cpu_has_sysenter();
+    syscall_init_cpu();
+}
 
-    /* Return to kernel - in a real OS, would terminate process */
-    /* For now, just halt this context */
-    for (;;) {
-        __asm__ volatile("hlt");
+void syscall_init_cpu(void) {
+    if (!sysenter_available) {
+        return;
     }
+    wrmsr(MSR_SYSENTER_CS, 0x08);  /* SS = CS + 8; SYSEXIT: CS + 16, SS + 24 */
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+    tss_enable_sysenter();
+}
+
+int syscall_sysenter_available(void) {
+    return sysenter_available;
+}
+
+void sys_exit(int status) {
+    process_exit(status);
 }
 
 int sys_write(int fd, const char *buf, size_t count) {
-    if (fd == 1 || fd == 2) {  /* stdout or stderr */
-        for (size_t i = 0; i < count; i++) {
-            vga_putc(buf[i]);
-        }
-        return (int)count;
+    if (!user_buffer_ok(buf, count)) {
+        return -1;
     }
-    return -1;  /* Invalid fd */
+    return file_write(fd, buf, count);
 }
 
 int sys_read(int fd, char *buf, size_t count) {
-    if (fd == 0) {  /* stdin */
-        for (size_t i = 0; i < count; i++) {
-            char c = keyboard_getchar();
-            buf[i] = c;
-            if (c == '\n') {
-                return (int)(i + 1);
-            }
-        }
-        return (int)count;
+    if (!user_buffer_ok(buf, count)) {
+        return -1;
     }
-    return -1;
+    return file_read(fd, buf, count);
 }
 
 int sys_getpid(void) {
-    return current_pid;
+    return (int)process_current()->pid;
 }
 
 void sys_sleep(uint32_t ms) {
@@ -109,5 +229,112 @@ void sys_sleep(uint32_t ms) {
 }
 
 void sys_yield(void) {
-    scheduler_tick();
+    process_yield();
+}
+
+int sys_exec(registers_t *regs, const char *path) {
+    /* The old address space goes away: copy the path out first */
+    char kpath[FS_MAX_PATH];
+    if (copy_path(kpath, path) != 0) {
+        return -1;
+    }
+    return exec_replace(regs, kpath);
+}
+
+int sys_fork(registers_t *regs) {
+    process_t *p = process_current();
+    if (!p->page_dir) {
+        return -1;  /* Nothing to copy: the usermode test shares the kernel's */
+    }
+
+    uint32_t dir = vm_clone(p->page_dir);
+    if (!dir) {
+        return -1;
+    }
+
+    /* The child resumes from the same syscall, seeing 0 */
+    registers_t frame = *regs;
+    frame.eax = 0;
+    int pid = process_create_user(p->name, dir, &frame);
+    if (pid < 0) {
+        vm_destroy(dir);
+    }
+    return pid;
+}
+
+int sys_wait(int pid, int *status) {
+    if (status && !user_buffer_ok(status, sizeof(*status))) {
+        return -1;
+    }
+    return process_wait(pid, status);
+}
+
+int sys_open(const char *path, int flags) {
+    char kpath[FS_MAX_PATH];
+    if (copy_path(kpath, path) != 0) {
+        return -1;
+    }
+    return file_open(kpath, flags);
+}
+
+int sys_close(int fd) {
+    return file_close(fd);
+}
+
+int sys_lseek(int fd, int offset, int whence) {
+    return file_lseek(fd, offset, whence);
+}
+
+int sys_stat(const char *path, stat_t *st) {
+    char kpath[FS_MAX_PATH];
+    if (!user_buffer_ok(st, sizeof(*st)) || copy_path(kpath, path) != 0) {
+        return -1;
+    }
+    return file_stat(kpath, st);
+}
+
+int sys_readdir(int fd, dirent_t *ent) {
+    if (!user_buffer_ok(ent, sizeof(*ent))) {
+        return -1;
+    }
+    return file_readdir(fd, ent);
+}
+
+int sys_writev(int fd, const iovec_t *iov, int count) {
+    /* Check the vector once, from a copy the program cannot change */
+    iovec_t kiov[IOV_MAX];
+    if (count < 0 || count > IOV_MAX || !user_buffer_ok(iov, (size_t)count * sizeof(*iov))) {
+        return -1;
+    }
+    memcpy(kiov, iov, (size_t)count * sizeof(*iov));
+    for (int i = 0; i < count; i++) {
+        if (!user_buffer_ok(kiov[i].base, kiov[i].len)) {
+            return -1;
+        }
+    }
+    return file_writev(fd, kiov, count);
+}
+
+int sys_ring_setup(ring_t *ring, uint32_t entries) {
+    if ((uint32_t)ring & 3 || entries > RING_MAX_ENTRIES ||
+        !user_buffer_ok(ring, RING_BYTES(entries))) {
+        return -1;
+    }
+    return ring_setup(ring, entries);
+}
+
+int sys_ring_enter(uint32_t to_submit) {
+    return ring_enter(to_submit);
+}
+
+int sys_mmap(const char *path, int flags) {
+    char kpath[FS_MAX_PATH];
+    if (copy_path(kpath, path) != 0) {
+        return -1;
+    }
+    return mmap_file(kpath, flags);
+}
+
+int sys_munmap(uint32_t addr) {
+    return mmap_unmap(addr);
 }
@@ -1,6 +1,6 @@
 /*
  * syscall.h - System Call Interface
- * Ring 3 to Ring 0 transition via int 0x80
+ * Ring 3 to Ring 0 transition via int 0x80 or SYSENTER
  */
 
 #ifndef SYSCALL_H
@@ -16,9 +16,107 @@
 #define SYS_GETPID  3
 #define SYS_SLEEP   4
 #define SYS_YIELD   5
+#define SYS_EXEC    6   /* ebx = path; does not return on success */
+#define SYS_FORK    7   /* Returns the child's pid, 0 in the child */
+#define SYS_WAIT    8   /* ebx = pid (-1: any child), ecx = int *status */
+#define SYS_OPEN    9   /* ebx = path, ecx = O_* flags; returns an fd */
+#define SYS_CLOSE   10
+#define SYS_LSEEK   11  /* ebx = fd, ecx = offset, edx = SEEK_*; new offset */
+#define SYS_STAT    12  /* ebx = path, ecx = stat_t * */
+#define SYS_READDIR 13  /* ebx = fd, ecx = dirent_t *; 1, or 0 at the end */
+#define SYS_WRITEV  14  /* ebx = fd, ecx = iovec_t *, edx = count */
+#define SYS_RING_SETUP 15  /* ebx = ring_t *, ecx = entries */
+#define SYS_RING_ENTER 16  /* ebx = entries to submit; returns those consumed */
+#define SYS_MMAP    17  /* ebx = path, ecx = MAP_* flags; returns the address */
+#define SYS_MUNMAP  18  /* ebx = address mmap returned */
+#define SYS_COUNT   19
 
-/* Initialize syscall handler */
+/* open() flags */
+#define O_RDONLY    0
+#define O_WRONLY    1
+#define O_RDWR      2
+#define O_ACCMODE   3
+#define O_CREAT     0x40
+#define O_TRUNC     0x200
+#define O_APPEND    0x400
+
+/* mmap() flags: writes go to a private copy, never to the file */
+#define MAP_WRITE   1
+
+/* lseek() origins */
+#define SEEK_SET    0
+#define SEEK_CUR    1
+#define SEEK_END    2
+
+/* Most buffers one writev() takes */
+#define IOV_MAX     16
+
+typedef struct {
+    uint32_t size;
+    uint32_t is_dir;
+} stat_t;
+
+typedef struct {
+    char name[24];              /* FS_MAX_NAME + 1 */
+    uint32_t size;
+    uint32_t is_dir;
+} dirent_t;
+
+typedef struct {
+    const void *base;
+    size_t len;
+} iovec_t;
+
+/*
+ * Submission ring: a program queues requests in memory it shares with the
+ * kernel and hands over a whole batch with one SYS_RING_ENTER. Each ring
+ * is a ring_t followed by `entries` ring_sqe_t and `entries` ring_cqe_t
+ * (RING_BYTES in all). The program advances sq_tail and cq_head, the
+ * kernel sq_head and cq_tail; indices run freely and are taken modulo
+ * entries. Requests run in order, and the kernel stops early when the
+ * completion queue is full.
+ */
+#define RING_MAX_ENTRIES 64     /* Power of two, as is every ring size */
+
+#define RING_OP_NOP    0
+#define RING_OP_READ   1        /* read(fd, addr, len) */
+#define RING_OP_WRITE  2        /* write(fd, addr, len); fd 1 is the console */
+#define RING_OP_SLEEP  3        /* Sleep len ms */
+
+typedef struct {
+    uint32_t op;
+    int32_t fd;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t user_data;         /* Copied to the completion */
+} ring_sqe_t;
+
+typedef struct {
+    uint32_t user_data;
+    int32_t res;                /* What the equivalent syscall returns */
+} ring_cqe_t;
+
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t entries;
+} ring_t;
+
+#define RING_SQES(r) ((ring_sqe_t *)((ring_t *)(r) + 1))
+#define RING_CQES(r) ((ring_cqe_t *)(RING_SQES(r) + (r)->entries))
+#define RING_BYTES(entries) \
+    (sizeof(ring_t) + (entries) * (sizeof(ring_sqe_t) + sizeof(ring_cqe_t)))
+
+struct registers;
+
+/* Initialize syscall handler (BSP), and SYSENTER on each other CPU */
 void syscall_init(void);
+void syscall_init_cpu(void);
+
+/* SYSENTER is set up: programs may use it instead of int 0x80 */
+int syscall_sysenter_available(void);
 
 /* Syscall implementations */
 void sys_exit(int status);
@@ -27,5 +125,18 @@ int sys_read(int fd, char *buf, size_t count);
 int sys_getpid(void);
 void sys_sleep(uint32_t ms);
 void sys_yield(void);
+int sys_exec(struct registers *regs, const char *path);
+int sys_fork(struct registers *regs);
+int sys_wait(int pid, int *status);
+int sys_open(const char *path, int flags);
+int sys_close(int fd);
+int sys_lseek(int fd, int offset, int whence);
+int sys_stat(const char *path, stat_t *st);
+int sys_readdir(int fd, dirent_t *ent);
+int sys_writev(int fd, const iovec_t *iov, int count);
+int sys_ring_setup(ring_t *ring, uint32_t entries);
+int sys_ring_enter(uint32_t to_submit);
+int sys_mmap(const char *path, int flags);
+int sys_munmap(uint32_t addr);
 
 #endif /* SYSCALL_H */
@@ -1,12 +1,27 @@
 /*
- * timer.c - PIT (Programmable Interval Timer) driver
+ * timer.c - System timer: PIT periodic ticks or LAPIC one-shot events
  * Used for preemptive scheduling and time tracking
+ *
+ * Both drive the ktimer wheel. With a local APIC and a TSC the kernel runs
+ * tickless: the PIT is masked and the LAPIC timer is armed for the earliest
+ * of the next wheel expiry and, only while another task is waiting for the CPU, the next scheduler
+ * tick. Without them the PIT interrupts at tick_frequency as before.
+ *
+ * Every CPU arms its own LAPIC for its slice ticks and profiler samples,
+ * but only the BSP runs the wheel; an AP that queues an earlier timer
+ * kicks the BSP to re-arm.
  */
 
 #include "timer.h"
+#include "clock.h"
 #include "idt.h"
 #include "io.h"
+#include "ioapic.h"
+#include "ktimer.h"
+#include "lapic.h"
 #include "process.h"
+#include "prof.h"
+#include "smp.h"
 #include "vga.h"
 
 /* PIT ports */
@@ -14,23 +29,112 @@
 #define PIT_CHANNEL1 0x41
 #define PIT_CHANNEL2 0x42
 #define PIT_COMMAND  0x43
+#define PIT_GATE     0x61
+
+/* Longest the LAPIC timer is left unarmed while idle */
+#define TIMER_MAX_IDLE_NS (1000ull * NSEC_PER_MSEC)
 
 /* Tick counter */
 static volatile uint32_t tick_count = 0;
 static uint32_t tick_frequency = TIMER_FREQ;
+static uint64_t tick_ns;
+
+/* Tickless state */
+static int tickless;
+static volatile uint64_t wheel_armed_ns; /* BSP's programmed event */
+static volatile uint32_t timer_irqs;     /* Interrupts actually taken */
 
 /* Timer interrupt handler */
 static void timer_irq_handler(registers_t *r) {
-    (void)r;
     tick_count++;
+    timer_irqs++;
+    prof_tick(r, clock_ns());
+
+    /* Fire kernel timers that expired during this tick */
+    ktimer_run(clock_ns());
 
     /* Call scheduler tick for preemptive scheduling */
     scheduler_tick();
 }
 
+/* LAPIC one-shot handler: emulates ticks only when someone needs them */
+static void lapic_timer_handler(registers_t *r) {
+    timer_irqs++;
+
+    /* Acknowledge first: scheduler_tick() may switch to another task */
+    lapic_eoi();
+
+    cpu_t *cpu = this_cpu();
+    uint64_t now = clock_ns();
+    prof_tick(r, now);
+    if (cpu->id == 0) {
+        ktimer_run(now);
+    }
+
+    int tick = cpu->slicing && now >= cpu->next_sched_tick;
+    if (tick) {
+        cpu->next_sched_tick = now + tick_ns;
+    }
+
+    /* Re-arm before scheduler_tick(), which may not return here soon */
+    timer_reprogram();
+
+    if (tick) {
+        scheduler_tick();
+    }
+}
+
+static void lapic_spurious_handler(registers_t *r) {
+    (void)r;
+    /* Spurious interrupts must not be acknowledged */
+}
+
+/* Busy-wait on PIT channel 2 (mode 0), independent of IRQ0 */
+void timer_pit_wait_ms(uint32_t ms) {
+    while (ms > 0) {
+        uint32_t chunk = ms > 50 ? 50 : ms;   /* 16-bit counter limit */
+        uint32_t count = (PIT_BASE_FREQ / 1000u) * chunk;
+
+        /* Gate low, speaker off */
+        uint8_t gate = (uint8_t)(inb(PIT_GATE) & ~0x03);
+        outb(PIT_GATE, gate);
+
+        outb(PIT_COMMAND, 0xB0); /* Channel 2, lobyte/hibyte, mode 0 */
+        outb(PIT_CHANNEL2, (uint8_t)(count & 0xFF));
+        outb(PIT_CHANNEL2, (uint8_t)((count >> 8) & 0xFF));
+
+        /* Raising the gate starts the count; OUT2 (bit 5) goes high at zero */
+        outb(PIT_GATE, (uint8_t)(gate | 0x01));
+        while ((inb(PIT_GATE) & 0x20) == 0) {
+            /* wait */
+        }
+        outb(PIT_GATE, gate);
+
+        ms -= chunk;
+    }
+}
+
+/* Switch from PIT ticks to LAPIC one-shot events if the hardware allows */
+static void timer_try_tickless(void) {
+    if (!clock_tsc_khz() || lapic_init() != 0 || lapic_timer_calibrate() != 0) {
+        return;
+    }
+
+    idt_register_handler(LAPIC_TIMER_VECTOR, lapic_timer_handler);
+    idt_register_handler(LAPIC_SPURIOUS_VECTOR, lapic_spurious_handler);
+
+    /* Mask IRQ0; the LAPIC timer takes over */
+    irq_mask(0);
+
+    tickless = 1;
+    this_cpu()->next_sched_tick = clock_ns() + tick_ns;
+    timer_reprogram();
+}
+
 /* Initialize the PIT */
 void timer_init(uint32_t frequency) {
     tick_frequency = frequency;
+    tick_ns = NSEC_PER_SEC / frequency;
 
     /* Calculate divisor */
     uint32_t divisor = PIT_BASE_FREQ / frequency;
@@ -53,20 +157,108 @@ void timer_init(uint32_t frequency) {
 
     /* Register IRQ0 handler */
     idt_register_handler(32, timer_irq_handler);
+
+    timer_try_tickless();
+}
+
+/* Arm the LAPIC for the next event; no-op in periodic PIT mode */
+void timer_reprogram(void) {
+    if (!tickless) {
+        return;
+    }
+
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+
+    cpu_t *cpu = this_cpu();
+    uint64_t now = clock_ns();
+    uint64_t wheel = ktimer_next_expiry();
+    uint64_t next = cpu->id == 0 ? wheel : UINT64_MAX;
+
+    cpu->slicing = scheduler_wants_tick();
+    if (cpu->slicing) {
+        if (cpu->next_sched_tick <= now) {
+            cpu->next_sched_tick = now + tick_ns;
+        }
+        if (cpu->next_sched_tick < next) {
+            next = cpu->next_sched_tick;
+        }
+    } else {
+        /* Nobody to preempt for: restart the slice when someone shows up */
+        cpu->next_sched_tick = now + tick_ns;
+    }
+
+    uint64_t sample = prof_next_ns();
+    if (sample < next) {
+        next = sample;
+    }
+
+    if (next > now + TIMER_MAX_IDLE_NS) {
+        next = now + TIMER_MAX_IDLE_NS;
+    }
+    lapic_timer_oneshot(next > now ? next - now : 0);
+
+    if (cpu->id == 0) {
+        wheel_armed_ns = next;
+    } else if (wheel < wheel_armed_ns) {
+        /* The BSP would sleep past a timer added here */
+        wheel_armed_ns = wheel;
+        smp_send_resched(&cpus[0]);
+    }
+
+    if (flags & 0x200) {
+        __asm__ volatile("sti");
+    }
+}
+
+int timer_is_tickless(void) {
+    return tickless;
+}
+
+uint32_t timer_irq_count(void) {
+    return timer_irqs;
 }
 
 /* Get tick count */
 uint32_t timer_get_ticks(void) {
+    if (tickless) {
+        return udiv64_32(clock_ns(), (uint32_t)tick_ns);
+    }
     return tick_count;
 }
 
-/* Sleep for approximately ms milliseconds */
+static void sleep_expired(void *arg) {
+    *(volatile int *)arg = 1;
+}
+
+/* Sleep for ms milliseconds. A task blocks on a wheel timer and leaves
+ * the CPU to others; before the scheduler runs, the caller halts until
+ * the timer fires (the sub-tick remainder in PIT mode is spun). */
 void timer_sleep(uint32_t ms) {
-    uint32_t ticks = (ms * tick_frequency) / 1000;
-    if (ticks == 0) ticks = 1;
+    uint64_t deadline = clock_ns() + (uint64_t)ms * NSEC_PER_MSEC;
 
-    uint32_t start = tick_count;
-    while (tick_count - start < ticks) {
+    if (process_can_block()) {
+        process_sleep_until(deadline);
+        return;
+    }
+
+    volatile int expired = 0;
+    ktimer_t wake = {0};
+    ktimer_add(&wake, deadline, sleep_expired, (void *)&expired);
+
+    for (;;) {
+        __asm__ volatile("cli");
+        if (expired || clock_ns() >= deadline) {
+            break;
+        }
+        if (!tickless && clock_tsc_khz() && deadline - clock_ns() <= tick_ns) {
+            __asm__ volatile("sti; pause");
+            continue;
+        }
+        /* sti takes effect after hlt starts, so the wakeup cannot be lost */
         __asm__ volatile("sti; hlt");
     }
+    __asm__ volatile("sti");
+
+    ktimer_cancel(&wake);
 }
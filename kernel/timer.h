@@ -1,5 +1,5 @@
 /*
- * timer.h - Programmable Interval Timer (PIT) driver
+ * timer.h - System timer: PIT periodic ticks or LAPIC one-shot events
  */
 
 #ifndef TIMER_H
@@ -22,4 +22,16 @@ uint32_t timer_get_ticks(void);
 /* Sleep for approximately ms milliseconds */
 void timer_sleep(uint32_t ms);
 
+/* Busy-wait ms milliseconds on PIT channel 2 (calibration only) */
+void timer_pit_wait_ms(uint32_t ms);
+
+/* Re-arm the one-shot timer after deadlines or runnable tasks change */
+void timer_reprogram(void);
+
+/* 1 if the LAPIC one-shot timer replaced the periodic PIT tick */
+int timer_is_tickless(void);
+
+/* Timer interrupts taken since boot */
+uint32_t timer_irq_count(void);
+
 #endif /* TIMER_H */
@@ -0,0 +1,151 @@
+/*
+ * trace.c - Static tracepoints and per-CPU trace rings
+ *
+ * A writer claims a slot by incrementing its ring's head atomically and
+ * then fills it in, so tracepoints take no lock and an IRQ that traces
+ * in the middle of another event simply gets the next slot. A task moved
+ * to another CPU between choosing a ring and claiming a slot still gets
+ * a slot of its own. The newest TRACE_RING events per CPU are kept; the
+ * rings are read only once tracing has stopped.
+ */
+
+#include "trace.h"
+
+#include "clock.h"
+#include "fs.h"
+#include "paging.h"
+#include "process.h"
+#include "smp.h"
+#include "vfs.h"
+
+#define TRACE_RING 512u    /* Events kept per CPU; a power of two */
+
+/* Records after the header in one dump file, and files to hold them all */
+#define TRACE_FILE_RECS  (FS_MAX_FILE_SIZE / sizeof(trace_rec_t) - 1u)
+#define TRACE_MAX_FILES  ((MAX_CPUS * TRACE_RING + TRACE_FILE_RECS - 1u) / TRACE_FILE_RECS)
+
+typedef struct {
+    trace_rec_t rec[TRACE_RING];
+    uint32_t head;          /* Events recorded; the next goes in rec[head % TRACE_RING] */
+} trace_ring_t;
+
+static trace_ring_t rings[MAX_CPUS];
+
+volatile uint32_t trace_on;
+
+static uint32_t ring_kept(const trace_ring_t *ring) {
+    return ring->head < TRACE_RING ? ring->head : TRACE_RING;
+}
+
+#if CONFIG_TRACE
+void trace_emit(uint32_t event, uint32_t arg) {
+    cpu_t *cpu = this_cpu();
+    trace_ring_t *ring = &rings[cpu->id];
+    uint32_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+
+    trace_rec_t *r = &ring->rec[slot & (TRACE_RING - 1)];
+    r->tsc = clock_cycles();
+    r->event = (uint8_t)event;
+    r->cpu = (uint8_t)cpu->id;
+    r->pid = (uint16_t)(cpu->current ? cpu->current->pid : 0);
+    r->arg = arg;
+}
+#endif
+
+int trace_start(void) {
+    if (!CONFIG_TRACE) {
+        return -1;
+    }
+    trace_on = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        rings[i].head = 0;
+    }
+    __atomic_store_n(&trace_on, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+uint32_t trace_stop(void) {
+    __atomic_store_n(&trace_on, 0, __ATOMIC_SEQ_CST);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        kept += ring_kept(&rings[i]);
+    }
+    return kept;
+}
+
+/* name.index, if it fits the 8.3 limits */
+static int file_name(char *out, const char *name, uint32_t index) {
+    size_t len = 0;
+    while (name[len]) {
+        if (name[len] == '.' || len >= 8) {
+            return -1;
+        }
+        out[len] = name[len];
+        len++;
+    }
+    if (len == 0) {
+        return -1;
+    }
+    out[len++] = '.';
+    if (index >= 10) {
+        out[len++] = (char)('0' + index / 10);
+    }
+    out[len++] = (char)('0' + index % 10);
+    out[len] = '\0';
+    return 0;
+}
+
+int trace_dump(const char *name) {
+    char path[FS_MAX_NAME + 1];
+    if (trace_on || file_name(path, name, TRACE_MAX_FILES - 1) != 0) {
+        return -1;
+    }
+    trace_rec_t *buf = (trace_rec_t *)frame_alloc();
+    if (!buf) {
+        return -1;
+    }
+
+    /* Records go out ring by ring; the converter sorts them by time */
+    uint32_t files = 0;
+    uint32_t cpu = 0;
+    uint32_t next = 0;          /* Position in rings[cpu]'s kept events */
+    int ret = 0;
+    while (ret == 0 && cpu < MAX_CPUS) {
+        uint32_t n = 0;
+        for (; cpu < MAX_CPUS && n < TRACE_FILE_RECS; cpu++, next = 0) {
+            const trace_ring_t *ring = &rings[cpu];
+            uint32_t kept = ring_kept(ring);
+            uint32_t first = ring->head - kept;
+            while (next < kept && n < TRACE_FILE_RECS) {
+                buf[1 + n++] = ring->rec[(first + next++) & (TRACE_RING - 1)];
+            }
+            if (next < kept) {
+                break;          /* File full; carry on with this ring */
+            }
+        }
+        if (n == 0) {
+            break;
+        }
+
+        buf[0].tsc = 0;
+        buf[0].event = TRACE_HEADER;
+        buf[0].cpu = 0;
+        buf[0].pid = TRACE_VERSION;
+        buf[0].arg = clock_tsc_khz();
+        file_name(path, name, files);
+        ret = vfs_write_raw(path, (const char *)buf, (1 + n) * sizeof(trace_rec_t));
+        files++;
+    }
+    frame_free((uint32_t)buf);
+    if (ret != 0) {
+        return -1;
+    }
+
+    /* Leftovers from a longer earlier dump would be read back as ours */
+    for (uint32_t i = files; i < TRACE_MAX_FILES; i++) {
+        file_name(path, name, i);
+        vfs_remove(path);
+    }
+    return (int)files;
+}
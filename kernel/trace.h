@@ -0,0 +1,79 @@
+/*
+ * trace.h - Static tracepoints
+ *
+ * TRACE(event, arg) records a fixed-size event with a TSC timestamp in
+ * the current CPU's ring while tracing is on, and costs one load and a
+ * branch while it is off. Building with TRACE=0 (CONFIG_TRACE 0) removes
+ * the tracepoints entirely. "trace dump" writes the rings to files that
+ * tools/trace2json.c turns into Chrome trace JSON; the record layout is
+ * shared with it, so this header includes nothing from the kernel.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifndef CONFIG_TRACE
+#define CONFIG_TRACE 1
+#endif
+
+/* Events; pid is the task running when the event was recorded */
+#define TRACE_HEADER        0   /* First record of each dump file */
+#define TRACE_SCHED_SWITCH  1   /* pid switched to; arg: pid switched from */
+#define TRACE_IRQ_ENTER     2   /* arg: vector */
+#define TRACE_IRQ_EXIT      3   /* arg: vector */
+#define TRACE_SYSCALL_ENTER 4   /* arg: number */
+#define TRACE_SYSCALL_EXIT  5   /* arg: return value */
+#define TRACE_DISK_READ     6   /* arg: first LBA */
+#define TRACE_DISK_WRITE    7   /* arg: first LBA */
+#define TRACE_DISK_END      8   /* arg: result */
+#define TRACE_FS_BEGIN      9   /* arg: TRACE_FS_* operation */
+#define TRACE_FS_END        10  /* arg: result */
+
+/* Filesystem operations */
+#define TRACE_FS_CREATE     0
+#define TRACE_FS_REMOVE     1
+#define TRACE_FS_READ       2
+#define TRACE_FS_WRITE      3
+#define TRACE_FS_MKDIR      4
+#define TRACE_FS_RMDIR      5
+#define TRACE_FS_COMMIT     6   /* Journal transaction for metadata */
+#define TRACE_FS_READ_PAGE  7   /* Page cache miss filled from disk */
+
+#define TRACE_VERSION 1
+
+/* Little endian on disk, 16 bytes. A TRACE_HEADER record has pid set to
+ * TRACE_VERSION and arg to the TSC rate in kHz (0 if not calibrated). */
+typedef struct {
+    uint64_t tsc;
+    uint8_t event;
+    uint8_t cpu;
+    uint16_t pid;
+    uint32_t arg;
+} __attribute__((packed)) trace_rec_t;
+
+#if CONFIG_TRACE
+extern volatile uint32_t trace_on;
+void trace_emit(uint32_t event, uint32_t arg);
+#define TRACE(event, arg) do { \
+        if (trace_on) { \
+            trace_emit((event), (uint32_t)(arg)); \
+        } \
+    } while (0)
+#else
+#define TRACE(event, arg) do { } while (0)
+#endif
+
+/* Clear the rings and start recording; -1 if built without tracepoints */
+int trace_start(void);
+
+/* Stop recording; returns the events still held in the rings */
+uint32_t trace_stop(void);
+
+/* Write the rings to NAME.0, NAME.1, ... (at most one file's worth of
+ * records each) and remove higher-numbered files left by an earlier
+ * dump. Returns the number of files or -1 while tracing. */
+int trace_dump(const char *name);
+
+#endif /* TRACE_H */
@@ -3,38 +3,113 @@
  */
 
 #include "tss.h"
+#include "cpu.h"
+#include "paging.h"
+#include "process.h"
+#include "smp.h"
 #include "string.h"
+#include "vga.h"
 
-/* TSS entry */
-static tss_t tss;
+#define DF_TSS_SELECTOR 0x30
 
-/* Kernel stack for syscalls */
-static uint8_t kernel_stack[4096] __attribute__((aligned(16)));
+/* TSS entry, one per CPU */
+static tss_t tss[MAX_CPUS];
+
+/* Double faults switch to their own task and stack, so a kernel stack
+ * overflow (a fault while pushing onto a guard page) can still report */
+static tss_t df_tss[MAX_CPUS];
+static uint8_t df_stack[MAX_CPUS][4096] __attribute__((aligned(16)));
+
+/* Kernel stack for ring transitions outside user tasks (V86) */
+static uint8_t kernel_stack[MAX_CPUS][4096] __attribute__((aligned(16)));
+
+/* SYSENTER enters on MSR_SYSENTER_ESP, which follows esp0 once set */
+static uint8_t sysenter_on[MAX_CPUS];
 
 /* External function to load TSS (defined in assembly) */
 extern void tss_flush(void);
 
 /* GDT TSS descriptor (will be set up in idt.c) */
-extern void gdt_set_tss(uint32_t base, uint32_t limit);
+extern void gdt_set_tss(uint32_t cpu, uint32_t base, uint32_t limit);
+extern void gdt_set_df_tss(uint32_t cpu, uint32_t base, uint32_t limit);
+extern void idt_set_task_gate(uint8_t n, uint16_t tss_selector);
+
+/* Entered through the task gate; the faulting state is saved in this
+ * CPU's tss, and %gs is reloaded from df_tss so this_cpu() works */
+static void double_fault_task(void) {
+    process_t *p = process_current();
+    tss_t *t = &tss[this_cpu()->id];
+
+    if (kstack_is_guard(t->esp - 4)) {
+        vga_printf("Kernel stack overflow: pid %u (%s) esp=%x eip=%x\n",
+                   p ? p->pid : 0, p ? p->name : "?", t->esp, t->eip);
+    } else {
+        vga_printf("Double fault: eip=%x esp=%x\n", t->eip, t->esp);
+    }
+
+    for (;;) {
+        __asm__ volatile("cli; hlt");
+    }
+}
 
+static void df_tss_init(uint32_t cpu) {
+    tss_t *t = &df_tss[cpu];
+    memset(t, 0, sizeof(*t));
+    t->cr3 = read_cr3();
+    t->eip = (uint32_t)double_fault_task;
+    t->eflags = 0x2;   /* Interrupts off */
+    t->esp = (uint32_t)&df_stack[cpu][sizeof(df_stack[cpu])];
+    t->ss0 = 0x10;
+    t->esp0 = t->esp;
+    t->cs = 0x08;
+    t->ds = t->es = t->fs = t->ss = 0x10;
+    t->gs = PERCPU_SELECTOR;
+    t->iomap_base = sizeof(*t);
+
+    gdt_set_df_tss(cpu, (uint32_t)t, sizeof(*t) - 1);
+    idt_set_task_gate(8, DF_TSS_SELECTOR);
+}
+
+/* Set up and load the executing CPU's TSS; its GDT must be loaded */
 void tss_init(void) {
+    uint32_t cpu = this_cpu()->id;
+    tss_t *t = &tss[cpu];
+
     /* Clear TSS */
-    memset(&tss, 0, sizeof(tss));
+    memset(t, 0, sizeof(*t));
 
     /* Set up kernel stack */
-    tss.ss0 = 0x10;  /* Kernel data segment */
-    tss.esp0 = (uint32_t)&kernel_stack[sizeof(kernel_stack)];
+    t->ss0 = 0x10;  /* Kernel data segment */
+    t->esp0 = (uint32_t)&kernel_stack[cpu][sizeof(kernel_stack[cpu])];
 
     /* Set I/O map base to beyond TSS limit (no I/O allowed) */
-    tss.iomap_base = sizeof(tss);
+    t->iomap_base = sizeof(*t);
 
     /* Set up TSS descriptor in GDT */
-    gdt_set_tss((uint32_t)&tss, sizeof(tss) - 1);
+    gdt_set_tss(cpu, (uint32_t)t, sizeof(*t) - 1);
 
     /* Load TSS */
     tss_flush();
+
+    df_tss_init(cpu);
 }
 
 void tss_set_kernel_stack(uint32_t stack) {
-    tss.esp0 = stack;
+    uint32_t cpu = this_cpu()->id;
+    if (!stack) {
+        stack = (uint32_t)&kernel_stack[cpu][sizeof(kernel_stack[cpu])];
+    }
+    if (tss[cpu].esp0 == stack) {
+        return;  /* Kernel threads in a row: spare the MSR write */
+    }
+    tss[cpu].esp0 = stack;
+    if (sysenter_on[cpu]) {
+        wrmsr(MSR_SYSENTER_ESP, stack);
+    }
+}
+
+void tss_enable_sysenter(void) {
+    uint32_t cpu = this_cpu()->id;
+    wrmsr(MSR_SYSENTER_ESP, tss[cpu].esp0);
+    sysenter_on[cpu] = 1;
 }
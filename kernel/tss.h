@@ -28,10 +28,14 @@ typedef struct {
     uint16_t iomap_base;
 } __attribute__((packed)) tss_t;
 
-/* Initialize TSS and load it */
+/* Initialize the executing CPU's TSS and load it */
 void tss_init(void);
 
-/* Set kernel stack for ring transitions */
+/* Set the executing CPU's kernel stack for ring transitions
+ * (0: its default stack) */
 void tss_set_kernel_stack(uint32_t stack);
 
+/* Keep MSR_SYSENTER_ESP equal to esp0 on the executing CPU from now on */
+void tss_enable_sysenter(void);
+
 #endif /* TSS_H */
@@ -2,10 +2,16 @@
 
 #include "fs.h"
 #include "string.h"
+#include "sync.h"
+#include "trace.h"
 
-static char name_buf[FS_MAX_NAME + 1];
+/* Serialises every call into fs, whose buffers and cwd are shared */
+static mutex_t fs_lock = MUTEX_INIT;
 
-static const char *normalize(const char *path) {
+/* File contents being patched by vfs_write_at() (under fs_lock) */
+static char patch_buf[FS_MAX_FILE_SIZE];
+
+static const char *normalize(const char *path, char *name_buf) {
     if (!path || path[0] == '\0') {
         return 0;
     }
@@ -42,7 +48,7 @@ static const char *normalize(const char *path) {
 }
 
 /* Normalize for directory operations - allows .. */
-static const char *normalize_dir(const char *path) {
+static const char *normalize_dir(const char *path, char *name_buf) {
     if (!path || path[0] == '\0') {
         return 0;
     }
@@ -75,65 +81,300 @@ void vfs_init(void) {
 }
 
 int vfs_touch(const char *path) {
-    const char *n = normalize(path);
-    return n ? fs_touch(n) : -1;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_CREATE);
+    mutex_lock(&fs_lock);
+    int r = fs_touch(n);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
 }
 
 int vfs_remove(const char *path) {
-    const char *n = normalize(path);
-    return n ? fs_remove(n) : -1;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_REMOVE);
+    mutex_lock(&fs_lock);
+    int r = fs_remove(n);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
 }
 
 int vfs_write(const char *path, const char *text) {
-    const char *n = normalize(path);
-    return n ? fs_write(n, text) : -1;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_WRITE);
+    mutex_lock(&fs_lock);
+    int r = fs_write(n, text);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
 }
 
 int vfs_append(const char *path, const char *text) {
-    const char *n = normalize(path);
-    return n ? fs_append(n, text) : -1;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_WRITE);
+    mutex_lock(&fs_lock);
+    int r = fs_append(n, text);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
 }
 
 int vfs_write_raw(const char *path, const char *data, size_t len) {
-    const char *n = normalize(path);
-    return n ? fs_write_raw(n, data, len) : -1;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_WRITE);
+    mutex_lock(&fs_lock);
+    int r = fs_write_raw(n, data, len);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
+}
+
+/* Copy at most cap bytes of a file; returns its length or -1 */
+int vfs_read(const char *path, void *dst, size_t cap) {
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_READ);
+    mutex_lock(&fs_lock);
+    size_t len = 0;
+    int r = fs_read(n, 0, dst, cap, &len);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r < 0 ? -1 : (int)len);
+    return r < 0 ? -1 : (int)len;
+}
+
+int vfs_read_at(const char *path, size_t off, void *dst, size_t len) {
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_READ);
+    mutex_lock(&fs_lock);
+    int r = fs_read(n, off, dst, len, 0);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
+}
+
+int vfs_write_at(const char *path, size_t off, const void *src, size_t len) {
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n || off >= FS_MAX_FILE_SIZE) {
+        return -1;
+    }
+    if (len > FS_MAX_FILE_SIZE - off) {
+        len = FS_MAX_FILE_SIZE - off;  /* Short write at the size limit */
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_WRITE);
+    mutex_lock(&fs_lock);
+    size_t size = 0;
+    int ret = -1;
+    if (fs_read(n, 0, patch_buf, sizeof(patch_buf), &size) >= 0) {
+        if (off > size) {
+            memset(patch_buf + size, 0, off - size);  /* Hole reads as zeros */
+        }
+        memcpy(patch_buf + off, src, len);
+        size_t end = off + len > size ? off + len : size;
+        if (fs_write_raw(n, patch_buf, end) == 0) {
+            ret = (int)len;
+        }
+    }
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, ret);
+    return ret;
+}
+
+int vfs_lookup(const char *path, uint32_t *ino, size_t *size) {
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    mutex_lock(&fs_lock);
+    int r = fs_lookup(n, ino, size);
+    mutex_unlock(&fs_lock);
+    return r;
+}
+
+uint32_t vfs_page(uint32_t ino, uint32_t index) {
+    mutex_lock(&fs_lock);
+    uint32_t frame = fs_page(ino, index);
+    mutex_unlock(&fs_lock);
+    return frame;
 }
 
-const char *vfs_read_ptr(const char *path, size_t *len) {
-    const char *n = normalize(path);
-    return n ? fs_read_ptr(n, len) : 0;
+int vfs_get_page(const char *path, uint32_t *frame, size_t *size) {
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_READ);
+    mutex_lock(&fs_lock);
+    uint32_t ino;
+    int r = fs_lookup(n, &ino, size);
+    *frame = 0;
+    if (r == 0 && *size > 0) {
+        *frame = fs_page(ino, 0);
+        if (!*frame) {
+            r = -1;
+        }
+    }
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
 }
 
-int vfs_list_entry(size_t index, const char **name, size_t *len) {
-    return fs_list_entry(index, name, len);
+int vfs_stat(const char *path, size_t *size, int *is_dir) {
+    char buf[FS_MAX_NAME + 1];
+    if (path && strcmp(path, ".") == 0) {
+        *size = 0;
+        *is_dir = 1;
+        return 0;
+    }
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    mutex_lock(&fs_lock);
+    int ret = -1;
+    uint32_t ino;
+    *is_dir = fs_is_dir(n);
+    *size = 0;
+    if (*is_dir || fs_lookup(n, &ino, size) == 0) {
+        ret = 0;
+    }
+    mutex_unlock(&fs_lock);
+    return ret;
+}
+
+int vfs_list_entry(size_t index, char *name, size_t *len) {
+    mutex_lock(&fs_lock);
+    const char *n;
+    int r = fs_list_entry(index, &n, len);
+    if (r && name) {
+        strcpy(name, n);
+    }
+    mutex_unlock(&fs_lock);
+    return r;
 }
 
 /* Directory operations */
 
 int vfs_mkdir(const char *path) {
-    const char *n = normalize(path);
-    return n ? fs_mkdir(n) : -1;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_MKDIR);
+    mutex_lock(&fs_lock);
+    int r = fs_mkdir(n);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
 }
 
 int vfs_rmdir(const char *path) {
-    const char *n = normalize(path);
-    return n ? fs_rmdir(n) : -1;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    TRACE(TRACE_FS_BEGIN, TRACE_FS_RMDIR);
+    mutex_lock(&fs_lock);
+    int r = fs_rmdir(n);
+    mutex_unlock(&fs_lock);
+    TRACE(TRACE_FS_END, r);
+    return r;
 }
 
 int vfs_chdir(const char *path) {
-    const char *n = normalize_dir(path);
-    return n ? fs_chdir(n) : -1;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize_dir(path, buf);
+    if (!n) {
+        return -1;
+    }
+
+    mutex_lock(&fs_lock);
+    int r = fs_chdir(n);
+    mutex_unlock(&fs_lock);
+    return r;
 }
 
-const char *vfs_getcwd(void) {
-    return fs_getcwd();
+void vfs_getcwd(char *buf, size_t cap) {
+    if (cap == 0) {
+        return;
+    }
+
+    mutex_lock(&fs_lock);
+    const char *r = fs_getcwd();
+    size_t i = 0;
+    while (r[i] && i < cap - 1) {
+        buf[i] = r[i];
+        i++;
+    }
+    buf[i] = '\0';
+    mutex_unlock(&fs_lock);
 }
 
 int vfs_is_dir(const char *path) {
-    const char *n = normalize(path);
-    return n ? fs_is_dir(n) : 0;
+    char buf[FS_MAX_NAME + 1];
+    const char *n = normalize(path, buf);
+    if (!n) {
+        return 0;
+    }
+
+    mutex_lock(&fs_lock);
+    int r = fs_is_dir(n);
+    mutex_unlock(&fs_lock);
+    return r;
 }
 
-int vfs_list_dir_entry(size_t index, const char **name, size_t *len, int *is_dir) {
-    return fs_list_dir_entry(index, name, len, is_dir);
+int vfs_list_dir_entry(size_t index, char *name, size_t *len, int *is_dir) {
+    mutex_lock(&fs_lock);
+    const char *n;
+    int r = fs_list_dir_entry(index, &n, len, is_dir);
+    if (r && name) {
+        strcpy(name, n);
+    }
+    mutex_unlock(&fs_lock);
+    return r;
 }
@@ -2,6 +2,7 @@
 #define VFS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 void vfs_init(void);
 int vfs_touch(const char *path);
@@ -9,15 +10,41 @@ int vfs_remove(const char *path);
 int vfs_write(const char *path, const char *text);
 int vfs_append(const char *path, const char *text);
 int vfs_write_raw(const char *path, const char *data, size_t len);
-const char *vfs_read_ptr(const char *path, size_t *len);
-int vfs_list_entry(size_t index, const char **name, size_t *len);
+
+/* Calls are serialised on one mutex, and anything returned is copied to
+ * the caller's buffer before it is released. vfs_read() copies at most
+ * cap bytes of the file (not NUL-terminated) and returns its length. */
+int vfs_read(const char *path, void *dst, size_t cap);
+
+/* Byte ranges of a file: bytes copied, or -1. Writing past the end
+ * grows the file (at most FS_MAX_FILE_SIZE; longer writes are cut short). */
+int vfs_read_at(const char *path, size_t off, void *dst, size_t len);
+int vfs_write_at(const char *path, size_t off, const void *src, size_t len);
+
+/* Mapping files: the inode and size of a regular file, and a cached page
+ * of it with one share of the frame given to the caller (0 if gone) */
+int vfs_lookup(const char *path, uint32_t *ino, size_t *size);
+uint32_t vfs_page(uint32_t ino, uint32_t index);
+
+/* A file's data read in place: its cached page (0 if the file is empty)
+ * with one share of the frame given to the caller, who drops it with
+ * frame_free(). A later vfs write replaces the cached page rather than
+ * changing it, so the caller keeps the contents as they were. -1 if missing. */
+int vfs_get_page(const char *path, uint32_t *frame, size_t *size);
+
+/* Size and type of path ("." is the current directory); -1 if missing */
+int vfs_stat(const char *path, size_t *size, int *is_dir);
+
+/* Listing the current directory: entry index, if there is one, with its
+ * NUL-terminated name copied to name (FS_MAX_NAME + 1 bytes) */
+int vfs_list_entry(size_t index, char *name, size_t *len);
 
 /* Directory operations */
 int vfs_mkdir(const char *path);
 int vfs_rmdir(const char *path);
 int vfs_chdir(const char *path);
-const char *vfs_getcwd(void);
+void vfs_getcwd(char *buf, size_t cap);  /* Truncated to fit cap */
 int vfs_is_dir(const char *path);
-int vfs_list_dir_entry(size_t index, const char **name, size_t *len, int *is_dir);
+int vfs_list_dir_entry(size_t index, char *name, size_t *len, int *is_dir);
 
 #endif
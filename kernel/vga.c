@@ -4,6 +4,7 @@
 
 #include "gfxcon.h"
 #include "io.h"
+#include "sync.h"
 
 #define VGA_MEM ((volatile uint16_t *)0xB8000)
 
@@ -11,6 +12,9 @@ static uint8_t cursor_x;
 static uint8_t cursor_y;
 static uint8_t color;
 
+/* Keeps each string from interleaving with output from other CPUs */
+static spinlock_t vga_lock = SPINLOCK_INIT;
+
 static inline uint16_t make_cell(char c, uint8_t col) {
     return (uint16_t)((uint8_t)c) | ((uint16_t)col << 8);
 }
@@ -76,12 +80,8 @@ void vga_set_color(vga_color_t fg, vga_color_t bg) {
     }
 }
 
-void vga_putc(char c) {
-    if (gfxcon_active()) {
-        gfxcon_putc(c);
-        return;
-    }
-
+/* Place c without moving the hardware cursor */
+static void place_locked(char c) {
     if (c == '\n') {
         cursor_x = 0;
         cursor_y++;
@@ -102,17 +102,49 @@ void vga_putc(char c) {
         cursor_y++;
     }
     scroll_if_needed();
+}
+
+static void putc_locked(char c) {
+    if (gfxcon_active()) {
+        gfxcon_putc(c);
+        return;
+    }
+    place_locked(c);
     update_cursor();
 }
 
+void vga_putc(char c) {
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
+    putc_locked(c);
+    spin_unlock_irqrestore(&vga_lock, flags);
+}
+
 void vga_puts(const char *str) {
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
     if (gfxcon_active()) {
         gfxcon_puts(str);
-        return;
+    } else {
+        while (*str) {
+            putc_locked(*str++);
+        }
     }
-    while (*str) {
-        vga_putc(*str++);
+    spin_unlock_irqrestore(&vga_lock, flags);
+}
+
+/* One lock hold and one cursor update for the whole buffer */
+void vga_write(const char *buf, size_t len) {
+    uint32_t flags = spin_lock_irqsave(&vga_lock);
+    if (gfxcon_active()) {
+        for (size_t i = 0; i < len; i++) {
+            gfxcon_putc(buf[i]);
+        }
+    } else {
+        for (size_t i = 0; i < len; i++) {
+            place_locked(buf[i]);
+        }
+        update_cursor();
     }
+    spin_unlock_irqrestore(&vga_lock, flags);
 }
 
 void vga_print_dec(uint32_t value) {
@@ -31,6 +31,7 @@ void vga_clear(void);
 void vga_set_color(vga_color_t fg, vga_color_t bg);
 void vga_putc(char c);
 void vga_puts(const char *str);
+void vga_write(const char *buf, size_t len);
 void vga_print_dec(uint32_t value);
 void vga_print_hex(uint32_t value);
 void vga_printf(const char *fmt, ...);
@@ -0,0 +1,202 @@
+/*
+ * vm.c - User address spaces
+ *
+ * fork() shares every frame read-only and marks the writable ones PTE_COW;
+ * the first write to such a page faults and copies it, unless the frame
+ * has meanwhile lost its other owners. A directory is only ever loaded by
+ * the one task that owns it, and every task switch reloads CR3, so user
+ * mappings never need a TLB shootdown.
+ */
+
+#include "vm.h"
+
+#include "cpu.h"
+#include "paging.h"
+#include "string.h"
+
+#define PAGE_MASK      (~(PAGE_SIZE - 1))
+#define USER_PDE_FIRST (USER_BASE >> 22)
+#define USER_PDE_END   (USER_LIMIT >> 22)
+
+static inline void invlpg(uint32_t addr) {
+    __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static uint32_t zeroed_frame(void) {
+    uint32_t f = frame_alloc();
+    if (f) {
+        memset((void *)f, 0, PAGE_SIZE);
+    }
+    return f;
+}
+
+static uint32_t *vm_pte(uint32_t dir, uint32_t va, int alloc) {
+    uint32_t *pde = &((uint32_t *)dir)[va >> 22];
+    if (!(*pde & PAGE_PRESENT)) {
+        uint32_t table = alloc ? zeroed_frame() : 0;
+        if (!table) {
+            return 0;
+        }
+        *pde = table | PAGE_PRESENT | PAGE_WRITE | PAGE_USER;
+    }
+    return &((uint32_t *)(*pde & PAGE_MASK))[(va >> PAGE_SHIFT) & 1023u];
+}
+
+uint32_t vm_create(void) {
+    if (!paging_enabled()) {
+        return 0;
+    }
+    uint32_t dir = frame_alloc();
+    if (!dir) {
+        return 0;
+    }
+
+    uint32_t *pd = (uint32_t *)dir;
+    const uint32_t *kd = (const uint32_t *)paging_kernel_dir();
+    for (uint32_t i = 0; i < 1024; i++) {
+        pd[i] = (i >= USER_PDE_FIRST && i < USER_PDE_END) ? 0 : kd[i] & ~PAGE_USER;
+    }
+    return dir;
+}
+
+void vm_destroy(uint32_t dir) {
+    if (!dir) {
+        return;
+    }
+    uint32_t *pd = (uint32_t *)dir;
+    for (uint32_t i = USER_PDE_FIRST; i < USER_PDE_END; i++) {
+        if (!(pd[i] & PAGE_PRESENT)) {
+            continue;
+        }
+        uint32_t *pt = (uint32_t *)(pd[i] & PAGE_MASK);
+        for (uint32_t j = 0; j < 1024; j++) {
+            if (pt[j] & PAGE_PRESENT) {
+                frame_free(pt[j] & PAGE_MASK);
+            }
+        }
+        frame_free((uint32_t)pt);
+    }
+    frame_free(dir);
+}
+
+uint32_t vm_map(uint32_t dir, uint32_t va, int writable) {
+    uint32_t *pte = vm_pte(dir, va, 1);
+    if (!pte) {
+        return 0;
+    }
+    if (!(*pte & PAGE_PRESENT)) {
+        uint32_t frame = zeroed_frame();
+        if (!frame) {
+            return 0;
+        }
+        *pte = frame | PAGE_PRESENT | PAGE_USER;
+    }
+    if (writable) {
+        *pte |= PAGE_WRITE;
+    }
+    return *pte & PAGE_MASK;
+}
+
+int vm_map_frame(uint32_t dir, uint32_t va, uint32_t frame, int cow) {
+    uint32_t *pte = vm_pte(dir, va, 1);
+    if (!pte || (*pte & PAGE_PRESENT)) {
+        return -1;
+    }
+    *pte = frame | PAGE_PRESENT | PAGE_USER | (cow ? PTE_COW : 0);
+    return 0;
+}
+
+void vm_unmap(uint32_t dir, uint32_t va) {
+    uint32_t *pte = vm_pte(dir, va, 0);
+    if (pte && (*pte & PAGE_PRESENT)) {
+        frame_free(*pte & PAGE_MASK);
+        *pte = 0;
+        invlpg(va);
+    }
+}
+
+uint32_t vm_clone(uint32_t dir) {
+    uint32_t child = vm_create();
+    if (!child) {
+        return 0;
+    }
+
+    uint32_t *pd = (uint32_t *)dir;
+    uint32_t *cd = (uint32_t *)child;
+    int ok = 1;
+    for (uint32_t i = USER_PDE_FIRST; i < USER_PDE_END && ok; i++) {
+        if (!(pd[i] & PAGE_PRESENT)) {
+            continue;
+        }
+        uint32_t table = zeroed_frame();
+        if (!table) {
+            ok = 0;
+            break;
+        }
+        cd[i] = table | (pd[i] & ~PAGE_MASK);
+
+        uint32_t *pt = (uint32_t *)(pd[i] & PAGE_MASK);
+        uint32_t *ct = (uint32_t *)table;
+        for (uint32_t j = 0; j < 1024; j++) {
+            uint32_t e = pt[j];
+            if (!(e & PAGE_PRESENT)) {
+                continue;
+            }
+            if (frame_share(e & PAGE_MASK) != 0) {
+                ok = 0;
+                break;
+            }
+            if (e & PAGE_WRITE) {
+                e = (e & ~PAGE_WRITE) | PTE_COW;
+                pt[j] = e;
+            }
+            ct[j] = e;
+        }
+    }
+
+    /* The parent lost write access to its pages */
+    if (paging_enabled() && read_cr3() == dir) {
+        write_cr3(dir);
+    }
+    if (!ok) {
+        vm_destroy(child);
+        return 0;
+    }
+    return child;
+}
+
+int vm_fault(uint32_t dir, uint32_t addr, uint32_t err) {
+    if (!dir || addr < USER_BASE || addr >= USER_LIMIT ||
+        (err & (PF_PRESENT | PF_WRITE)) != (PF_PRESENT | PF_WRITE)) {
+        return -1;
+    }
+    uint32_t *pte = vm_pte(dir, addr, 0);
+    if (!pte || !(*pte & PTE_COW)) {
+        return -1;
+    }
+
+    /* The last owner keeps the frame */
+    uint32_t old = *pte & PAGE_MASK;
+    if (frame_is_shared(old)) {
+        uint32_t frame = frame_alloc();
+        if (!frame) {
+            return -1;
+        }
+        memcpy((void *)frame, (const void *)old, PAGE_SIZE);
+        *pte = frame | (*pte & ~PAGE_MASK);
+        frame_free(old);
+    }
+    *pte = (*pte & ~PTE_COW) | PAGE_WRITE;
+    invlpg(addr);
+    return 0;
+}
+
+void vm_switch(uint32_t dir) {
+    if (!paging_enabled()) {
+        return;
+    }
+    uint32_t cr3 = dir ? dir : paging_kernel_dir();
+    if (read_cr3() != cr3) {
+        write_cr3(cr3);
+    }
+}
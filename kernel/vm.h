@@ -0,0 +1,68 @@
+/*
+ * vm.h - User address spaces
+ *
+ * Every user program gets a page directory of its own. The kernel half is
+ * shared with the kernel directory (without the user bit); programs live
+ * in [USER_BASE, USER_LIMIT), mapped with 4 KiB pages. Page tables and
+ * frames are reached through the identity map, so a directory need not be
+ * loaded to be filled in.
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define USER_BASE        0x40000000u
+#define USER_LIMIT       0x80000000u
+#define USER_STACK_PAGES 16u
+#define USER_STACK_TOP   USER_LIMIT
+#define USER_STACK_BASE  (USER_STACK_TOP - USER_STACK_PAGES * 4096u)
+
+/* File mappings go between here and the stack; programs load below */
+#define USER_MMAP_BASE   0x70000000u
+#define USER_MMAP_LIMIT  USER_STACK_BASE
+
+/* Available PTE bit: read-only for now, copy on the first write */
+#define PTE_COW          0x200u
+
+/* Page fault error code bits */
+#define PF_PRESENT       0x1u
+#define PF_WRITE         0x2u
+
+/* Empty address space; 0 on failure or without paging */
+uint32_t vm_create(void);
+
+/* Free every user page and table, then the directory. It must not be
+ * loaded on any CPU. */
+void vm_destroy(uint32_t dir);
+
+/* Map a zeroed page at va (or keep the one there), writable if asked;
+ * returns the frame or 0. For directories that are not loaded. */
+uint32_t vm_map(uint32_t dir, uint32_t va, int writable);
+
+/* Map frame (the caller's share of it) read-only at va, copy-on-write if
+ * cow; -1 if va is already mapped or a page table cannot be had */
+int vm_map_frame(uint32_t dir, uint32_t va, uint32_t frame, int cow);
+
+/* Drop the page at va, if any; dir must be the current directory */
+void vm_unmap(uint32_t dir, uint32_t va);
+
+/* Copy of dir sharing every page copy-on-write; 0 on failure.
+ * dir must be the current directory, or not loaded at all. */
+uint32_t vm_clone(uint32_t dir);
+
+/* Resolve a write to a copy-on-write page of dir; -1 if the fault is not
+ * one of those */
+int vm_fault(uint32_t dir, uint32_t addr, uint32_t err);
+
+/* Load dir on this CPU (0: the kernel directory) */
+void vm_switch(uint32_t dir);
+
+/* 1 if [addr, addr + len) lies in user space */
+static inline int vm_user_range(uint32_t addr, size_t len) {
+    return addr >= USER_BASE && addr <= USER_LIMIT && len <= USER_LIMIT - addr;
+}
+
+#endif /* VM_H */
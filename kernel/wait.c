@@ -0,0 +1,143 @@
+/*
+ * wait.c - Wait queues for blocking until an event
+ */
+
+#include "wait.h"
+
+#include "process.h"
+#include "sync.h"
+
+/* Guards every wait queue and each task's wait_entry/wait_queue */
+static spinlock_t wait_lock = SPINLOCK_INIT;
+
+uint32_t wait_irq_save(void) {
+    return spin_lock_irqsave(&wait_lock);
+}
+
+void wait_irq_restore(uint32_t flags) {
+    spin_unlock_irqrestore(&wait_lock, flags);
+}
+
+/* Before the scheduler runs: let any interrupt change the state */
+static void wait_halt(void) {
+    spin_unlock(&wait_lock);
+    __asm__ volatile("sti; hlt; cli");
+    spin_lock(&wait_lock);
+}
+
+void wait_queue_init(wait_queue_t *q) {
+    q->head = 0;
+    q->tail = 0;
+}
+
+static void enqueue(wait_queue_t *q, wait_entry_t *e) {
+    e->next = 0;
+    e->prev = q->tail;
+    if (q->tail) {
+        q->tail->next = e;
+    } else {
+        q->head = e;
+    }
+    q->tail = e;
+}
+
+static void dequeue(wait_queue_t *q, wait_entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        q->head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        q->tail = e->prev;
+    }
+    e->next = 0;
+    e->prev = 0;
+}
+
+void wait_sleep_until(wait_queue_t *q, uint64_t deadline_ns) {
+    if (!process_can_block()) {
+        wait_halt();
+        return;
+    }
+
+    process_t *p = process_current();
+    wait_entry_t e = { p, 0, 0 };
+    enqueue(q, &e);
+    p->wait_entry = &e;
+    p->wait_queue = q;
+
+    process_block_locked(deadline_ns, &wait_lock);
+
+    /* Still queued if the deadline, not wake_up(), ended the wait */
+    if (p->wait_entry) {
+        dequeue(q, &e);
+        p->wait_entry = 0;
+        p->wait_queue = 0;
+    }
+}
+
+void wait_sleep(wait_queue_t *q) {
+    wait_sleep_until(q, 0);
+}
+
+void wait_sleep_locked(wait_queue_t *q, spinlock_t *lock) {
+    spin_lock(&wait_lock);
+    spin_unlock(lock);
+
+    if (!process_can_block()) {
+        wait_halt();
+    } else {
+        process_t *p = process_current();
+        wait_entry_t e = { p, 0, 0 };
+        enqueue(q, &e);
+        p->wait_entry = &e;
+        p->wait_queue = q;
+
+        process_block_locked(0, &wait_lock);
+
+        if (p->wait_entry) {
+            dequeue(q, &e);
+            p->wait_entry = 0;
+            p->wait_queue = 0;
+        }
+    }
+
+    spin_unlock(&wait_lock);
+    spin_lock(lock);
+}
+
+static void wake_entry(wait_queue_t *q, wait_entry_t *e) {
+    process_t *p = e->task;
+    dequeue(q, e);
+    p->wait_entry = 0;
+    p->wait_queue = 0;
+    process_wake(p);
+}
+
+void wake_up(wait_queue_t *q) {
+    uint32_t flags = wait_irq_save();
+    while (q->head) {
+        wake_entry(q, q->head);
+    }
+    wait_irq_restore(flags);
+}
+
+void wake_up_one(wait_queue_t *q) {
+    uint32_t flags = wait_irq_save();
+    if (q->head) {
+        wake_entry(q, q->head);
+    }
+    wait_irq_restore(flags);
+}
+
+void wait_abort(process_t *p) {
+    uint32_t flags = wait_irq_save();
+    if (p->wait_entry) {
+        dequeue(p->wait_queue, p->wait_entry);
+        p->wait_entry = 0;
+        p->wait_queue = 0;
+    }
+    wait_irq_restore(flags);
+}
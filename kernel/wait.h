@@ -0,0 +1,72 @@
+/*
+ * wait.h - Wait queues for blocking until an event
+ *
+ * A waiter is PROCESS_BLOCKED and off the run queue until wake_up() is
+ * called on its queue, typically from an interrupt handler:
+ *
+ *     wait_event(kbd_wait, kbd_head != kbd_tail);    (reader)
+ *     wake_up(&kbd_wait);                             (IRQ handler)
+ *
+ * The condition is re-checked under the wait queue lock with interrupts
+ * disabled, so a wakeup between the check and the block cannot be lost,
+ * whichever CPU it comes from.
+ */
+
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <stdint.h>
+
+struct process;
+struct spinlock;
+
+typedef struct wait_entry {
+    struct process *task;
+    struct wait_entry *next;
+    struct wait_entry *prev;
+} wait_entry_t;
+
+typedef struct wait_queue {
+    wait_entry_t *head;
+    wait_entry_t *tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { 0, 0 }
+
+void wait_queue_init(wait_queue_t *q);
+
+/* Block on q once; call inside wait_irq_save(), returns the same way.
+ * Before the scheduler runs it halts until any interrupt. */
+void wait_sleep(wait_queue_t *q);
+
+/* Like wait_sleep, also woken at deadline_ns (clock_ns time) */
+void wait_sleep_until(wait_queue_t *q, uint64_t deadline_ns);
+
+/* Like wait_sleep for a caller holding lock: the task is queued before
+ * lock is dropped, and lock is held again on return */
+void wait_sleep_locked(wait_queue_t *q, struct spinlock *lock);
+
+/* Wake every waiter on q (safe from interrupt context) */
+void wake_up(wait_queue_t *q);
+
+/* Wake the longest waiter on q */
+void wake_up_one(wait_queue_t *q);
+
+/* Drop a killed task's entry from whatever queue it waits on */
+void wait_abort(struct process *p);
+
+/* Take the wait queue lock with interrupts disabled */
+uint32_t wait_irq_save(void);
+void wait_irq_restore(uint32_t flags);
+
+/* Block until condition is true */
+#define wait_event(wq, condition)                   \
+    do {                                            \
+        uint32_t wait_flags_ = wait_irq_save();     \
+        while (!(condition)) {                      \
+            wait_sleep(&(wq));                      \
+        }                                           \
+        wait_irq_restore(wait_flags_);              \
+    } while (0)
+
+#endif /* WAIT_H */
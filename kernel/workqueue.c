@@ -0,0 +1,71 @@
+/*
+ * workqueue.c - Kernel worker threads for deferred work that may sleep
+ *
+ * One FIFO shared by every worker. pending is cleared just before an
+ * item runs, so it can queue itself again from its own function.
+ */
+
+#include "workqueue.h"
+
+#include "process.h"
+#include "sync.h"
+#include "wait.h"
+
+static spinlock_t work_lock = SPINLOCK_INIT;
+static work_t *work_head;
+static work_t *work_tail;
+
+/* Idle workers */
+static wait_queue_t work_wait = WAIT_QUEUE_INIT;
+
+int work_queue(work_t *w) {
+    uint32_t flags = spin_lock_irqsave(&work_lock);
+    if (w->pending) {
+        spin_unlock_irqrestore(&work_lock, flags);
+        return -1;
+    }
+    w->pending = 1;
+    w->next = 0;
+    if (work_tail) {
+        work_tail->next = w;
+    } else {
+        work_head = w;
+    }
+    work_tail = w;
+    spin_unlock_irqrestore(&work_lock, flags);
+
+    wake_up_one(&work_wait);
+    return 0;
+}
+
+static work_t *work_take(void) {
+    uint32_t flags = spin_lock_irqsave(&work_lock);
+    work_t *w = work_head;
+    if (w) {
+        work_head = w->next;
+        if (!work_head) {
+            work_tail = 0;
+        }
+        w->pending = 0;
+    }
+    spin_unlock_irqrestore(&work_lock, flags);
+    return w;
+}
+
+static void worker_main(void) {
+    for (;;) {
+        wait_event(work_wait, work_head != 0);
+        work_t *w = work_take();
+        if (w) {
+            w->fn(w->arg);
+        }
+    }
+}
+
+void workqueue_init(void) {
+    char name[] = "kworker0";
+    for (int i = 0; i < WORKQUEUE_THREADS; i++) {
+        name[7] = (char)('0' + i);
+        process_create(name, worker_main);
+    }
+}
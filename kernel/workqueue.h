@@ -0,0 +1,33 @@
+/*
+ * workqueue.h - Kernel worker threads for deferred work that may sleep
+ *
+ * Interrupt handlers, softirqs and code holding spinlocks queue work
+ * here when it needs a task context: taking the fs mutex, waiting on the
+ * disk or simply taking long. Items run in queueing order on whichever
+ * worker thread is free.
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+
+#define WORKQUEUE_THREADS 2
+
+typedef struct work {
+    struct work *next;
+    void (*fn)(void *arg);
+    void *arg;
+    volatile uint32_t pending;      /* Queued and not yet started */
+} work_t;
+
+#define WORK_INIT(fn, arg) { 0, (fn), (arg), 0 }
+
+/* Start the worker threads; work queued before then waits for them */
+void workqueue_init(void);
+
+/* Run w->fn(w->arg) on a worker thread; safe from any context. Returns
+ * 0, or -1 if w is still waiting from an earlier call. */
+int work_queue(work_t *w);
+
+#endif /* WORKQUEUE_H */
@@ -0,0 +1,37 @@
+#!/bin/sh
+# mksyms.sh - Kernel symbol table for the profiler
+#
+# Reads `nm -n kernel.elf` on stdin and writes C for the .ksyms section:
+# every text symbol's address and the offset of its name in one string.
+# Empty input gives an empty table, for the first link.
+
+awk '
+BEGIN {
+    print "/* Generated by tools/mksyms.sh; do not edit */"
+    print ""
+    print "#include \"ksyms.h\""
+    print ""
+    print "__attribute__((section(\".ksyms\"))) const ksym_t ksyms[] = {"
+    n = 0
+    off = 0
+}
+($2 == "T" || $2 == "t") && $3 != "_text_end" {
+    printf "    { 0x%su, %du },\n", $1, off
+    names[n++] = $3
+    off += length($3) + 1
+}
+END {
+    if (n == 0) {
+        print "    { 0, 0 },"
+    }
+    print "};"
+    print ""
+    printf "__attribute__((section(\".ksyms\"))) const uint32_t ksym_count = %du;\n", n
+    print ""
+    print "__attribute__((section(\".ksyms\"))) const char ksym_names[] ="
+    for (i = 0; i < n; i++) {
+        printf "    \"%s\\0\"\n", names[i]
+    }
+    print "    \"\";"
+}
+'
@@ -0,0 +1,545 @@
+/*
+ * osufs.c - Host-side image tool for the OsU FAT16 volume
+ *
+ * Usage:
+ *   osufs mkfs IMAGE               format the volume at sector FAT_LBA_START
+ *   osufs put IMAGE FILE...        copy host files into the root directory
+ *   osufs get IMAGE NAME OUT       copy a root directory file to the host
+ *   osufs ls IMAGE                 list the root directory
+ *   osufs fsck [-f] IMAGE          check for leaked/cross-linked clusters
+ *                                  (-f frees leaked clusters)
+ *
+ * The whole volume is loaded into memory, edited, and written back, so the
+ * kernel never has to run fat_format() on a freshly built image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../kernel/fs.h"
+#include "../kernel/fs_layout.h"
+#include "../kernel/journal.h"
+
+#define VOLUME_BYTES (FAT_TOTAL_SECTORS * 512u)
+#define DIR_ENTRIES_PER_CLUSTER (512u / sizeof(fat_dir_entry_t))
+
+static uint8_t *volume;
+static const char *image_path;
+
+static uint8_t *sector(uint32_t rel) {
+    return volume + (size_t)rel * 512u;
+}
+
+static uint8_t *fat(void) {
+    return sector(FAT_RESERVED_SECTORS);
+}
+
+static fat_dir_entry_t *root(void) {
+    return (fat_dir_entry_t *)sector(FAT_RESERVED_SECTORS + FAT_FAT_COUNT * FAT_SECTORS_PER_FAT);
+}
+
+static uint8_t *cluster(uint16_t c) {
+    return sector(FAT_FIRST_DATA_SECTOR + (uint32_t)(c - FAT_CLUSTER_MIN) * FAT_SECTORS_PER_CLUSTER);
+}
+
+static uint16_t fat_get(uint16_t c) {
+    uint8_t *f = fat();
+    return (uint16_t)(f[c * 2u] | (f[c * 2u + 1] << 8));
+}
+
+static void fat_set(uint16_t c, uint16_t v) {
+    uint8_t *f = fat();
+    f[c * 2u] = (uint8_t)(v & 0xFF);
+    f[c * 2u + 1] = (uint8_t)(v >> 8);
+}
+
+static int is_data_cluster(uint16_t c) {
+    return c >= FAT_CLUSTER_MIN && c <= FAT_CLUSTER_MAX;
+}
+
+static int load_volume(const char *path, int must_be_valid) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    volume = calloc(1, VOLUME_BYTES);
+    if (!volume) {
+        fclose(f);
+        return -1;
+    }
+
+    if (fseek(f, (long)FAT_LBA_START * 512L, SEEK_SET) != 0 ||
+        fread(volume, 1, VOLUME_BYTES, f) != VOLUME_BYTES) {
+        fprintf(stderr, "%s: image too small (need %u sectors)\n", path,
+                FAT_LBA_START + FAT_TOTAL_SECTORS);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    image_path = path;
+
+    if (must_be_valid) {
+        const fat16_boot_sector_t *bs = (const fat16_boot_sector_t *)sector(0);
+        if (bs->signature != 0xAA55 || bs->bytes_per_sector != 512 ||
+            bs->sectors_per_cluster != FAT_SECTORS_PER_CLUSTER ||
+            bs->reserved_sector_count != FAT_RESERVED_SECTORS ||
+            bs->num_fats != FAT_FAT_COUNT || bs->root_entry_count != FAT_ROOT_ENTRIES ||
+            bs->total_sectors_16 != FAT_TOTAL_SECTORS || bs->fat_size_16 != FAT_SECTORS_PER_FAT) {
+            fprintf(stderr, "%s: no OsU FAT16 volume at sector %u (run mkfs)\n", path, FAT_LBA_START);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int store_volume(void) {
+    FILE *f = fopen(image_path, "r+b");
+    if (!f) {
+        perror(image_path);
+        return -1;
+    }
+    if (fseek(f, (long)FAT_LBA_START * 512L, SEEK_SET) != 0 ||
+        fwrite(volume, 1, VOLUME_BYTES, f) != VOLUME_BYTES) {
+        fprintf(stderr, "%s: write failed\n", image_path);
+        fclose(f);
+        return -1;
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Same 8.3 rules as fat_name_from_input() in the kernel */
+static int make_fat_name(const char *in, char out[11]) {
+    memset(out, ' ', 11);
+    int len = 0;
+    int ext = -1;
+    for (const char *p = in; *p; p++) {
+        char c = *p;
+        if (c >= 'a' && c <= 'z') {
+            c = (char)(c - 32);
+        }
+        if (c == '.' && ext < 0) {
+            ext = 0;
+            continue;
+        }
+        if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '$')) {
+            return -1;
+        }
+        if (ext < 0) {
+            if (len >= 8) return -1;
+            out[len++] = c;
+        } else {
+            if (ext >= 3) return -1;
+            out[8 + ext++] = c;
+        }
+    }
+    return len > 0 ? 0 : -1;
+}
+
+static void print_name(const fat_dir_entry_t *e, char *out) {
+    int p = 0;
+    for (int i = 0; i < 8 && e->name[i] != ' '; i++) out[p++] = e->name[i];
+    if (e->ext[0] != ' ') {
+        out[p++] = '.';
+        for (int i = 0; i < 3 && e->ext[i] != ' '; i++) out[p++] = e->ext[i];
+    }
+    out[p] = '\0';
+}
+
+static void free_chain(uint16_t c) {
+    while (is_data_cluster(c)) {
+        uint16_t next = fat_get(c);
+        fat_set(c, 0);
+        if (next >= 0xFFF8 || next == 0) break;
+        c = next;
+    }
+}
+
+/* ---------------------------------------------------------------- mkfs */
+
+static int cmd_mkfs(const char *path) {
+    FILE *f = fopen(path, "r+b");
+    if (!f) {
+        f = fopen(path, "w+b");
+    }
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    /* Make sure the image covers the whole volume */
+    long need = (long)(FAT_LBA_START + FAT_TOTAL_SECTORS) * 512L;
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) < need) {
+        fseek(f, need - 1, SEEK_SET);
+        fputc(0, f);
+    }
+    fclose(f);
+
+    volume = calloc(1, VOLUME_BYTES);
+    if (!volume) return 1;
+    image_path = path;
+
+    fat16_boot_sector_t *bs = (fat16_boot_sector_t *)sector(0);
+    bs->jmp_boot[0] = 0xEB;
+    bs->jmp_boot[1] = 0x3C;
+    bs->jmp_boot[2] = 0x90;
+    memcpy(bs->oem_name, "MINIOS  ", 8);
+    bs->bytes_per_sector = 512;
+    bs->sectors_per_cluster = FAT_SECTORS_PER_CLUSTER;
+    bs->reserved_sector_count = FAT_RESERVED_SECTORS;
+    bs->num_fats = FAT_FAT_COUNT;
+    bs->root_entry_count = FAT_ROOT_ENTRIES;
+    bs->total_sectors_16 = FAT_TOTAL_SECTORS;
+    bs->media = 0xF8;
+    bs->fat_size_16 = FAT_SECTORS_PER_FAT;
+    bs->sectors_per_track = 63;
+    bs->num_heads = 16;
+    bs->hidden_sectors = FAT_LBA_START;
+    bs->drive_number = 0x80;
+    bs->boot_signature = 0x29;
+    bs->volume_id = 0x20260206;
+    memcpy(bs->volume_label, "OSUVOLUME  ", 11);
+    memcpy(bs->fs_type, "FAT16   ", 8);
+    bs->signature = 0xAA55;
+
+    journal_header_t *jh = (journal_header_t *)sector(1);
+    jh->magic = JOURNAL_MAGIC;
+
+    fat_set(0, 0xFFF8);
+    fat_set(1, FAT16_EOC);
+
+    if (store_volume() != 0) return 1;
+    printf("%s: formatted %u sectors at LBA %u, %u clusters\n", path,
+           FAT_TOTAL_SECTORS, FAT_LBA_START, FAT_CLUSTER_COUNT);
+    return 0;
+}
+
+/* ----------------------------------------------------------------- put */
+
+static uint16_t next_free = FAT_CLUSTER_MIN;
+
+static uint16_t alloc_cluster(void) {
+    for (uint16_t c = next_free; c <= FAT_CLUSTER_MAX; c++) {
+        if (fat_get(c) == 0) {
+            fat_set(c, FAT16_EOC);
+            next_free = (uint16_t)(c + 1);
+            return c;
+        }
+    }
+    return 0;
+}
+
+static int put_file(const char *host_path) {
+    const char *base = strrchr(host_path, '/');
+    base = base ? base + 1 : host_path;
+
+    char f11[11];
+    if (make_fat_name(base, f11) != 0) {
+        fprintf(stderr, "%s: not a valid 8.3 name\n", base);
+        return -1;
+    }
+
+    FILE *f = fopen(host_path, "rb");
+    if (!f) {
+        perror(host_path);
+        return -1;
+    }
+    static uint8_t data[FS_MAX_FILE_SIZE + 1];
+    size_t len = fread(data, 1, sizeof(data), f);
+    fclose(f);
+    if (len > FS_MAX_FILE_SIZE) {
+        fprintf(stderr, "%s: larger than %u bytes\n", host_path, FS_MAX_FILE_SIZE);
+        return -1;
+    }
+
+    fat_dir_entry_t *ent = root();
+    int slot = -1;
+    for (uint32_t i = 0; i < FS_MAX_FILES; i++) {
+        uint8_t lead = (uint8_t)ent[i].name[0];
+        if (lead == 0x00 || lead == 0xE5) {
+            if (slot < 0) slot = (int)i;
+            if (lead == 0x00) break;
+            continue;
+        }
+        if (memcmp(ent[i].name, f11, 11) == 0) {
+            if (ent[i].attr & FS_ATTR_DIRECTORY) {
+                fprintf(stderr, "%s: is a directory in the image\n", base);
+                return -1;
+            }
+            free_chain(ent[i].fst_clus_lo);
+            slot = (int)i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        fprintf(stderr, "%s: root directory full\n", base);
+        return -1;
+    }
+
+    uint16_t first = 0;
+    uint16_t prev = 0;
+    for (size_t off = 0; off < len; off += 512) {
+        uint16_t c = alloc_cluster();
+        if (c == 0) {
+            fprintf(stderr, "%s: volume full\n", base);
+            free_chain(first);
+            return -1;
+        }
+        if (prev) fat_set(prev, c);
+        if (!first) first = c;
+        size_t take = len - off < 512 ? len - off : 512;
+        memset(cluster(c), 0, 512);
+        memcpy(cluster(c), data + off, take);
+        prev = c;
+    }
+
+    memset(&ent[slot], 0, sizeof(ent[slot]));
+    memcpy(ent[slot].name, f11, 8);
+    memcpy(ent[slot].ext, f11 + 8, 3);
+    ent[slot].attr = FAT_ATTR_ARCHIVE;
+    ent[slot].fst_clus_lo = first;
+    ent[slot].file_size = (uint32_t)len;
+    return 0;
+}
+
+static int cmd_put(const char *path, int argc, char **argv) {
+    if (load_volume(path, 1) != 0) return 1;
+    int failed = 0;
+    for (int i = 0; i < argc; i++) {
+        if (put_file(argv[i]) != 0) failed = 1;
+    }
+    if (store_volume() != 0) return 1;
+    return failed;
+}
+
+/* ----------------------------------------------------------------- get */
+
+static int cmd_get(const char *path, const char *name, const char *out) {
+    if (load_volume(path, 1) != 0) return 1;
+
+    char f11[11];
+    if (make_fat_name(name, f11) != 0) {
+        fprintf(stderr, "%s: not a valid 8.3 name\n", name);
+        return 1;
+    }
+
+    fat_dir_entry_t *ent = root();
+    for (uint32_t i = 0; i < FS_MAX_FILES; i++) {
+        uint8_t lead = (uint8_t)ent[i].name[0];
+        if (lead == 0x00) break;
+        if (lead == 0xE5 || ent[i].attr == 0x0F || memcmp(ent[i].name, f11, 11) != 0) continue;
+        if (ent[i].attr & FS_ATTR_DIRECTORY) {
+            fprintf(stderr, "%s: is a directory in the image\n", name);
+            return 1;
+        }
+
+        FILE *f = fopen(out, "wb");
+        if (!f) {
+            perror(out);
+            return 1;
+        }
+        uint32_t left = ent[i].file_size;
+        for (uint16_t c = ent[i].fst_clus_lo; left > 0 && is_data_cluster(c); c = fat_get(c)) {
+            uint32_t take = left < 512 ? left : 512;
+            fwrite(cluster(c), 1, take, f);
+            left -= take;
+        }
+        if (fclose(f) != 0 || left > 0) {
+            fprintf(stderr, "%s: short chain or write failed\n", name);
+            return 1;
+        }
+        return 0;
+    }
+
+    fprintf(stderr, "%s: not found\n", name);
+    return 1;
+}
+
+/* ------------------------------------------------------------------ ls */
+
+static int cmd_ls(const char *path) {
+    if (load_volume(path, 1) != 0) return 1;
+    fat_dir_entry_t *ent = root();
+    for (uint32_t i = 0; i < FS_MAX_FILES; i++) {
+        uint8_t lead = (uint8_t)ent[i].name[0];
+        if (lead == 0x00) break;
+        if (lead == 0xE5 || ent[i].attr == 0x0F) continue;
+        char name[FS_MAX_NAME + 1];
+        print_name(&ent[i], name);
+        if (ent[i].attr & FS_ATTR_DIRECTORY) {
+            printf("%-12s  <DIR>\n", name);
+        } else {
+            printf("%-12s  %u\n", name, ent[i].file_size);
+        }
+    }
+    return 0;
+}
+
+/* ---------------------------------------------------------------- fsck */
+
+static uint16_t *owner;     /* Per cluster: 1-based id of the entry using it */
+static unsigned errors;
+static unsigned entry_ids;
+
+static void check_chain(const char *path, uint16_t first, uint32_t size, int is_dir, uint16_t id);
+
+static void check_dir(const char *path, const fat_dir_entry_t *ent, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t lead = (uint8_t)ent[i].name[0];
+        if (lead == 0x00) break;
+        if (lead == 0xE5 || ent[i].attr == 0x0F || lead == '.') continue;
+
+        char name[FS_MAX_NAME + 1];
+        char child[FS_MAX_PATH + FS_MAX_NAME + 2];
+        print_name(&ent[i], name);
+        snprintf(child, sizeof(child), "%s/%s", path, name);
+
+        int is_dir = (ent[i].attr & FS_ATTR_DIRECTORY) != 0;
+        uint16_t first = ent[i].fst_clus_lo;
+        if (first == 0) {
+            if (is_dir || ent[i].file_size != 0) {
+                printf("%s: size %u but no clusters\n", child, ent[i].file_size);
+                errors++;
+            }
+            continue;
+        }
+        check_chain(child, first, ent[i].file_size, is_dir, (uint16_t)++entry_ids);
+    }
+}
+
+static void check_chain(const char *path, uint16_t first, uint32_t size, int is_dir, uint16_t id) {
+    uint32_t n = 0;
+    uint16_t c = first;
+    while (1) {
+        if (!is_data_cluster(c)) {
+            printf("%s: chain points outside the data area (%u)\n", path, c);
+            errors++;
+            return;
+        }
+        if (owner[c]) {
+            if (owner[c] == id) {
+                printf("%s: chain loops at cluster %u\n", path, c);
+            } else {
+                printf("%s: cluster %u is cross-linked\n", path, c);
+            }
+            errors++;
+            return;
+        }
+        owner[c] = id;
+        n++;
+
+        uint16_t next = fat_get(c);
+        if (next == 0) {
+            printf("%s: chain runs into free cluster after %u\n", path, c);
+            errors++;
+            return;
+        }
+        if (next >= 0xFFF8) break;
+        c = next;
+    }
+
+    if (is_dir) {
+        check_dir(path, (const fat_dir_entry_t *)cluster(first), DIR_ENTRIES_PER_CLUSTER);
+        return;
+    }
+
+    uint32_t need = (size + 511u) / 512u;
+    if (n != need) {
+        printf("%s: size %u needs %u clusters, chain has %u\n", path, size, need, n);
+        errors++;
+    }
+}
+
+static int cmd_fsck(const char *path, int fix) {
+    if (load_volume(path, 1) != 0) return 1;
+
+    const journal_header_t *jh = (const journal_header_t *)sector(1);
+    if (jh->magic != JOURNAL_MAGIC) {
+        printf("journal: not initialised (kernel creates it at mount)\n");
+    } else if (jh->count > 0 && jh->count <= JOURNAL_MAX_BLOCKS &&
+               journal_checksum(jh, sector(2)) == jh->checksum) {
+        printf("journal: committed transaction %u pending (%u blocks), replayed at next mount\n",
+               jh->sequence, jh->count);
+    } else if (jh->count > 0) {
+        printf("journal: torn transaction %u, discarded at next mount\n", jh->sequence);
+    }
+
+    owner = calloc(FAT_CLUSTER_MAX + 1u, sizeof(uint16_t));
+    if (!owner) return 1;
+
+    if (fat_get(0) != 0xFFF8 || fat_get(1) != FAT16_EOC) {
+        printf("FAT: reserved entries damaged\n");
+        errors++;
+    }
+
+    check_dir("", root(), FAT_ROOT_ENTRIES);
+
+    unsigned leaked = 0;
+    unsigned used = 0;
+    for (uint16_t c = FAT_CLUSTER_MIN; c <= FAT_CLUSTER_MAX; c++) {
+        if (fat_get(c) == 0) continue;
+        if (owner[c]) {
+            used++;
+            continue;
+        }
+        leaked++;
+        if (fix) fat_set(c, 0);
+    }
+    if (leaked) {
+        printf("%u leaked cluster(s)%s\n", leaked, fix ? " freed" : "");
+        if (!fix) errors++;
+    }
+
+    printf("%s: %u entries, %u/%u clusters in use, %u error(s)\n", path, entry_ids, used,
+           FAT_CLUSTER_COUNT, errors);
+
+    if (fix && leaked && store_volume() != 0) return 1;
+    return errors ? 2 : 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: osufs mkfs IMAGE\n"
+            "       osufs put IMAGE FILE...\n"
+            "       osufs get IMAGE NAME OUT\n"
+            "       osufs ls IMAGE\n"
+            "       osufs fsck [-f] IMAGE\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+
+    const char *cmd = argv[1];
+    if (strcmp(cmd, "mkfs") == 0) {
+        return cmd_mkfs(argv[2]);
+    }
+    if (strcmp(cmd, "put") == 0) {
+        return cmd_put(argv[2], argc - 3, argv + 3);
+    }
+    if (strcmp(cmd, "get") == 0) {
+        if (argc < 5) {
+            usage();
+            return 1;
+        }
+        return cmd_get(argv[2], argv[3], argv[4]);
+    }
+    if (strcmp(cmd, "ls") == 0) {
+        return cmd_ls(argv[2]);
+    }
+    if (strcmp(cmd, "fsck") == 0) {
+        int fix = strcmp(argv[2], "-f") == 0;
+        if (fix && argc < 4) {
+            usage();
+            return 1;
+        }
+        return cmd_fsck(argv[fix ? 3 : 2], fix);
+    }
+
+    usage();
+    return 1;
+}
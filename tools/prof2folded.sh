@@ -0,0 +1,20 @@
+#!/bin/sh
+# prof2folded.sh - Fold a "prof dump" file for flame graph tools
+#
+#   build/osufs get build/os.img PROF.BIN prof.bin
+#   tools/prof2folded.sh prof.bin | flamegraph.pl > prof.svg
+#
+# Samples hold only the interrupted EIP, so each stack is one frame deep:
+# "kernel;function count", or "user count" outside kernel text.
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 DUMP [KERNEL_ELF]" >&2
+    exit 1
+fi
+ELF=${2:-build/kernel.elf}
+ADDR2LINE=${ADDR2LINE:-addr2line}
+
+od -An -v -tx4 "$1" | tr -s ' ' '\n' | grep -v '^$' | sed 's/^/0x/' |
+    "$ADDR2LINE" -f -e "$ELF" | awk 'NR % 2 == 1' |
+    sed 's/^??$/user/; t; s/^/kernel;/' | sort | uniq -c |
+    awk '{ print $2, $1 }'
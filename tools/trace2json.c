@@ -0,0 +1,251 @@
+/*
+ * trace2json.c - Convert "trace dump" files to Chrome trace JSON
+ *
+ * Usage:
+ *   trace2json FILE... > trace.json    (load in chrome://tracing or Perfetto)
+ *
+ * Records from every file are merged and sorted by TSC. Begin and end
+ * events are paired per task into complete events on that task's track,
+ * so a disk command or syscall that blocks spans the time the task was
+ * switched out. An IRQ is charged to the task it interrupted and ends at
+ * its exit, or at a task switch made from inside it. Context switches
+ * appear as instant events on a track per CPU. Events whose begin was
+ * overwritten in the ring are dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../kernel/trace.h"
+
+#define STACK_MAX 16
+
+typedef struct {
+    trace_rec_t rec;
+    size_t order;           /* Position read, to keep equal TSCs in order */
+} event_t;
+
+typedef struct {
+    uint8_t event;          /* Begin event */
+    uint8_t cpu;
+    uint32_t arg;
+    uint64_t tsc;
+} frame_t;
+
+typedef struct {
+    frame_t frame[STACK_MAX];
+    int depth;
+} task_stack_t;
+
+static event_t *events;
+static size_t event_count;
+static size_t event_cap;
+static uint32_t tsc_khz;
+static uint64_t tsc_zero;
+static task_stack_t *stacks[65536];
+static int cpu_seen[256];
+static int first_line = 1;
+
+static const char *fs_ops[] = {
+    "create", "remove", "read", "write", "mkdir", "rmdir", "commit", "read page",
+};
+
+static int load_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    trace_rec_t rec;
+    if (fread(&rec, sizeof(rec), 1, f) != 1 || rec.event != TRACE_HEADER || rec.pid != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a trace dump\n", path);
+        fclose(f);
+        return -1;
+    }
+    if (rec.arg) tsc_khz = rec.arg;
+
+    while (fread(&rec, sizeof(rec), 1, f) == 1) {
+        if (event_count == event_cap) {
+            event_cap = event_cap ? event_cap * 2 : 1024;
+            events = realloc(events, event_cap * sizeof(*events));
+            if (!events) {
+                fclose(f);
+                return -1;
+            }
+        }
+        events[event_count].rec = rec;
+        events[event_count].order = event_count;
+        event_count++;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int by_time(const void *a, const void *b) {
+    const event_t *x = a;
+    const event_t *y = b;
+    if (x->rec.tsc != y->rec.tsc) return x->rec.tsc < y->rec.tsc ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static double usec(uint64_t tsc) {
+    return (double)(tsc - tsc_zero) * 1000.0 / (double)tsc_khz;
+}
+
+static void emit(const char *line) {
+    printf("%s\n%s", first_line ? "" : ",", line);
+    first_line = 0;
+}
+
+static void complete(uint16_t pid, const frame_t *b, uint64_t end_tsc, uint32_t result) {
+    char name[32];
+    char args[96];
+    switch (b->event) {
+    case TRACE_IRQ_ENTER:
+        snprintf(name, sizeof(name), "irq %u", b->arg);
+        snprintf(args, sizeof(args), "\"cpu\":%u", b->cpu);
+        break;
+    case TRACE_SYSCALL_ENTER:
+        snprintf(name, sizeof(name), "syscall %u", b->arg);
+        snprintf(args, sizeof(args), "\"cpu\":%u,\"ret\":%d", b->cpu, (int)result);
+        break;
+    case TRACE_DISK_READ:
+    case TRACE_DISK_WRITE:
+        snprintf(name, sizeof(name), "disk %s", b->event == TRACE_DISK_READ ? "read" : "write");
+        snprintf(args, sizeof(args), "\"cpu\":%u,\"lba\":%u,\"ret\":%d", b->cpu, b->arg, (int)result);
+        break;
+    default:
+        snprintf(name, sizeof(name), "fs %s",
+                 b->arg < sizeof(fs_ops) / sizeof(fs_ops[0]) ? fs_ops[b->arg] : "?");
+        snprintf(args, sizeof(args), "\"cpu\":%u,\"ret\":%d", b->cpu, (int)result);
+        break;
+    }
+
+    char line[256];
+    snprintf(line, sizeof(line),
+             "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u,\"args\":{%s}}",
+             name, usec(b->tsc), usec(end_tsc) - usec(b->tsc), pid, args);
+    emit(line);
+}
+
+static task_stack_t *stack_of(uint16_t pid) {
+    if (!stacks[pid]) {
+        stacks[pid] = calloc(1, sizeof(task_stack_t));
+        if (!stacks[pid]) exit(1);
+    }
+    return stacks[pid];
+}
+
+static void begin(const trace_rec_t *r) {
+    task_stack_t *s = stack_of(r->pid);
+    if (s->depth == STACK_MAX) return;
+    frame_t *b = &s->frame[s->depth++];
+    b->event = r->event;
+    b->cpu = r->cpu;
+    b->arg = r->arg;
+    b->tsc = r->tsc;
+}
+
+static int matches(uint8_t begin_event, const trace_rec_t *end) {
+    switch (end->event) {
+    case TRACE_IRQ_EXIT:
+        return begin_event == TRACE_IRQ_ENTER;
+    case TRACE_SYSCALL_EXIT:
+        return begin_event == TRACE_SYSCALL_ENTER;
+    case TRACE_DISK_END:
+        return begin_event == TRACE_DISK_READ || begin_event == TRACE_DISK_WRITE;
+    default:
+        return begin_event == TRACE_FS_BEGIN;
+    }
+}
+
+/* Close the innermost matching begin; anything opened inside it whose
+ * end was lost goes with it */
+static void end(const trace_rec_t *r) {
+    task_stack_t *s = stack_of(r->pid);
+    int i = s->depth - 1;
+    while (i >= 0 && !matches(s->frame[i].event, r)) i--;
+    if (i < 0) return;
+    if (r->event == TRACE_IRQ_EXIT && s->frame[i].arg != r->arg) return;
+    complete(r->pid, &s->frame[i], r->tsc, r->arg);
+    s->depth = i;
+}
+
+/* The interrupt handler the old task switched away in ends here */
+static void switched(const trace_rec_t *r) {
+    char line[256];
+    snprintf(line, sizeof(line),
+             "{\"name\":\"switch\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,"
+             "\"args\":{\"from\":%u,\"to\":%u}}",
+             usec(r->tsc), r->cpu, r->arg, r->pid);
+    emit(line);
+
+    task_stack_t *s = stack_of((uint16_t)r->arg);
+    while (s->depth > 0 && s->frame[s->depth - 1].event == TRACE_IRQ_ENTER) {
+        s->depth--;
+        complete((uint16_t)r->arg, &s->frame[s->depth], r->tsc, 0);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: trace2json FILE... > trace.json\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (load_file(argv[i]) != 0) return 1;
+    }
+    if (event_count == 0) {
+        fprintf(stderr, "no events\n");
+        return 1;
+    }
+    if (!tsc_khz) {
+        fprintf(stderr, "TSC rate unknown; timestamps assume 1 GHz\n");
+        tsc_khz = 1000000;
+    }
+
+    qsort(events, event_count, sizeof(*events), by_time);
+    tsc_zero = events[0].rec.tsc;
+
+    printf("{\"traceEvents\":[");
+    emit("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"tasks\"}}");
+    emit("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"cpus\"}}");
+
+    for (size_t i = 0; i < event_count; i++) {
+        const trace_rec_t *r = &events[i].rec;
+        if (!cpu_seen[r->cpu]) {
+            char line[128];
+            snprintf(line, sizeof(line),
+                     "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"cpu %u\"}}",
+                     r->cpu, r->cpu);
+            emit(line);
+            cpu_seen[r->cpu] = 1;
+        }
+
+        switch (r->event) {
+        case TRACE_SCHED_SWITCH:
+            switched(r);
+            break;
+        case TRACE_IRQ_ENTER:
+        case TRACE_SYSCALL_ENTER:
+        case TRACE_DISK_READ:
+        case TRACE_DISK_WRITE:
+        case TRACE_FS_BEGIN:
+            begin(r);
+            break;
+        case TRACE_IRQ_EXIT:
+        case TRACE_SYSCALL_EXIT:
+        case TRACE_DISK_END:
+        case TRACE_FS_END:
+            end(r);
+            break;
+        default:
+            break;
+        }
+    }
+
+    printf("\n]}\n");
+    return 0;
+}
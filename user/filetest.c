@@ -0,0 +1,60 @@
+/* filetest.c - Descriptors: open, writev, lseek, read, stat, readdir */
+
+#include "ulib.h"
+
+#define NAME "fdtest.txt"
+
+static int fail(const char *what) {
+    puts(what);
+    puts(" failed\n");
+    return 1;
+}
+
+int main(void) {
+    int fd = open(NAME, O_RDWR | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        return fail("open");
+    }
+
+    /* Three pieces, one kernel entry */
+    iovec_t iov[3] = {
+        { "one ", 4 },
+        { "two ", 4 },
+        { "three\n", 6 },
+    };
+    if (writev(fd, iov, 3) != 14) {
+        return fail("writev");
+    }
+
+    char buf[32];
+    if (lseek(fd, 4, SEEK_SET) != 4) {
+        return fail("lseek");
+    }
+    int n = read(fd, buf, sizeof(buf));
+    if (n != 10) {
+        return fail("read");
+    }
+    puts("read back: ");
+    write(1, buf, (size_t)n);
+    close(fd);
+
+    stat_t st;
+    if (stat(NAME, &st) != 0 || st.size != 14) {
+        return fail("stat");
+    }
+
+    int dir = open(".", O_RDONLY);
+    if (dir < 0) {
+        return fail("open .");
+    }
+    dirent_t ent;
+    while (readdir(dir, &ent) == 1) {
+        iovec_t line[2] = {
+            { ent.name, strlen(ent.name) },
+            { ent.is_dir ? "/\n" : "\n", ent.is_dir ? 2 : 1 },
+        };
+        writev(1, line, 2);
+    }
+    close(dir);
+    return 0;
+}
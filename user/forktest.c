@@ -0,0 +1,44 @@
+/* forktest.c - fork, copy-on-write, wait and exec */
+
+#include "ulib.h"
+
+#define CHILDREN 3
+
+static int counter = 100;
+
+int main(void) {
+    for (int i = 0; i < CHILDREN; i++) {
+        int pid = fork();
+        if (pid == 0) {
+            /* Writes land in the child's own copy of the page */
+            counter += i + 1;
+            puts("child ");
+            put_dec(getpid());
+            puts(": counter = ");
+            put_dec(counter);
+            puts("\n");
+            return i + 1;
+        }
+        if (pid < 0) {
+            puts("fork failed\n");
+            return 1;
+        }
+    }
+
+    int status;
+    int pid;
+    while ((pid = wait(-1, &status)) > 0) {
+        puts("parent: child ");
+        put_dec(pid);
+        puts(" exited with ");
+        put_dec(status);
+        puts("\n");
+    }
+    puts("parent: counter = ");
+    put_dec(counter);
+    puts(" (unchanged)\n");
+
+    exec("hello");
+    puts("exec failed\n");
+    return 1;
+}
@@ -0,0 +1,10 @@
+/* hello.c - Smallest user program */
+
+#include "ulib.h"
+
+int main(void) {
+    puts("Hello from user space, pid ");
+    put_dec(getpid());
+    puts("\n");
+    return 0;
+}
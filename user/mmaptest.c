@@ -0,0 +1,42 @@
+/* mmaptest.c - Read a file through a mapping of its cached page */
+
+#include "ulib.h"
+
+#define NAME "map.txt"
+
+static const char text[] = "mapped files share the page cache\nno read() copies\n";
+
+int main(void) {
+    int fd = open(NAME, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0 || write(fd, text, sizeof(text) - 1) != (int)sizeof(text) - 1) {
+        puts("write failed\n");
+        return 1;
+    }
+    close(fd);
+
+    char *map = mmap(NAME, 0);
+    if (map == (char *)-1) {
+        puts("mmap failed\n");
+        return 1;
+    }
+    int lines = 0;
+    for (size_t i = 0; i < sizeof(text) - 1; i++) {
+        lines += map[i] == '\n';
+    }
+    write(1, map, sizeof(text) - 1);
+    puts("lines: ");
+    put_dec(lines);
+    puts("\n");
+    munmap(map);
+
+    /* A private writable mapping: the file keeps its contents */
+    char *copy = mmap(NAME, MAP_WRITE);
+    if (copy == (char *)-1) {
+        puts("mmap failed\n");
+        return 1;
+    }
+    copy[0] = 'M';
+    char *again = mmap(NAME, 0);
+    puts(again[0] == 'm' && copy[0] == 'M' ? "private copy ok\n" : "private copy leaked\n");
+    return 0;
+}
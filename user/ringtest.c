@@ -0,0 +1,62 @@
+/* ringtest.c - Many small writes and reads through one submission ring */
+
+#include "ulib.h"
+
+#define ENTRIES 16
+#define NAME    "ring.txt"
+
+static uint32_t ring_mem[RING_BYTES(ENTRIES) / 4 + 1];
+
+static const char *const lines[] = {
+    "alpha\n", "bravo\n", "charlie\n", "delta\n", "echo\n", "foxtrot\n",
+};
+#define LINES (int)(sizeof(lines) / sizeof(lines[0]))
+
+int main(void) {
+    ring_t *ring = (ring_t *)ring_mem;
+    if (ring_setup(ring, ENTRIES) != 0) {
+        puts("ring_setup failed\n");
+        return 1;
+    }
+
+    int fd = open(NAME, O_RDWR | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        puts("open failed\n");
+        return 1;
+    }
+
+    /* Every line to the file and the console, in one kernel entry */
+    for (int i = 0; i < LINES; i++) {
+        ring_push(ring, RING_OP_WRITE, fd, lines[i], strlen(lines[i]), (uint32_t)i);
+        ring_push(ring, RING_OP_WRITE, 1, lines[i], strlen(lines[i]), (uint32_t)i);
+    }
+    int n = ring_enter(ENTRIES);
+
+    int bytes = 0;
+    ring_cqe_t cqe;
+    while (ring_pop(ring, &cqe)) {
+        if (cqe.res < 0) {
+            puts("request failed\n");
+            return 1;
+        }
+        bytes += cqe.res;
+    }
+    puts("ring: ");
+    put_dec(n);
+    puts(" requests, ");
+    put_dec(bytes);
+    puts(" bytes in one entry\n");
+
+    /* Read it back the same way */
+    char buf[64];
+    lseek(fd, 0, SEEK_SET);
+    ring_push(ring, RING_OP_READ, fd, buf, sizeof(buf), 0);
+    ring_enter(1);
+    if (!ring_pop(ring, &cqe) || cqe.res <= 0) {
+        puts("read failed\n");
+        return 1;
+    }
+    write(1, buf, (size_t)cqe.res);
+    close(fd);
+    return 0;
+}
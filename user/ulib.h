@@ -0,0 +1,192 @@
+/*
+ * ulib.h - Syscall wrappers and helpers for user programs
+ *
+ * Each program is a single file that includes this and defines main();
+ * _start runs it and exits with its return value. Syscalls go through
+ * SYSENTER when the CPU has it (the kernel then enables it too) and
+ * through int 0x80 otherwise.
+ */
+
+#ifndef ULIB_H
+#define ULIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "syscall.h"
+
+static int ulib_sysenter;
+
+static inline int syscall3(uint32_t n, uint32_t a, uint32_t b, uint32_t c) {
+    int ret;
+    if (ulib_sysenter) {
+        /* The kernel resumes at ESI with the stack pointer from EBP */
+        __asm__ volatile("push %%ebp\n\t"
+                         "mov %%esp, %%ebp\n\t"
+                         "lea 1f, %%esi\n\t"
+                         "sysenter\n"
+                         "1:\n\t"
+                         "pop %%ebp"
+                         : "=a"(ret), "+c"(b), "+d"(c)
+                         : "a"(n), "b"(a)
+                         : "esi", "memory");
+    } else {
+        __asm__ volatile("int $0x80"
+                         : "=a"(ret)
+                         : "a"(n), "b"(a), "c"(b), "d"(c)
+                         : "memory");
+    }
+    return ret;
+}
+
+static inline __attribute__((noreturn)) void exit(int status) {
+    syscall3(SYS_EXIT, (uint32_t)status, 0, 0);
+    for (;;) {
+    }
+}
+
+static inline int write(int fd, const void *buf, size_t len) {
+    return syscall3(SYS_WRITE, (uint32_t)fd, (uint32_t)buf, len);
+}
+
+static inline int read(int fd, void *buf, size_t len) {
+    return syscall3(SYS_READ, (uint32_t)fd, (uint32_t)buf, len);
+}
+
+static inline int getpid(void) {
+    return syscall3(SYS_GETPID, 0, 0, 0);
+}
+
+static inline void sleep_ms(uint32_t ms) {
+    syscall3(SYS_SLEEP, ms, 0, 0);
+}
+
+static inline void yield(void) {
+    syscall3(SYS_YIELD, 0, 0, 0);
+}
+
+static inline int exec(const char *path) {
+    return syscall3(SYS_EXEC, (uint32_t)path, 0, 0);
+}
+
+static inline int fork(void) {
+    return syscall3(SYS_FORK, 0, 0, 0);
+}
+
+static inline int wait(int pid, int *status) {
+    return syscall3(SYS_WAIT, (uint32_t)pid, (uint32_t)status, 0);
+}
+
+static inline int open(const char *path, int flags) {
+    return syscall3(SYS_OPEN, (uint32_t)path, (uint32_t)flags, 0);
+}
+
+static inline int close(int fd) {
+    return syscall3(SYS_CLOSE, (uint32_t)fd, 0, 0);
+}
+
+static inline int lseek(int fd, int offset, int whence) {
+    return syscall3(SYS_LSEEK, (uint32_t)fd, (uint32_t)offset, (uint32_t)whence);
+}
+
+static inline int stat(const char *path, stat_t *st) {
+    return syscall3(SYS_STAT, (uint32_t)path, (uint32_t)st, 0);
+}
+
+static inline int readdir(int fd, dirent_t *ent) {
+    return syscall3(SYS_READDIR, (uint32_t)fd, (uint32_t)ent, 0);
+}
+
+static inline int writev(int fd, const iovec_t *iov, int count) {
+    return syscall3(SYS_WRITEV, (uint32_t)fd, (uint32_t)iov, (uint32_t)count);
+}
+
+/* Map a file; (void *)-1 on failure */
+static inline void *mmap(const char *path, int flags) {
+    return (void *)syscall3(SYS_MMAP, (uint32_t)path, (uint32_t)flags, 0);
+}
+
+static inline int munmap(void *addr) {
+    return syscall3(SYS_MUNMAP, (uint32_t)addr, 0, 0);
+}
+
+static inline int ring_setup(ring_t *ring, uint32_t entries) {
+    return syscall3(SYS_RING_SETUP, (uint32_t)ring, entries, 0);
+}
+
+static inline int ring_enter(uint32_t to_submit) {
+    return syscall3(SYS_RING_ENTER, to_submit, 0, 0);
+}
+
+/* Queue a request; -1 if the submission queue is full */
+static inline int ring_push(ring_t *ring, uint32_t op, int fd, const void *addr, uint32_t len,
+                            uint32_t user_data) {
+    uint32_t tail = ring->sq_tail;
+    if (tail - ring->sq_head >= ring->entries) {
+        return -1;
+    }
+    ring_sqe_t *sqe = &RING_SQES(ring)[tail & (ring->entries - 1)];
+    sqe->op = op;
+    sqe->fd = fd;
+    sqe->addr = (uint32_t)addr;
+    sqe->len = len;
+    sqe->user_data = user_data;
+    __atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Take the oldest completion; 0 if there is none */
+static inline int ring_pop(ring_t *ring, ring_cqe_t *cqe) {
+    uint32_t head = ring->cq_head;
+    if (head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *cqe = RING_CQES(ring)[head & (ring->entries - 1)];
+    __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline size_t strlen(const char *s) {
+    size_t n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+static inline void puts(const char *s) {
+    write(1, s, strlen(s));
+}
+
+static inline void put_dec(int v) {
+    char buf[12];
+    int i = sizeof(buf);
+    uint32_t u = v < 0 ? (uint32_t)-v : (uint32_t)v;
+    do {
+        buf[--i] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0) {
+        buf[--i] = '-';
+    }
+    write(1, buf + i, sizeof(buf) - (size_t)i);
+}
+
+/* CPUID's SEP bit, which the first Pentium Pro steppings get wrong */
+static inline int cpu_has_sysenter(void) {
+    uint32_t a, b, c, d;
+    __asm__ volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+    if (((a >> 8) & 0xF) == 6 && ((a >> 4) & 0xF) < 3 && (a & 0xF) < 3) {
+        return 0;
+    }
+    return (d >> 11) & 1;
+}
+
+int main(void);
+
+__attribute__((section(".text.start"), used, noreturn)) void _start(void) {
+    ulib_sysenter = cpu_has_sysenter();
+    exit(main());
+}
+
+#endif /* ULIB_H */